@@ -19,9 +19,11 @@
  */
 
 #include <assert.h>
+#include <math.h>
 
 #include "gdi_private.h"
 #include "dibdrv.h"
+#include "winreg.h"
 
 #include "wine/debug.h"
 
@@ -552,11 +554,131 @@ static void copy_rect( dib_info *dst, const RECT *dst_rect, const dib_info *src,
     }
 }
 
+/* Large stretch and blend operations can optionally be split into bands of
+ * destination rows that are rendered in parallel on the thread pool.  Each
+ * band writes to its own set of rows, so the result is the same as when
+ * rendering everything on the calling thread. */
+
+#define MAX_BANDS       16
+#define BAND_MIN_PIXELS (256 * 1024)
+#define BAND_MIN_ROWS   32
+
+struct band_work
+{
+    void       (*func)( void *ctx, int band );
+    void        *ctx;
+    LONG         pending;
+    HANDLE       done;
+};
+
+struct band_task
+{
+    struct band_work *work;
+    int               band;
+};
+
+static int render_threads = -1;
+
+/* @@ Wine registry key: HKCU\Software\Wine\DIB Engine */
+static int get_render_threads(void)
+{
+    HKEY hkey;
+    DWORD value, type, count = sizeof(value);
+    SYSTEM_INFO info;
+    int threads = 0;
+
+    if (render_threads != -1) return render_threads;
+
+    if (!RegOpenKeyA( HKEY_CURRENT_USER, "Software\\Wine\\DIB Engine", &hkey ))
+    {
+        if (!RegQueryValueExA( hkey, "RenderThreads", NULL, &type, (BYTE *)&value, &count ) &&
+            type == REG_DWORD)
+            threads = min( value, MAX_BANDS );
+        RegCloseKey( hkey );
+    }
+    GetSystemInfo( &info );
+    threads = min( threads, info.dwNumberOfProcessors );
+    if (threads < 2) threads = 0;
+    TRACE( "using %d render threads\n", threads );
+    return render_threads = threads;
+}
+
+/* number of bands to use for an operation covering the given area */
+static int get_band_count( int width, int height )
+{
+    int threads = get_render_threads();
+
+    if (!threads || (LONGLONG)width * height < BAND_MIN_PIXELS) return 1;
+    return max( 1, min( threads, height / BAND_MIN_ROWS ));
+}
+
+static DWORD CALLBACK band_proc( void *arg )
+{
+    struct band_task *task = arg;
+    struct band_work *work = task->work;
+
+    work->func( work->ctx, task->band );
+    if (!InterlockedDecrement( &work->pending )) SetEvent( work->done );
+    return 0;
+}
+
+/* run func for bands 0 to count - 1, the first one on the calling thread */
+static void run_bands( void (*func)( void *ctx, int band ), void *ctx, int count )
+{
+    struct band_work work;
+    struct band_task tasks[MAX_BANDS];
+    int i;
+
+    if (count > 1 && !(work.done = CreateEventW( NULL, TRUE, FALSE, NULL ))) count = 1;
+    if (count <= 1)
+    {
+        for (i = 0; i < count; i++) func( ctx, i );
+        return;
+    }
+
+    work.func = func;
+    work.ctx = ctx;
+    work.pending = count - 1;
+    for (i = 1; i < count; i++)
+    {
+        tasks[i].work = &work;
+        tasks[i].band = i;
+        if (!QueueUserWorkItem( band_proc, &tasks[i], WT_EXECUTEDEFAULT )) band_proc( &tasks[i] );
+    }
+    func( ctx, 0 );
+    WaitForSingleObject( work.done, INFINITE );
+    CloseHandle( work.done );
+}
+
+struct blend_bands
+{
+    dib_info      *dst;
+    const RECT    *rect;
+    const dib_info *src;
+    const POINT   *origin;
+    BLENDFUNCTION  blend;
+    int            count;
+};
+
+static void blend_band( void *ctx, int band )
+{
+    struct blend_bands *bands = ctx;
+    int height = bands->rect->bottom - bands->rect->top;
+    RECT rect = *bands->rect;
+    POINT origin = *bands->origin;
+
+    rect.top = bands->rect->top + height * band / bands->count;
+    rect.bottom = bands->rect->top + height * (band + 1) / bands->count;
+    origin.y += rect.top - bands->rect->top;
+    bands->dst->funcs->blend_rect( bands->dst, &rect, bands->src, &origin, bands->blend );
+}
+
 static DWORD blend_rect( dib_info *dst, const RECT *dst_rect, const dib_info *src, const RECT *src_rect,
                          HRGN clip, BLENDFUNCTION blend )
 {
     POINT origin;
     struct clipped_rects clipped_rects;
+    struct blend_bands bands;
     int i;
 
     if (!get_clipped_rects( dst, dst_rect, clip, &clipped_rects )) return ERROR_SUCCESS;
@@ -564,7 +686,20 @@ static DWORD blend_rect( dib_info *dst, const RECT *dst_rect, const dib_info *sr
     {
         origin.x = src_rect->left + clipped_rects.rects[i].left - dst_rect->left;
         origin.y = src_rect->top  + clipped_rects.rects[i].top  - dst_rect->top;
-        dst->funcs->blend_rect( dst, &clipped_rects.rects[i], src, &origin, blend );
+        bands.count = 1;
+        if (src->bits.ptr != dst->bits.ptr)
+            bands.count = get_band_count( clipped_rects.rects[i].right - clipped_rects.rects[i].left,
+                                          clipped_rects.rects[i].bottom - clipped_rects.rects[i].top );
+        if (bands.count > 1)
+        {
+            bands.dst = dst;
+            bands.rect = &clipped_rects.rects[i];
+            bands.src = src;
+            bands.origin = &origin;
+            bands.blend = blend;
+            run_bands( blend_band, &bands, bands.count );
+        }
+        else dst->funcs->blend_rect( dst, &clipped_rects.rects[i], src, &origin, blend );
     }
     free_clipped_rects( &clipped_rects );
     return ERROR_SUCCESS;
@@ -1140,6 +1275,360 @@ static DWORD calc_1d_stretch_params( INT dst_start, INT dst_length, INT dst_vis_
 }
 
 
+struct stretch_band
+{
+    POINT dst_start, src_start;
+    int   err, start, length;
+};
+
+struct stretch_bands
+{
+    dib_info       *dst_dib;
+    const dib_info *src_dib;
+    const struct stretch_params *v_params;
+    const struct stretch_params *h_params;
+    void (* row_fn)(const dib_info *dst_dib, const POINT *dst_start,
+                    const dib_info *src_dib, const POINT *src_start,
+                    const struct stretch_params *params, int mode, BOOL keep_dst);
+    BOOL hstretch, vstretch;
+    int  mode;
+    int  width;
+    int  count;
+    struct stretch_band bands[MAX_BANDS];
+};
+
+static void stretch_band( void *ctx, int band )
+{
+    struct stretch_bands *bands = ctx;
+    const struct stretch_params *v_params = bands->v_params;
+    dib_info *dst_dib = bands->dst_dib;
+    POINT dst_start = bands->bands[band].dst_start;
+    POINT src_start = bands->bands[band].src_start;
+    int err = bands->bands[band].err;
+    int length = bands->bands[band].length;
+    int mode = bands->mode;
+
+    if (bands->vstretch)
+    {
+        BOOL need_row = TRUE;
+        RECT last_row, this_row;
+        last_row.left = 0;
+        last_row.right = bands->width;
+
+        while (length--)
+        {
+            if (need_row)
+            {
+                bands->row_fn( dst_dib, &dst_start, bands->src_dib, &src_start, bands->h_params, mode, FALSE );
+                need_row = FALSE;
+            }
+            else
+            {
+                last_row.top = dst_start.y - v_params->dst_inc;
+                last_row.bottom = last_row.top + 1;
+                this_row = last_row;
+                offset_rect( &this_row, 0, v_params->dst_inc );
+                copy_rect( dst_dib, &this_row, dst_dib, &last_row, NULL, R2_COPYPEN );
+            }
+
+            if (err > 0)
+            {
+                src_start.y += v_params->src_inc;
+                need_row = TRUE;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            dst_start.y += v_params->dst_inc;
+        }
+    }
+    else
+    {
+        int merged_rows = 0;
+        int faster_mode = mode;
+
+        while (length--)
+        {
+            if (bands->hstretch) faster_mode = merged_rows ? mode : STRETCH_DELETESCANS;
+            bands->row_fn( dst_dib, &dst_start, bands->src_dib, &src_start, bands->h_params,
+                           faster_mode, merged_rows != 0 );
+            merged_rows++;
+
+            if (err > 0)
+            {
+                dst_start.y += v_params->dst_inc;
+                merged_rows = 0;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            src_start.y += v_params->src_inc;
+        }
+    }
+}
+
+/* compute the starting state of each band by stepping through the rows without
+ * rendering them; bands only start where a new destination row begins */
+static void split_stretch_bands( struct stretch_bands *bands, const POINT *dst_start,
+                                 const POINT *src_start, int count )
+{
+    const struct stretch_params *v_params = bands->v_params;
+    POINT dst = *dst_start, src = *src_start;
+    int i, length = v_params->length, err = v_params->err_start;
+    BOOL new_row = TRUE;
+
+    bands->count = 0;
+    for (i = 0; i < length; i++)
+    {
+        if (new_row && bands->count < count && i >= length * bands->count / count)
+        {
+            struct stretch_band *band = &bands->bands[bands->count++];
+            band->dst_start = dst;
+            band->src_start = src;
+            band->err = err;
+            band->start = i;
+        }
+
+        if (bands->vstretch)
+        {
+            if (err > 0)
+            {
+                src.y += v_params->src_inc;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            dst.y += v_params->dst_inc;
+        }
+        else
+        {
+            new_row = (err > 0);
+            if (err > 0)
+            {
+                dst.y += v_params->dst_inc;
+                err += v_params->err_add_1;
+            }
+            else err += v_params->err_add_2;
+            src.y += v_params->src_inc;
+        }
+    }
+
+    for (i = 0; i < bands->count; i++)
+    {
+        int end = (i + 1 < bands->count) ? bands->bands[i + 1].start : length;
+        bands->bands[i].length = end - bands->bands[i].start;
+    }
+}
+
+/* HALFTONE stretching is done with a separable filter on 32-bpp copies of the
+ * bits: area averaging along an axis that shrinks, linear interpolation along
+ * an axis that grows.  The filter weights are computed once per axis. */
+
+#define FILTER_SHIFT 14
+
+struct filter_table
+{
+    int *start;     /* first source pixel for each destination pixel */
+    int *count;     /* number of source pixels for each destination pixel */
+    int *weights;   /* max_count weights for each destination pixel */
+    int  max_count;
+};
+
+static void free_filter_table( struct filter_table *table )
+{
+    HeapFree( GetProcessHeap(), 0, table->start );
+    HeapFree( GetProcessHeap(), 0, table->count );
+    HeapFree( GetProcessHeap(), 0, table->weights );
+}
+
+static void add_filter_weight( int *start, int *count, double *weights, int pos, double weight )
+{
+    if (weight < 1e-6) return;
+    if (*count && pos == *start + *count - 1) weights[*count - 1] += weight;
+    else
+    {
+        if (!*count) *start = pos;
+        weights[(*count)++] = weight;
+    }
+}
+
+/* map destination pixels [dst_start, dst_end) of the dst_pos/dst_len area onto
+ * the src_pos/src_len area, with source pixels clamped to [src_min, src_max) */
+static BOOL init_filter_table( struct filter_table *table, int dst_pos, int dst_len, int dst_start, int dst_end,
+                               int src_pos, int src_len, int src_min, int src_max )
+{
+    int i, j, len = dst_end - dst_start;
+    double scale = (double)src_len / dst_len, weights[256], total;
+
+    table->max_count = src_len >= dst_len ? (src_len + dst_len - 1) / dst_len + 2 : 2;
+    if (table->max_count > 256) return FALSE;
+
+    table->start = HeapAlloc( GetProcessHeap(), 0, len * sizeof(int) );
+    table->count = HeapAlloc( GetProcessHeap(), 0, len * sizeof(int) );
+    table->weights = HeapAlloc( GetProcessHeap(), 0, len * table->max_count * sizeof(int) );
+    if (!table->start || !table->count || !table->weights)
+    {
+        free_filter_table( table );
+        return FALSE;
+    }
+
+    for (i = 0; i < len; i++)
+    {
+        double u0 = src_pos + (dst_start + i - dst_pos) * scale, u1 = u0 + scale;
+        int *start = &table->start[i], *count = &table->count[i];
+        int *fixed = table->weights + i * table->max_count, sum = 0, largest = 0;
+
+        *count = 0;
+        if (src_len >= dst_len)  /* area average */
+        {
+            for (j = floor( u0 ); j < u1; j++)
+                add_filter_weight( start, count, weights, max( src_min, min( src_max - 1, j )),
+                                   min( u1, j + 1 ) - max( u0, j ));
+        }
+        else  /* linear interpolation */
+        {
+            double center = (u0 + u1) / 2 - 0.5;
+            double frac = center - floor( center );
+
+            j = floor( center );
+            add_filter_weight( start, count, weights, max( src_min, min( src_max - 1, j )), 1.0 - frac );
+            add_filter_weight( start, count, weights, max( src_min, min( src_max - 1, j + 1 )), frac );
+        }
+
+        for (j = 0, total = 0.0; j < *count; j++) total += weights[j];
+        for (j = 0; j < *count; j++)
+        {
+            fixed[j] = weights[j] * (1 << FILTER_SHIFT) / total + 0.5;
+            sum += fixed[j];
+            if (fixed[j] > fixed[largest]) largest = j;
+        }
+        fixed[largest] += (1 << FILTER_SHIFT) - sum;
+        *start -= src_min;
+    }
+    return TRUE;
+}
+
+struct halftone_bands
+{
+    const dib_info *src;
+    dib_info       *dst;
+    struct filter_table h, v;
+    int            *tmp;    /* one row of intermediate values per band */
+    int             width, height;
+    int             count;
+};
+
+static void halftone_band( void *ctx, int band )
+{
+    struct halftone_bands *bands = ctx;
+    int x, y, i, c, top = bands->height * band / bands->count, bottom = bands->height * (band + 1) / bands->count;
+    int src_width = bands->src->width;
+    int *tmp = bands->tmp + band * src_width * 4;
+
+    for (y = top; y < bottom; y++)
+    {
+        const int *weights = bands->v.weights + y * bands->v.max_count;
+        BYTE *dst_ptr = (BYTE *)bands->dst->bits.ptr + y * bands->dst->stride;
+
+        /* vertical pass into tmp, keeping 6 bits of fraction */
+        for (x = 0; x < src_width * 4; x++) tmp[x] = 0;
+        for (i = 0; i < bands->v.count[y]; i++)
+        {
+            const BYTE *src_ptr = (const BYTE *)bands->src->bits.ptr + (bands->v.start[y] + i) * bands->src->stride;
+            for (x = 0; x < src_width * 4; x++) tmp[x] += src_ptr[x] * weights[i];
+        }
+        for (x = 0; x < src_width * 4; x++) tmp[x] = (tmp[x] + (1 << 7)) >> 8;
+
+        /* horizontal pass */
+        for (x = 0; x < bands->width; x++)
+        {
+            const int *row = tmp + bands->h.start[x] * 4;
+            weights = bands->h.weights + x * bands->h.max_count;
+            for (c = 0; c < 4; c++)
+            {
+                int val = 0;
+                for (i = 0; i < bands->h.count[x]; i++) val += row[i * 4 + c] * weights[i];
+                val = (val + (1 << (FILTER_SHIFT + 5))) >> (FILTER_SHIFT + 6);
+                dst_ptr[x * 4 + c] = max( 0, min( val, 255 ));
+            }
+        }
+    }
+}
+
+static DWORD create_8888_dib( int width, int height, dib_info *dib )
+{
+    BITMAPINFO info;
+    void *bits;
+
+    memset( &info, 0, sizeof(info) );
+    info.bmiHeader.biSize        = sizeof(info.bmiHeader);
+    info.bmiHeader.biWidth       = width;
+    info.bmiHeader.biHeight      = -height;
+    info.bmiHeader.biPlanes      = 1;
+    info.bmiHeader.biBitCount    = 32;
+    info.bmiHeader.biCompression = BI_RGB;
+    if (!(bits = HeapAlloc( GetProcessHeap(), 0, width * height * 4 ))) return ERROR_OUTOFMEMORY;
+    init_dib_info_from_bitmapinfo( dib, &info, bits );
+    dib->bits.is_copy = TRUE;
+    dib->bits.free = free_heap_bits;
+    return ERROR_SUCCESS;
+}
+
+/* stretch src into the dst visible rectangle, which is stored at 0,0 in dst_dib */
+static DWORD halftone_stretch( dib_info *dst_dib, const struct bitblt_coords *dst,
+                               const dib_info *src_dib, const struct bitblt_coords *src )
+{
+    struct halftone_bands bands;
+    dib_info src_tmp, dst_tmp;
+    RECT rect;
+    DWORD ret;
+
+    bands.width  = dst->visrect.right - dst->visrect.left;
+    bands.height = dst->visrect.bottom - dst->visrect.top;
+    if (!init_filter_table( &bands.h, dst->x, dst->width, dst->visrect.left, dst->visrect.right,
+                            src->x, src->width, src->visrect.left, src->visrect.right ))
+        return ERROR_OUTOFMEMORY;
+    if (!init_filter_table( &bands.v, dst->y, dst->height, dst->visrect.top, dst->visrect.bottom,
+                            src->y, src->height, src->visrect.top, src->visrect.bottom ))
+    {
+        free_filter_table( &bands.h );
+        return ERROR_OUTOFMEMORY;
+    }
+
+    if ((ret = create_8888_dib( src->visrect.right - src->visrect.left,
+                                src->visrect.bottom - src->visrect.top, &src_tmp )))
+        goto done;
+    if ((ret = create_8888_dib( bands.width, bands.height, &dst_tmp )))
+    {
+        free_dib_info( &src_tmp );
+        goto done;
+    }
+
+    bands.count = get_band_count( bands.width, bands.height );
+    if (!(bands.tmp = HeapAlloc( GetProcessHeap(), 0, bands.count * src_tmp.width * 4 * sizeof(int) )))
+    {
+        free_dib_info( &dst_tmp );
+        free_dib_info( &src_tmp );
+        ret = ERROR_OUTOFMEMORY;
+        goto done;
+    }
+
+    src_tmp.funcs->convert_to( &src_tmp, src_dib, &src->visrect, FALSE );
+    bands.src = &src_tmp;
+    bands.dst = &dst_tmp;
+    run_bands( halftone_band, &bands, bands.count );
+    HeapFree( GetProcessHeap(), 0, bands.tmp );
+
+    rect.left = rect.top = 0;
+    rect.right = bands.width;
+    rect.bottom = bands.height;
+    dst_dib->funcs->convert_to( dst_dib, &dst_tmp, &rect, FALSE );
+
+    free_dib_info( &dst_tmp );
+    free_dib_info( &src_tmp );
+done:
+    free_filter_table( &bands.v );
+    free_filter_table( &bands.h );
+    return ret;
+}
+
 DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bitblt_coords *src,
                           const BITMAPINFO *dst_info, void *dst_bits, struct bitblt_coords *dst,
                           INT mode )
@@ -1149,11 +1638,9 @@ DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bit
     RECT rect;
     BOOL hstretch, vstretch;
     struct stretch_params v_params, h_params;
-    int err;
+    struct stretch_bands bands;
+    int count = 1;
     DWORD ret;
-    void (* row_fn)(const dib_info *dst_dib, const POINT *dst_start,
-                    const dib_info *src_dib, const POINT *src_start,
-                    const struct stretch_params *params, int mode, BOOL keep_dst);
 
     TRACE("dst %d, %d - %d x %d visrect %s src %d, %d - %d x %d visrect %s\n",
           dst->x, dst->y, dst->width, dst->height, wine_dbgstr_rect(&dst->visrect),
@@ -1184,69 +1671,43 @@ DWORD stretch_bitmapinfo( const BITMAPINFO *src_info, void *src_bits, struct bit
     get_bounding_rect( &rect, dst_start.x, dst_start.y, dst_end.x - dst_start.x, dst_end.y - dst_start.y );
     intersect_rect( &dst->visrect, &dst->visrect, &rect );
 
+    if (mode == STRETCH_HALFTONE && dst->width > 0 && dst->height > 0 && src->width > 0 && src->height > 0 &&
+        !halftone_stretch( &dst_dib, dst, &src_dib, src ))
+        goto done;
+
     dst_start.x -= dst->visrect.left;
     dst_start.y -= dst->visrect.top;
 
-    err = v_params.err_start;
+    bands.dst_dib  = &dst_dib;
+    bands.src_dib  = &src_dib;
+    bands.v_params = &v_params;
+    bands.h_params = &h_params;
+    bands.row_fn   = hstretch ? dst_dib.funcs->stretch_row : dst_dib.funcs->shrink_row;
+    bands.hstretch = hstretch;
+    bands.vstretch = vstretch;
+    bands.mode     = (vstretch && hstretch) ? STRETCH_DELETESCANS : mode;
+    bands.width    = dst->visrect.right - dst->visrect.left;
 
-    row_fn = hstretch ? dst_dib.funcs->stretch_row : dst_dib.funcs->shrink_row;
+    if (src_bits != dst_bits)
+        count = get_band_count( bands.width, dst->visrect.bottom - dst->visrect.top );
 
-    if (vstretch)
+    if (count > 1)
     {
-        BOOL need_row = TRUE;
-        RECT last_row, this_row;
-        if (hstretch) mode = STRETCH_DELETESCANS;
-        last_row.left = 0;
-        last_row.right = dst->visrect.right - dst->visrect.left;
-
-        while (v_params.length--)
-        {
-            if (need_row)
-            {
-                row_fn( &dst_dib, &dst_start, &src_dib, &src_start, &h_params, mode, FALSE );
-                need_row = FALSE;
-            }
-            else
-            {
-                last_row.top = dst_start.y - v_params.dst_inc;
-                last_row.bottom = last_row.top + 1;
-                this_row = last_row;
-                offset_rect( &this_row, 0, v_params.dst_inc );
-                copy_rect( &dst_dib, &this_row, &dst_dib, &last_row, NULL, R2_COPYPEN );
-            }
-
-            if (err > 0)
-            {
-                src_start.y += v_params.src_inc;
-                need_row = TRUE;
-                err += v_params.err_add_1;
-            }
-            else err += v_params.err_add_2;
-            dst_start.y += v_params.dst_inc;
-        }
+        split_stretch_bands( &bands, &dst_start, &src_start, count );
+        run_bands( stretch_band, &bands, bands.count );
     }
     else
     {
-        int merged_rows = 0;
-        int faster_mode = mode;
-
-        while (v_params.length--)
-        {
-            if (hstretch) faster_mode = merged_rows ? mode : STRETCH_DELETESCANS;
-            row_fn( &dst_dib, &dst_start, &src_dib, &src_start, &h_params, faster_mode, merged_rows != 0 );
-            merged_rows++;
-
-            if (err > 0)
-            {
-                dst_start.y += v_params.dst_inc;
-                merged_rows = 0;
-                err += v_params.err_add_1;
-            }
-            else err += v_params.err_add_2;
-            src_start.y += v_params.src_inc;
-        }
+        bands.count = 1;
+        bands.bands[0].dst_start = dst_start;
+        bands.bands[0].src_start = src_start;
+        bands.bands[0].err = v_params.err_start;
+        bands.bands[0].start = 0;
+        bands.bands[0].length = v_params.length;
+        stretch_band( &bands, 0 );
     }
 
+done:
     /* update coordinates, the destination rectangle is always stored at 0,0 */
     *src = *dst;
     src->x -= src->visrect.left;
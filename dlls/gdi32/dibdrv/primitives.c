@@ -107,6 +107,34 @@ static inline BYTE *get_pixel_ptr_1(const dib_info *dib, int x, int y)
 static const BYTE pixel_masks_4[2] = {0xf0, 0x0f};
 static const BYTE pixel_masks_1[8] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
 
+static inline void memset_32( DWORD *start, DWORD val, DWORD size )
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    ULONG_PTR count;
+    void *ptr;
+    __asm__ __volatile__( "cld; rep; stosl"
+                          : "=c" (count), "=D" (ptr)
+                          : "a" (val), "0" ((ULONG_PTR)size), "1" (start)
+                          : "memory" );
+#else
+    while (size--) *start++ = val;
+#endif
+}
+
+static inline void memset_16( WORD *start, WORD val, DWORD size )
+{
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+    ULONG_PTR count;
+    void *ptr;
+    __asm__ __volatile__( "cld; rep; stosw"
+                          : "=c" (count), "=D" (ptr)
+                          : "a" (val), "0" ((ULONG_PTR)size), "1" (start)
+                          : "memory" );
+#else
+    while (size--) *start++ = val;
+#endif
+}
+
 static inline void do_rop_32(DWORD *ptr, DWORD and, DWORD xor)
 {
     *ptr = (*ptr & and) ^ xor;
@@ -264,9 +292,13 @@ static void solid_rects_32(const dib_info *dib, int num, const RECT *rc, DWORD a
     for(i = 0; i < num; i++, rc++)
     {
         start = get_pixel_ptr_32(dib, rc->left, rc->top);
-        for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 4)
-            for(x = rc->left, ptr = start; x < rc->right; x++)
-                do_rop_32(ptr++, and, xor);
+        if (and)
+            for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 4)
+                for(x = rc->left, ptr = start; x < rc->right; x++)
+                    do_rop_32(ptr++, and, xor);
+        else
+            for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 4)
+                memset_32( start, xor, rc->right - rc->left );
     }
 }
 
@@ -362,9 +394,13 @@ static void solid_rects_16(const dib_info *dib, int num, const RECT *rc, DWORD a
     for(i = 0; i < num; i++, rc++)
     {
         start = get_pixel_ptr_16(dib, rc->left, rc->top);
-        for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 2)
-            for(x = rc->left, ptr = start; x < rc->right; x++)
-                do_rop_16(ptr++, and, xor);
+        if ((WORD)and)
+            for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 2)
+                for(x = rc->left, ptr = start; x < rc->right; x++)
+                    do_rop_16(ptr++, and, xor);
+        else
+            for(y = rc->top; y < rc->bottom; y++, start += dib->stride / 2)
+                memset_16( start, xor, rc->right - rc->left );
     }
 }
 
@@ -3830,36 +3866,35 @@ static inline BYTE blend_color(BYTE dst, BYTE src, DWORD alpha)
     return (src * alpha + dst * (255 - alpha) + 127) / 255;
 }
 
+/* compute (x + 127) / 255 for two values up to 255 * 255 packed in the 16-bit halves of a DWORD */
+static inline DWORD div255_packed( DWORD val )
+{
+    val += 0x00800080;
+    return ((val + ((val >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+}
+
+/* the 32-bit blending functions work on the red/blue and alpha/green channel pairs at once */
+
 static inline DWORD blend_argb_constant_alpha( DWORD dst, DWORD src, DWORD alpha )
 {
-    return (blend_color( dst, src, alpha ) |
-            blend_color( dst >> 8, src >> 8, alpha ) << 8 |
-            blend_color( dst >> 16, src >> 16, alpha ) << 16 |
-            blend_color( dst >> 24, src >> 24, alpha ) << 24);
+    DWORD rb = div255_packed( (src & 0x00ff00ff) * alpha + (dst & 0x00ff00ff) * (255 - alpha) );
+    DWORD ag = div255_packed( ((src >> 8) & 0x00ff00ff) * alpha + ((dst >> 8) & 0x00ff00ff) * (255 - alpha) );
+    return rb | (ag << 8);
 }
 
 static inline DWORD blend_argb( DWORD dst, DWORD src )
 {
-    BYTE b = (BYTE)src;
-    BYTE g = (BYTE)(src >> 8);
-    BYTE r = (BYTE)(src >> 16);
-    DWORD alpha  = (BYTE)(src >> 24);
-    return ((b     + ((BYTE)dst         * (255 - alpha) + 127) / 255) |
-            (g     + ((BYTE)(dst >> 8)  * (255 - alpha) + 127) / 255) << 8 |
-            (r     + ((BYTE)(dst >> 16) * (255 - alpha) + 127) / 255) << 16 |
-            (alpha + ((BYTE)(dst >> 24) * (255 - alpha) + 127) / 255) << 24);
+    DWORD alpha = src >> 24;
+    DWORD rb = div255_packed( (dst & 0x00ff00ff) * (255 - alpha) ) + (src & 0x00ff00ff);
+    DWORD ag = div255_packed( ((dst >> 8) & 0x00ff00ff) * (255 - alpha) ) + ((src >> 8) & 0x00ff00ff);
+    return rb | (ag << 8);
 }
 
 static inline DWORD blend_argb_alpha( DWORD dst, DWORD src, DWORD alpha )
 {
-    BYTE b = ((BYTE)src         * alpha + 127) / 255;
-    BYTE g = ((BYTE)(src >> 8)  * alpha + 127) / 255;
-    BYTE r = ((BYTE)(src >> 16) * alpha + 127) / 255;
-    alpha  = ((BYTE)(src >> 24) * alpha + 127) / 255;
-    return ((b     + ((BYTE)dst         * (255 - alpha) + 127) / 255) |
-            (g     + ((BYTE)(dst >> 8)  * (255 - alpha) + 127) / 255) << 8 |
-            (r     + ((BYTE)(dst >> 16) * (255 - alpha) + 127) / 255) << 16 |
-            (alpha + ((BYTE)(dst >> 24) * (255 - alpha) + 127) / 255) << 24);
+    DWORD rb = div255_packed( (src & 0x00ff00ff) * alpha );
+    DWORD ag = div255_packed( ((src >> 8) & 0x00ff00ff) * alpha );
+    return blend_argb( dst, rb | (ag << 8) );
 }
 
 static inline DWORD blend_rgb( BYTE dst_r, BYTE dst_g, BYTE dst_b, DWORD src, BLENDFUNCTION blend )
@@ -3892,7 +3927,11 @@ static void blend_rect_8888(const dib_info *dst, const RECT *rc,
 	if (blend.SourceConstantAlpha == 255)
 	    for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
 		for (x = 0; x < rc->right - rc->left; x++)
-		    dst_ptr[x] = blend_argb( dst_ptr[x], src_ptr[x] );
+                {
+                    /* fully opaque and fully transparent pixels are the common case */
+                    if (src_ptr[x] >= 0xff000000) dst_ptr[x] = src_ptr[x];
+                    else if (src_ptr[x]) dst_ptr[x] = blend_argb( dst_ptr[x], src_ptr[x] );
+                }
         else
 	    for (y = rc->top; y < rc->bottom; y++, dst_ptr += dst->stride / 4, src_ptr += src->stride / 4)
 		for (x = 0; x < rc->right - rc->left; x++)
@@ -5250,6 +5289,22 @@ static void stretch_row_32(const dib_info *dst_dib, const POINT *dst_start,
     int width;
     struct rop_codes codes;
 
+    if (mode != STRETCH_ORSCANS && mode != STRETCH_ANDSCANS)  /* plain copy */
+    {
+        for (width = params->length; width; width--)
+        {
+            *dst_ptr = *src_ptr;
+            dst_ptr += params->dst_inc;
+            if (err > 0)
+            {
+                src_ptr += params->src_inc;
+                err += params->err_add_1;
+            }
+            else err += params->err_add_2;
+        }
+        return;
+    }
+
     rop_codes_from_stretch_mode( mode, &codes );
     for (width = params->length; width; width--)
     {
@@ -5275,6 +5330,24 @@ static void stretch_row_24(const dib_info *dst_dib, const POINT *dst_start,
     int width;
     struct rop_codes codes;
 
+    if (mode != STRETCH_ORSCANS && mode != STRETCH_ANDSCANS)  /* plain copy */
+    {
+        for (width = params->length; width; width--)
+        {
+            dst_ptr[0] = src_ptr[0];
+            dst_ptr[1] = src_ptr[1];
+            dst_ptr[2] = src_ptr[2];
+            dst_ptr += 3 * params->dst_inc;
+            if (err > 0)
+            {
+                src_ptr += 3 * params->src_inc;
+                err += params->err_add_1;
+            }
+            else err += params->err_add_2;
+        }
+        return;
+    }
+
     rop_codes_from_stretch_mode( mode, &codes );
     for (width = params->length; width; width--)
     {
@@ -5302,6 +5375,22 @@ static void stretch_row_16(const dib_info *dst_dib, const POINT *dst_start,
     int width;
     struct rop_codes codes;
 
+    if (mode != STRETCH_ORSCANS && mode != STRETCH_ANDSCANS)  /* plain copy */
+    {
+        for (width = params->length; width; width--)
+        {
+            *dst_ptr = *src_ptr;
+            dst_ptr += params->dst_inc;
+            if (err > 0)
+            {
+                src_ptr += params->src_inc;
+                err += params->err_add_1;
+            }
+            else err += params->err_add_2;
+        }
+        return;
+    }
+
     rop_codes_from_stretch_mode( mode, &codes );
     for (width = params->length; width; width--)
     {
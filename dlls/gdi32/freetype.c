@@ -319,6 +319,7 @@ struct tagGdiFont {
     struct list entry;
     GM **gm;
     DWORD gmsize;
+    struct list *glyph_cache;
     struct list hfontlist;
     OUTLINETEXTMETRICW *potm;
     DWORD total_kern_pairs;
@@ -370,6 +371,26 @@ struct enum_charset_list {
 #define GM_BLOCK_SIZE 128
 #define FONT_GM(font,idx) (&(font)->gm[(idx) / GM_BLOCK_SIZE][(idx) % GM_BLOCK_SIZE])
 
+/* rendered glyph bitmaps, hashed per font and kept in a process-wide LRU list */
+struct glyph_bitmap
+{
+    struct list entry;      /* entry in the font hash bucket */
+    struct list lru_entry;  /* entry in glyph_cache_lru */
+    GdiFont    *font;
+    UINT        glyph;
+    UINT        format;
+    GLYPHMETRICS gm;
+    DWORD       size;
+    BYTE        bits[1];
+};
+
+#define GLYPH_CACHE_BUCKETS 64
+#define GLYPH_CACHE_DEFAULT_SIZE (2 * 1024 * 1024)
+
+static struct list glyph_cache_lru = LIST_INIT(glyph_cache_lru);
+static SIZE_T glyph_cache_size;
+static SIZE_T glyph_cache_max_size = GLYPH_CACHE_DEFAULT_SIZE;
+
 static struct list gdi_font_list = LIST_INIT(gdi_font_list);
 static struct list unused_gdi_font_list = LIST_INIT(unused_gdi_font_list);
 #define UNUSED_CACHE_SIZE 10
@@ -1571,14 +1592,10 @@ static void get_family_names( FT_Face ft_face, WCHAR **name, WCHAR **english, BO
     }
 }
 
-static Family *get_family( FT_Face ft_face, BOOL vertical )
+/* takes ownership of the name strings */
+static Family *find_or_create_family( WCHAR *name, WCHAR *english_name )
 {
-    Family *family;
-    WCHAR *name, *english_name;
-
-    get_family_names( ft_face, &name, &english_name, vertical );
-
-    family = find_family_from_name( name );
+    Family *family = find_family_from_name( name );
 
     if (!family)
     {
@@ -1604,6 +1621,14 @@ static Family *get_family( FT_Face ft_face, BOOL vertical )
     return family;
 }
 
+static Family *get_family( FT_Face ft_face, BOOL vertical )
+{
+    WCHAR *name, *english_name;
+
+    get_family_names( ft_face, &name, &english_name, vertical );
+    return find_or_create_family( name, english_name );
+}
+
 static inline FT_Fixed get_font_version( FT_Face ft_face )
 {
     FT_Fixed version = 0;
@@ -1766,6 +1791,456 @@ static Face *create_face( FT_Face ft_face, FT_Long face_index, const char *file,
     return face;
 }
 
+/* The faces found in font files are remembered across sessions in an index
+ * file in the configuration directory.  The index is mapped once while the
+ * font list is built, and an entry is only used while the size and modification
+ * time of its font file still match, so that only new or modified files have to
+ * be opened with FreeType.  The index is rewritten when files were added,
+ * modified or removed. */
+
+#define FONT_INDEX_MAGIC    0x58444946  /* "FIDX" */
+#define FONT_INDEX_VERSION  1
+#define FONT_INDEX_ALIGN(size) (((size) + 7) & ~7)
+
+struct font_index_header
+{
+    DWORD     magic;
+    DWORD     version;
+    DWORD     count;            /* number of font files */
+    DWORD     size;             /* size of the whole index */
+};
+
+struct font_index_file
+{
+    DWORD     size;             /* size of the entry, including the path and the faces */
+    DWORD     flags;            /* ADDFONT_FORCE_BITMAP if the file was loaded with it */
+    ULONGLONG mtime;
+    ULONGLONG file_size;
+    DWORD     faces;            /* number of faces */
+    DWORD     path_len;         /* length of the unix path, including the null */
+    /* followed by the path, then by the faces */
+};
+
+struct font_index_face
+{
+    DWORD         size;         /* size of the record, including the names */
+    DWORD         face_index;
+    DWORD         ntm_flags;
+    LONG          font_version;
+    DWORD         scalable;
+    DWORD         vertical;
+    FONTSIGNATURE fs;
+    INT           bitmap_height;
+    INT           bitmap_width;
+    INT           bitmap_size;
+    INT           x_ppem;
+    INT           y_ppem;
+    INT           internal_leading;
+    WORD          name_len[4];  /* family, English, style and full names, including the null, 0 if missing */
+    /* followed by the names */
+};
+
+struct font_index
+{
+    BYTE         *data;         /* mapping of the index file */
+    SIZE_T        data_size;
+    const struct font_index_file **hash;  /* mapped entries hashed by path, NULL for free slots */
+    BOOL         *used;         /* mapped entries found again during the current scan */
+    UINT          hash_size;
+    UINT          count;        /* number of mapped entries */
+    UINT          used_count;
+    BYTE         *added;        /* entries for the files opened during the current scan */
+    SIZE_T        added_size;
+    SIZE_T        added_alloc;
+    UINT          added_count;
+    SIZE_T        current;      /* offset of the entry being recorded in added */
+    BOOL          recording;
+};
+
+static struct font_index *font_index;  /* only set while init_font_list() runs */
+
+static char *get_font_index_path( const char *suffix )
+{
+    const char *config_dir = wine_get_config_dir();
+    char *path;
+
+    if (!(path = HeapAlloc( GetProcessHeap(), 0, strlen(config_dir) + sizeof("/fontindex") + strlen(suffix) )))
+        return NULL;
+    strcpy( path, config_dir );
+    strcat( path, "/fontindex" );
+    strcat( path, suffix );
+    return path;
+}
+
+static UINT hash_font_path( const char *path, UINT hash_size )
+{
+    UINT hash = 0;
+
+    while (*path) hash = hash * 31 + (BYTE)*path++;
+    return hash & (hash_size - 1);
+}
+
+static inline const char *get_font_index_file_path( const struct font_index_file *entry )
+{
+    return (const char *)(entry + 1);
+}
+
+/* check that an entry and its faces are entirely inside the index */
+static BOOL validate_font_index_file( const struct font_index_file *entry, SIZE_T avail )
+{
+    const BYTE *ptr, *end;
+    const WCHAR *name;
+    DWORD i, j;
+
+    if (avail < sizeof(*entry) || entry->size < sizeof(*entry) || entry->size > avail) return FALSE;
+    if (entry->size != FONT_INDEX_ALIGN( entry->size )) return FALSE;
+    if (!entry->path_len || entry->path_len > entry->size - sizeof(*entry)) return FALSE;
+    if (get_font_index_file_path( entry )[entry->path_len - 1]) return FALSE;
+
+    ptr = (const BYTE *)(entry + 1) + FONT_INDEX_ALIGN( entry->path_len );
+    end = (const BYTE *)entry + entry->size;
+    for (i = 0; i < entry->faces; i++)
+    {
+        const struct font_index_face *face = (const struct font_index_face *)ptr;
+        DWORD len = 0;
+
+        if (ptr > end || end - ptr < sizeof(*face) || face->size > end - ptr ||
+            face->size != FONT_INDEX_ALIGN( face->size ))
+            return FALSE;
+        name = (const WCHAR *)(face + 1);
+        for (j = 0; j < 4; j++)
+        {
+            len += face->name_len[j];
+            if ((len * sizeof(WCHAR)) > face->size - sizeof(*face)) return FALSE;
+            if (face->name_len[j] && name[len - 1]) return FALSE;
+        }
+        if (!face->name_len[0] || !face->name_len[2]) return FALSE;
+        ptr += face->size;
+    }
+    return TRUE;
+}
+
+static void open_font_index(void)
+{
+    const struct font_index_header *header;
+    const struct font_index_file *entry;
+    struct stat st;
+    SIZE_T pos;
+    char *path;
+    UINT i, hash;
+    int fd = -1;
+
+    if (!(font_index = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*font_index) ))) return;
+
+    if (!(path = get_font_index_path( "" ))) return;
+    fd = open( path, O_RDONLY );
+    HeapFree( GetProcessHeap(), 0, path );
+    if (fd == -1) return;
+
+    if (fstat( fd, &st ) != -1 && st.st_size >= sizeof(*header) && st.st_size < 0x40000000)
+    {
+        font_index->data = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if (font_index->data == MAP_FAILED) font_index->data = NULL;
+        else font_index->data_size = st.st_size;
+    }
+    close( fd );
+    if (!font_index->data) return;
+
+    header = (const struct font_index_header *)font_index->data;
+    if (header->magic != FONT_INDEX_MAGIC || header->version != FONT_INDEX_VERSION ||
+        header->size != font_index->data_size)
+    {
+        TRACE( "ignoring invalid font index\n" );
+        return;
+    }
+
+    for (font_index->hash_size = 16; font_index->hash_size < header->count * 2; font_index->hash_size *= 2)
+        ;
+    font_index->hash = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                  font_index->hash_size * sizeof(*font_index->hash) );
+    font_index->used = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY,
+                                  font_index->hash_size * sizeof(*font_index->used) );
+    if (!font_index->hash || !font_index->used)
+    {
+        font_index->hash_size = 0;
+        return;
+    }
+
+    for (i = 0, pos = sizeof(*header); i < header->count; i++, pos += entry->size)
+    {
+        entry = (const struct font_index_file *)(font_index->data + pos);
+        if (!validate_font_index_file( entry, font_index->data_size - pos ))
+        {
+            WARN( "font index is corrupted after %u entries\n", i );
+            break;
+        }
+        hash = hash_font_path( get_font_index_file_path( entry ), font_index->hash_size );
+        while (font_index->hash[hash] &&
+               strcmp( get_font_index_file_path( font_index->hash[hash] ), get_font_index_file_path( entry )))
+            hash = (hash + 1) & (font_index->hash_size - 1);
+        if (font_index->hash[hash]) continue;  /* duplicate entry, dropped when the index is saved */
+        font_index->hash[hash] = entry;
+        font_index->count++;
+    }
+    TRACE( "loaded font index with %u entries\n", font_index->count );
+}
+
+/* reserve space at the end of the entries added by the current scan */
+static void *add_font_index_data( SIZE_T size )
+{
+    BYTE *ptr;
+
+    size = FONT_INDEX_ALIGN( size );
+    if (font_index->added_size + size > font_index->added_alloc)
+    {
+        SIZE_T new_alloc = max( font_index->added_alloc * 2, font_index->added_size + size + 4096 );
+
+        if (font_index->added)
+            ptr = HeapReAlloc( GetProcessHeap(), 0, font_index->added, new_alloc );
+        else
+            ptr = HeapAlloc( GetProcessHeap(), 0, new_alloc );
+        if (!ptr) return NULL;
+        font_index->added = ptr;
+        font_index->added_alloc = new_alloc;
+    }
+    ptr = font_index->added + font_index->added_size;
+    memset( ptr, 0, size );
+    font_index->added_size += size;
+    return ptr;
+}
+
+static WCHAR *get_font_index_name( const WCHAR **name, WORD len )
+{
+    WCHAR *ret = NULL;
+
+    if (len && (ret = HeapAlloc( GetProcessHeap(), 0, len * sizeof(WCHAR) )))
+        memcpy( ret, *name, len * sizeof(WCHAR) );
+    *name += len;
+    return ret;
+}
+
+/* add the faces recorded for a font file, returns -1 if there's no valid entry */
+static INT load_font_index_faces( const char *file, DWORD flags )
+{
+    const struct font_index_file *entry;
+    const struct font_index_face *record;
+    struct stat st;
+    UINT hash;
+    DWORD i;
+
+    if (!font_index->hash_size || stat( file, &st ) == -1) return -1;
+
+    hash = hash_font_path( file, font_index->hash_size );
+    while ((entry = font_index->hash[hash]) && strcmp( get_font_index_file_path( entry ), file ))
+        hash = (hash + 1) & (font_index->hash_size - 1);
+    if (!entry) return -1;
+    if (entry->mtime != st.st_mtime || entry->file_size != st.st_size ||
+        entry->flags != (flags & ADDFONT_FORCE_BITMAP))
+        return -1;
+
+    if (!font_index->used[hash])
+    {
+        font_index->used[hash] = TRUE;
+        font_index->used_count++;
+    }
+
+    TRACE( "using indexed faces for %s\n", debugstr_a(file) );
+    record = (const struct font_index_face *)((const BYTE *)(entry + 1) + FONT_INDEX_ALIGN( entry->path_len ));
+    for (i = 0; i < entry->faces; i++, record = (const struct font_index_face *)((const BYTE *)record + record->size))
+    {
+        const WCHAR *name = (const WCHAR *)(record + 1);
+        WCHAR *family_name = get_font_index_name( &name, record->name_len[0] );
+        WCHAR *english_name = get_font_index_name( &name, record->name_len[1] );
+        Family *family;
+        Face *face;
+
+        if (!family_name || !(face = HeapAlloc( GetProcessHeap(), 0, sizeof(*face) )))
+        {
+            HeapFree( GetProcessHeap(), 0, family_name );
+            HeapFree( GetProcessHeap(), 0, english_name );
+            continue;
+        }
+        face->StyleName = get_font_index_name( &name, record->name_len[2] );
+        face->FullName = get_font_index_name( &name, record->name_len[3] );
+        face->file = strdupA( file );
+        face->font_data_ptr = NULL;
+        face->font_data_size = 0;
+        face->face_index = record->face_index;
+        face->fs = record->fs;
+        face->ntmFlags = record->ntm_flags;
+        face->font_version = record->font_version;
+        face->scalable = record->scalable;
+        face->vertical = record->vertical;
+        face->size.height = record->bitmap_height;
+        face->size.width = record->bitmap_width;
+        face->size.size = record->bitmap_size;
+        face->size.x_ppem = record->x_ppem;
+        face->size.y_ppem = record->y_ppem;
+        face->size.internal_leading = record->internal_leading;
+        face->external = (flags & ADDFONT_EXTERNAL_FONT) != 0;
+        face->family = NULL;
+        face->cached_enum_data = NULL;
+
+        family = find_or_create_family( family_name, english_name );
+        if (!insert_face_in_family_list( face, family ))
+        {
+            free_face( face );
+            continue;
+        }
+        if (flags & ADDFONT_ADD_TO_CACHE) add_face_to_cache( face );
+        TRACE( "Added font %s %s\n", debugstr_w(family->FamilyName), debugstr_w(face->StyleName) );
+    }
+    return entry->faces;
+}
+
+/* start recording the faces of a font file that has to be opened with FreeType */
+static void start_font_index_file( const char *file, DWORD flags )
+{
+    struct font_index_file *entry;
+    struct stat st;
+    SIZE_T len = strlen( file ) + 1;
+
+    font_index->recording = FALSE;
+    if (stat( file, &st ) == -1) return;
+
+    font_index->current = font_index->added_size;
+    if (!(entry = add_font_index_data( sizeof(*entry) + FONT_INDEX_ALIGN( len ) ))) return;
+    entry->flags = flags & ADDFONT_FORCE_BITMAP;
+    entry->mtime = st.st_mtime;
+    entry->file_size = st.st_size;
+    entry->path_len = len;
+    memcpy( entry + 1, file, len );
+    font_index->recording = TRUE;
+}
+
+static void add_face_to_font_index( const Face *face, const Family *family )
+{
+    struct font_index_face *record;
+    struct font_index_file *entry;
+    const WCHAR *names[4];
+    WCHAR *ptr;
+    SIZE_T len = 0;
+    UINT i;
+
+    if (!font_index || !font_index->recording) return;
+
+    names[0] = family->FamilyName;
+    names[1] = family->EnglishName;
+    names[2] = face->StyleName;
+    names[3] = face->FullName;
+    for (i = 0; i < 4; i++) if (names[i]) len += strlenW( names[i] ) + 1;
+
+    if (!(record = add_font_index_data( sizeof(*record) + len * sizeof(WCHAR) )))
+    {
+        font_index->added_size = font_index->current;
+        font_index->recording = FALSE;
+        return;
+    }
+    record->size = FONT_INDEX_ALIGN( sizeof(*record) + len * sizeof(WCHAR) );
+    record->face_index = face->face_index;
+    record->ntm_flags = face->ntmFlags;
+    record->font_version = face->font_version;
+    record->scalable = face->scalable;
+    record->vertical = face->vertical;
+    record->fs = face->fs;
+    record->bitmap_height = face->size.height;
+    record->bitmap_width = face->size.width;
+    record->bitmap_size = face->size.size;
+    record->x_ppem = face->size.x_ppem;
+    record->y_ppem = face->size.y_ppem;
+    record->internal_leading = face->size.internal_leading;
+
+    ptr = (WCHAR *)(record + 1);
+    for (i = 0; i < 4; i++)
+    {
+        if (!names[i]) continue;
+        record->name_len[i] = strlenW( names[i] ) + 1;
+        memcpy( ptr, names[i], record->name_len[i] * sizeof(WCHAR) );
+        ptr += record->name_len[i];
+    }
+
+    entry = (struct font_index_file *)(font_index->added + font_index->current);
+    entry->faces++;
+}
+
+/* keep the recorded entry if all the faces of the file could be read */
+static void finish_font_index_file( BOOL complete )
+{
+    struct font_index_file *entry;
+
+    if (!font_index || !font_index->recording) return;
+    font_index->recording = FALSE;
+
+    if (!complete)
+    {
+        font_index->added_size = font_index->current;
+        return;
+    }
+    entry = (struct font_index_file *)(font_index->added + font_index->current);
+    entry->size = font_index->added_size - font_index->current;
+    font_index->added_count++;
+}
+
+/* write the entries that are still valid to a new index, and replace the old one with it */
+static void save_font_index(void)
+{
+    struct font_index_header header;
+    char *path, *tmp_path, suffix[16];
+    BOOL ok = TRUE;
+    UINT i;
+    int fd;
+
+    if (!font_index->added_count && font_index->used_count == font_index->count &&
+        font_index->data && font_index->hash_size)
+        return;  /* nothing changed */
+
+    header.magic = FONT_INDEX_MAGIC;
+    header.version = FONT_INDEX_VERSION;
+    header.count = font_index->used_count + font_index->added_count;
+    header.size = sizeof(header) + font_index->added_size;
+    for (i = 0; i < font_index->hash_size; i++)
+        if (font_index->used[i]) header.size += font_index->hash[i]->size;
+
+    sprintf( suffix, ".%u", (unsigned int)getpid() );
+    if (!(path = get_font_index_path( "" ))) return;
+    if (!(tmp_path = get_font_index_path( suffix )))
+    {
+        HeapFree( GetProcessHeap(), 0, path );
+        return;
+    }
+
+    if ((fd = open( tmp_path, O_CREAT | O_TRUNC | O_WRONLY, 0666 )) != -1)
+    {
+        ok = write( fd, &header, sizeof(header) ) == sizeof(header);
+        for (i = 0; ok && i < font_index->hash_size; i++)
+            if (font_index->used[i])
+                ok = write( fd, font_index->hash[i], font_index->hash[i]->size ) == font_index->hash[i]->size;
+        if (ok && font_index->added_size)
+            ok = write( fd, font_index->added, font_index->added_size ) == font_index->added_size;
+        if (close( fd ) == -1) ok = FALSE;
+        if (!ok || rename( tmp_path, path ) == -1)
+        {
+            WARN( "failed to write the font index %s\n", debugstr_a(path) );
+            unlink( tmp_path );
+        }
+        else TRACE( "saved font index with %u entries\n", header.count );
+    }
+    HeapFree( GetProcessHeap(), 0, tmp_path );
+    HeapFree( GetProcessHeap(), 0, path );
+}
+
+static void close_font_index(void)
+{
+    if (!font_index) return;
+    save_font_index();
+    if (font_index->data) munmap( font_index->data, font_index->data_size );
+    HeapFree( GetProcessHeap(), 0, font_index->hash );
+    HeapFree( GetProcessHeap(), 0, font_index->used );
+    HeapFree( GetProcessHeap(), 0, font_index->added );
+    HeapFree( GetProcessHeap(), 0, font_index );
+    font_index = NULL;
+}
+
 static void AddFaceToList(FT_Face ft_face, const char *file, void *font_data_ptr, DWORD font_data_size,
                           FT_Long face_index, DWORD flags, BOOL vertical)
 {
@@ -1774,6 +2249,7 @@ static void AddFaceToList(FT_Face ft_face, const char *file, void *font_data_ptr
 
     face = create_face( ft_face, face_index, file, font_data_ptr, font_data_size, flags, vertical );
     family = get_family( ft_face, vertical );
+    add_face_to_font_index( face, family );
     if (!insert_face_in_family_list( face, family ))
     {
         free_face( face );
@@ -1893,14 +2369,27 @@ static INT AddFontToList(const char *file, void *font_data_ptr, DWORD font_data_
     }
 #endif /* HAVE_CARBON_CARBON_H */
 
+    if (file && font_index && (flags & ADDFONT_ADD_TO_CACHE))
+    {
+        if ((ret = load_font_index_faces( file, flags )) >= 0) return ret;
+        ret = 0;
+        start_font_index_file( file, flags );
+    }
+
     do {
         ft_face = new_ft_face( file, font_data_ptr, font_data_size, face_index, flags & ADDFONT_FORCE_BITMAP );
-        if (!ft_face) return 0;
+        if (!ft_face)
+        {
+            /* a file that isn't a font is remembered as having no faces */
+            finish_font_index_file( !face_index );
+            return 0;
+        }
 
         if(ft_face->family_name[0] == '.') /* Ignore fonts with names beginning with a dot */
         {
             TRACE("Ignoring %s since its family name begins with a dot\n", debugstr_a(file));
             pFT_Done_Face(ft_face);
+            finish_font_index_file( !face_index );
             return 0;
         }
 
@@ -1916,6 +2405,7 @@ static INT AddFontToList(const char *file, void *font_data_ptr, DWORD font_data_
 	num_faces = ft_face->num_faces;
 	pFT_Done_Face(ft_face);
     } while(num_faces > ++face_index);
+    finish_font_index_file( TRUE );
     return ret;
 }
 
@@ -3542,8 +4032,10 @@ static void init_font_list(void)
     WCHAR windowsdir[MAX_PATH];
     char *unixname;
     const char *data_dir;
+    DWORD start_time = GetTickCount();
 
     delete_external_font_keys();
+    open_font_index();
 
     /* load the system bitmap fonts */
     load_system_fonts();
@@ -3671,6 +4163,9 @@ static void init_font_list(void)
         }
         RegCloseKey(hkey);
     }
+
+    close_font_index();
+    TRACE("font list built in %u ms\n", GetTickCount() - start_time);
 }
 
 static BOOL move_to_front(const WCHAR *name)
@@ -3706,6 +4201,23 @@ static void reorder_font_list(void)
     set_default( default_sans_list );
 }
 
+static void load_glyph_cache_size(void)
+{
+    HKEY hkey;
+    DWORD size, type, count = sizeof(size);
+
+    /* @@ Wine registry key: HKCU\Software\Wine\Fonts */
+    if (RegOpenKeyA( HKEY_CURRENT_USER, "Software\\Wine\\Fonts", &hkey )) return;
+    if (!RegQueryValueExA( hkey, "GlyphCacheSize", NULL, &type, (BYTE *)&size, &count ) &&
+        type == REG_DWORD)
+    {
+        /* size is in kilobytes, 0 disables the cache */
+        glyph_cache_max_size = (SIZE_T)size * 1024;
+        TRACE( "glyph cache size %u kb\n", size );
+    }
+    RegCloseKey( hkey );
+}
+
 /*************************************************************
  *    WineEngInit
  *
@@ -3729,6 +4241,8 @@ BOOL WineEngInit(void)
     }
     WaitForSingleObject(font_mutex, INFINITE);
 
+    load_glyph_cache_size();
+
     create_font_cache_key(&hkey_font_cache, &disposition);
 
     if(disposition == REG_CREATED_NEW_KEY)
@@ -3957,11 +4471,34 @@ static GdiFont *alloc_font(void)
     return ret;
 }
 
+static void free_glyph_bitmap( struct glyph_bitmap *bitmap )
+{
+    list_remove( &bitmap->entry );
+    list_remove( &bitmap->lru_entry );
+    glyph_cache_size -= FIELD_OFFSET( struct glyph_bitmap, bits[bitmap->size] );
+    HeapFree( GetProcessHeap(), 0, bitmap );
+}
+
+static void free_glyph_cache( GdiFont *font )
+{
+    struct glyph_bitmap *bitmap, *next;
+    unsigned int i;
+
+    if (!font->glyph_cache) return;
+    for (i = 0; i < GLYPH_CACHE_BUCKETS; i++)
+        LIST_FOR_EACH_ENTRY_SAFE( bitmap, next, &font->glyph_cache[i], struct glyph_bitmap, entry )
+            free_glyph_bitmap( bitmap );
+    HeapFree( GetProcessHeap(), 0, font->glyph_cache );
+    font->glyph_cache = NULL;
+}
+
 static void free_font(GdiFont *font)
 {
     struct list *cursor, *cursor2;
     DWORD i;
 
+    free_glyph_cache( font );
+
     LIST_FOR_EACH_SAFE(cursor, cursor2, &font->child_fonts)
     {
         CHILD_FONT *child = LIST_ENTRY(cursor, CHILD_FONT, entry);
@@ -6856,6 +7393,111 @@ end:
     return ret;
 }
 
+static BOOL is_cacheable_glyph_format( UINT format )
+{
+    switch (format & ~(GGO_GLYPH_INDEX | GGO_UNHINTED))
+    {
+    case GGO_BITMAP:
+    case GGO_GRAY2_BITMAP:
+    case GGO_GRAY4_BITMAP:
+    case GGO_GRAY8_BITMAP:
+    case WINE_GGO_GRAY16_BITMAP:
+    case WINE_GGO_HRGB_BITMAP:
+    case WINE_GGO_HBGR_BITMAP:
+    case WINE_GGO_VRGB_BITMAP:
+    case WINE_GGO_VBGR_BITMAP:
+        return TRUE;
+    }
+    return FALSE;
+}
+
+static inline unsigned int glyph_cache_hash( UINT glyph, UINT format )
+{
+    return (glyph ^ (format << 4)) % GLYPH_CACHE_BUCKETS;
+}
+
+static struct glyph_bitmap *find_glyph_bitmap( GdiFont *font, UINT glyph, UINT format )
+{
+    struct glyph_bitmap *bitmap;
+
+    if (!font->glyph_cache) return NULL;
+    LIST_FOR_EACH_ENTRY( bitmap, &font->glyph_cache[glyph_cache_hash( glyph, format )],
+                         struct glyph_bitmap, entry )
+    {
+        if (bitmap->glyph != glyph || bitmap->format != format) continue;
+        list_remove( &bitmap->lru_entry );
+        list_add_head( &glyph_cache_lru, &bitmap->lru_entry );
+        return bitmap;
+    }
+    return NULL;
+}
+
+static struct glyph_bitmap *add_glyph_bitmap( GdiFont *font, UINT glyph, UINT format, const MAT2 *lpmat )
+{
+    struct glyph_bitmap *bitmap;
+    GLYPHMETRICS gm;
+    SIZE_T alloc_size;
+    DWORD size;
+    unsigned int i;
+
+    size = get_glyph_outline( font, glyph, format, &gm, 0, NULL, lpmat );
+    if (size == GDI_ERROR) return NULL;
+    alloc_size = FIELD_OFFSET( struct glyph_bitmap, bits[size] );
+    if (alloc_size > glyph_cache_max_size / 8) return NULL;
+
+    if (!font->glyph_cache)
+    {
+        if (!(font->glyph_cache = HeapAlloc( GetProcessHeap(), 0, GLYPH_CACHE_BUCKETS * sizeof(struct list) )))
+            return NULL;
+        for (i = 0; i < GLYPH_CACHE_BUCKETS; i++) list_init( &font->glyph_cache[i] );
+    }
+
+    while (glyph_cache_size + alloc_size > glyph_cache_max_size)
+        free_glyph_bitmap( LIST_ENTRY( list_tail( &glyph_cache_lru ), struct glyph_bitmap, lru_entry ));
+
+    if (!(bitmap = HeapAlloc( GetProcessHeap(), HEAP_ZERO_MEMORY, alloc_size ))) return NULL;
+    if (size && get_glyph_outline( font, glyph, format, &gm, size, bitmap->bits, lpmat ) == GDI_ERROR)
+    {
+        HeapFree( GetProcessHeap(), 0, bitmap );
+        return NULL;
+    }
+    bitmap->font   = font;
+    bitmap->glyph  = glyph;
+    bitmap->format = format;
+    bitmap->gm     = gm;
+    bitmap->size   = size;
+    list_add_head( &font->glyph_cache[glyph_cache_hash( glyph, format )], &bitmap->entry );
+    list_add_head( &glyph_cache_lru, &bitmap->lru_entry );
+    glyph_cache_size += alloc_size;
+    return bitmap;
+}
+
+/*************************************************************
+ * get_cached_glyph_outline
+ *
+ * Same as get_glyph_outline, but keeps the rendered bitmaps around so
+ * that text redrawn with the same font doesn't get rasterized again.
+ * The cache is attached to the GdiFont, so it's shared by all the DCs
+ * using that font; custom transforms are never cached.
+ */
+static DWORD get_cached_glyph_outline( GdiFont *font, UINT glyph, UINT format, GLYPHMETRICS *lpgm,
+                                       DWORD buflen, void *buf, const MAT2 *lpmat )
+{
+    struct glyph_bitmap *bitmap;
+
+    if (!glyph_cache_max_size || !is_cacheable_glyph_format( format ) || !is_identity_MAT2( lpmat ))
+        return get_glyph_outline( font, glyph, format, lpgm, buflen, buf, lpmat );
+
+    if (!(bitmap = find_glyph_bitmap( font, glyph, format )) &&
+        !(bitmap = add_glyph_bitmap( font, glyph, format, lpmat )))
+        return get_glyph_outline( font, glyph, format, lpgm, buflen, buf, lpmat );
+
+    TRACE( "cached %p glyph %04x format %x\n", font, glyph, format );
+    *lpgm = bitmap->gm;
+    if (buf) memcpy( buf, bitmap->bits, min( buflen, bitmap->size ));
+    return bitmap->size;
+}
+
 /*************************************************************
  * freetype_GetGlyphOutline
  */
@@ -6873,7 +7515,7 @@ static DWORD freetype_GetGlyphOutline( PHYSDEV dev, UINT glyph, UINT format,
 
     GDI_CheckNotLock();
     EnterCriticalSection( &freetype_cs );
-    ret = get_glyph_outline( physdev->font, glyph, format, lpgm, buflen, buf, lpmat );
+    ret = get_cached_glyph_outline( physdev->font, glyph, format, lpgm, buflen, buf, lpmat );
     LeaveCriticalSection( &freetype_cs );
     return ret;
 }
@@ -3009,6 +3009,23 @@ static void check_StretchBlt_pixel(HDC hdcDst, HDC hdcSrc, UINT32 *dstBuffer, UI
         dwRop, expected, *dstBuffer, line);
 }
 
+static void check_StretchBlt_halftone(HDC hdcDst, HDC hdcSrc, UINT32 *dstBuffer, UINT32 *srcBuffer,
+                                     const BYTE *src, int nWidthSrc, const BYTE *expected, int nWidthDest,
+                                     int line)
+{
+    int i;
+
+    /* gray pixels on a single row, the expected values allow for rounding differences */
+    for (i = 0; i < nWidthSrc; i++) srcBuffer[i] = src[i] * 0x010101;
+    memset(dstBuffer, 0, 16 * sizeof(*dstBuffer));
+    StretchBlt(hdcDst, 0, 0, nWidthDest, 1, hdcSrc, 0, 0, nWidthSrc, 1, SRCCOPY);
+    for (i = 0; i < nWidthDest; i++)
+        ok(abs((int)(dstBuffer[i] & 0xff) - expected[i]) <= 2 &&
+           (dstBuffer[i] & 0xffffff) == (dstBuffer[i] & 0xff) * 0x010101,
+           "StretchBlt %d->%d pixel %d: expected about 0x%02x, got 0x%08X from line %d\n",
+           nWidthSrc, nWidthDest, i, expected[i], dstBuffer[i], line);
+}
+
 static void check_StretchBlt_stretch(HDC hdcDst, HDC hdcSrc, BITMAPINFO *dst_info, UINT32 *dstBuffer, UINT32 *srcBuffer,
                                      int nXOriginDest, int nYOriginDest, int nWidthDest, int nHeightDest,
                                      int nXOriginSrc, int nYOriginSrc, int nWidthSrc, int nHeightSrc,
@@ -3038,6 +3055,12 @@ static void test_StretchBlt(void)
     BITMAPINFO biDst, biSrc;
     UINT32 expected[256];
     RGBQUAD colors[2];
+    UINT i;
+    static const BYTE black_white[] = {0x00, 0xff};
+    static const BYTE gradient[] = {0x00, 0x55, 0xaa, 0xff};
+    static const BYTE expect_2_3[] = {0x00, 0x80, 0xff};
+    static const BYTE expect_2_4[] = {0x00, 0x40, 0xbf, 0xff};
+    static const BYTE expect_4_2[] = {0x2b, 0xd5};
 
     memset(&biDst, 0, sizeof(BITMAPINFO));
     biDst.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
@@ -3321,6 +3344,31 @@ static void test_StretchBlt(void)
     SelectObject(hdcSrc, oldSrc);
     DeleteObject(bmpSrc);
 
+    /* HALFTONE stretching of a single color keeps the color */
+    bmpSrc = CreateDIBSection(hdcScreen, &biSrc, DIB_RGB_COLORS, (void**)&srcBuffer, NULL, 0);
+    oldSrc = SelectObject(hdcSrc, bmpSrc);
+    for (i = 0; i < 256; i++) srcBuffer[i] = 0x00408020;
+    SetStretchBltMode(hdcDst, HALFTONE);
+
+    memset(dstBuffer, 0, 256 * sizeof(*dstBuffer));
+    StretchBlt(hdcDst, 0, 0, 7, 3, hdcSrc, 0, 0, 4, 4, SRCCOPY);
+    for (i = 0; i < 3 * 16; i++)
+        if (i % 16 < 7) ok((dstBuffer[i] & 0xffffff) == 0x408020, "%u: got %08x\n", i, dstBuffer[i]);
+
+    memset(dstBuffer, 0, 256 * sizeof(*dstBuffer));
+    StretchBlt(hdcDst, 0, 0, 3, 5, hdcSrc, 0, 0, 16, 16, SRCCOPY);
+    for (i = 0; i < 5 * 16; i++)
+        if (i % 16 < 3) ok((dstBuffer[i] & 0xffffff) == 0x408020, "%u: got %08x\n", i, dstBuffer[i]);
+
+    /* growing interpolates between the pixels, shrinking averages them */
+    check_StretchBlt_halftone(hdcDst, hdcSrc, dstBuffer, srcBuffer, black_white, 2, expect_2_3, 3, __LINE__);
+    check_StretchBlt_halftone(hdcDst, hdcSrc, dstBuffer, srcBuffer, black_white, 2, expect_2_4, 4, __LINE__);
+    check_StretchBlt_halftone(hdcDst, hdcSrc, dstBuffer, srcBuffer, gradient, 4, expect_4_2, 2, __LINE__);
+
+    SetStretchBltMode(hdcDst, BLACKONWHITE);
+    SelectObject(hdcSrc, oldSrc);
+    DeleteObject(bmpSrc);
+
     DeleteDC(hdcSrc);
 
     SelectObject(hdcDst, oldDst);
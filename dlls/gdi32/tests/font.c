@@ -3531,6 +3531,30 @@ static void test_GetGlyphOutline(void)
        ok(GetLastError() == 0xdeadbeef, "expected 0xdeadbeef, got %u\n", GetLastError());
     }
 
+    /* rendering the same glyph twice must give the same bitmap */
+    memset(&gm, 0, sizeof(gm));
+    ret = GetGlyphOutlineW(hdc, 'A', GGO_GRAY4_BITMAP, &gm, 0, NULL, &mat);
+    if (ret != GDI_ERROR && ret > 0)
+    {
+        BYTE *buf1 = HeapAlloc(GetProcessHeap(), 0, ret);
+        BYTE *buf2 = HeapAlloc(GetProcessHeap(), 0, ret);
+
+        memset(buf1, 0xcc, ret);
+        memset(buf2, 0xcc, ret);
+        memset(&gm2, 0, sizeof(gm2));
+        ret2 = GetGlyphOutlineW(hdc, 'A', GGO_GRAY4_BITMAP, &gm2, ret, buf1, &mat);
+        ok(ret2 == ret, "expected %d, got %d\n", ret, ret2);
+        ok(!memcmp(&gm, &gm2, sizeof(gm)), "metrics differ\n");
+        memset(&gm2, 0, sizeof(gm2));
+        ret2 = GetGlyphOutlineW(hdc, 'A', GGO_GRAY4_BITMAP, &gm2, ret, buf2, &mat);
+        ok(ret2 == ret, "expected %d, got %d\n", ret, ret2);
+        ok(!memcmp(&gm, &gm2, sizeof(gm)), "metrics differ\n");
+        ok(!memcmp(buf1, buf2, ret), "bitmaps differ\n");
+
+        HeapFree(GetProcessHeap(), 0, buf1);
+        HeapFree(GetProcessHeap(), 0, buf2);
+    }
+
     SelectObject(hdc, old_hfont);
     DeleteObject(hfont);
 
@@ -38,6 +38,7 @@
 #define HEAP_VALIDATE_PARAMS  0x40000000
 
 static BOOL (WINAPI *pHeapQueryInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T, PSIZE_T);
+static BOOL (WINAPI *pHeapSetInformation)(HANDLE, HEAP_INFORMATION_CLASS, PVOID, SIZE_T);
 static ULONG (WINAPI *pRtlGetNtGlobalFlags)(void);
 
 struct heap_layout
@@ -535,6 +536,67 @@ static void test_HeapQueryInformation(void)
     ok(info == 0 || info == 1 || info == 2, "expected 0, 1 or 2, got %u\n", info);
 }
 
+static void test_HeapSetInformation(void)
+{
+    BYTE *ptrs[64];
+    HANDLE heap;
+    ULONG info;
+    SIZE_T size, i, j;
+    BOOL ret;
+
+    pHeapSetInformation = (void *)GetProcAddress(GetModuleHandle("kernel32.dll"), "HeapSetInformation");
+    if (!pHeapSetInformation || !pHeapQueryInformation)
+    {
+        win_skip("HeapSetInformation is not available\n");
+        return;
+    }
+
+    heap = HeapCreate( 0, 0, 0 );
+    ok( heap != NULL, "HeapCreate failed\n" );
+
+    info = 2;
+    SetLastError(0xdeadbeef);
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &info, 0 );
+    ok( !ret, "HeapSetInformation should fail\n" );
+
+    ret = pHeapSetInformation( heap, HeapCompatibilityInformation, &info, sizeof(info) );
+    if (!ret)
+    {
+        skip( "low fragmentation heap not available\n" );
+        HeapDestroy( heap );
+        return;
+    }
+
+    info = 0xdeadbeef;
+    ret = pHeapQueryInformation( heap, HeapCompatibilityInformation, &info, sizeof(info), &size );
+    ok( ret, "HeapQueryInformation error %u\n", GetLastError() );
+    ok( info == 2, "expected 2, got %u\n", info );
+
+    for (j = 0; j < 3; j++)
+    {
+        for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++)
+        {
+            ptrs[i] = HeapAlloc( heap, HEAP_ZERO_MEMORY, i * 7 + 1 );
+            ok( ptrs[i] != NULL, "HeapAlloc failed for size %lu\n", i * 7 + 1 );
+            size = HeapSize( heap, 0, ptrs[i] );
+            ok( size == i * 7 + 1, "wrong size %lu for %lu\n", size, i * 7 + 1 );
+            ok( !ptrs[i][i * 7], "block %lu not zeroed\n", i );
+            memset( ptrs[i], 0xcc, i * 7 + 1 );
+        }
+        ret = HeapValidate( heap, 0, NULL );
+        ok( ret, "HeapValidate failed\n" );
+        for (i = 0; i < sizeof(ptrs) / sizeof(ptrs[0]); i++)
+        {
+            ret = HeapFree( heap, 0, ptrs[i] );
+            ok( ret, "HeapFree failed\n" );
+        }
+        ret = HeapValidate( heap, 0, NULL );
+        ok( ret, "HeapValidate failed\n" );
+    }
+
+    HeapDestroy( heap );
+}
+
 static void test_heap_checks( DWORD flags )
 {
     BYTE old, *p, *p2;
@@ -852,6 +914,7 @@ START_TEST(heap)
     test_sized_HeapReAlloc((1 << 20), (2 << 20));
     test_sized_HeapReAlloc((1 << 20), 1);
     test_HeapQueryInformation();
+    test_HeapSetInformation();
 
     if (pRtlGetNtGlobalFlags)
     {
@@ -1031,12 +1031,24 @@ static void CALLBACK timeout_function(PVOID p, BOOLEAN TimerOrWaitFired)
     ok(TimerOrWaitFired, "wait should have timed out\n");
 }
 
+static LONG multiple_count;
+
+static void CALLBACK multiple_function(PVOID p, BOOLEAN TimerOrWaitFired)
+{
+    HANDLE event = p;
+    ok(!TimerOrWaitFired, "wait shouldn't have timed out\n");
+    if (InterlockedIncrement(&multiple_count) == 100) SetEvent(event);
+}
+
 static void test_RegisterWaitForSingleObject(void)
 {
     BOOL ret;
     HANDLE wait_handle;
     HANDLE handle;
     HANDLE complete_event;
+    HANDLE wait_handles[100], handles[100];
+    DWORD result;
+    int i;
 
     if (!pRegisterWaitForSingleObject || !pUnregisterWait)
     {
@@ -1080,6 +1092,33 @@ static void test_RegisterWaitForSingleObject(void)
 
     ret = pUnregisterWait(wait_handle);
     ok(ret, "UnregisterWait failed with error %d\n", GetLastError());
+
+    /* test more waits than a single thread can wait for */
+
+    for (i = 0; i < 100; i++)
+    {
+        handles[i] = CreateEvent(NULL, TRUE, FALSE, NULL);
+        ret = pRegisterWaitForSingleObject(&wait_handles[i], handles[i], multiple_function, complete_event,
+                                           INFINITE, WT_EXECUTEONLYONCE);
+        ok(ret, "RegisterWaitForSingleObject failed with error %d\n", GetLastError());
+    }
+    for (i = 0; i < 100; i++) SetEvent(handles[i]);
+
+    result = WaitForSingleObject(complete_event, 5000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+    /* give worker threads chance to complete */
+    Sleep(100);
+    ok(multiple_count == 100, "expected 100 callbacks, got %d\n", multiple_count);
+
+    for (i = 0; i < 100; i++)
+    {
+        ret = pUnregisterWait(wait_handles[i]);
+        ok(ret, "UnregisterWait failed with error %d\n", GetLastError());
+        CloseHandle(handles[i]);
+    }
+
+    CloseHandle(complete_event);
+    CloseHandle(handle);
 }
 
 static DWORD TLS_main;
@@ -25,6 +25,7 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #ifdef HAVE_SYS_SYSCALL_H
 #include <sys/syscall.h>
@@ -39,6 +40,31 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(ntdll);
 WINE_DECLARE_DEBUG_CHANNEL(relay);
+WINE_DECLARE_DEBUG_CHANNEL(lockstats);
+
+/* Adaptive spinning: the spin count of the section is only an upper bound,
+ * the actual number of iterations follows the recent history of the lock,
+ * stored in DebugInfo->EntryCount (which is otherwise unused). */
+#define MIN_SPIN_COUNT 16
+
+/* Contention profiler, enabled with WINEDEBUG=+lockstats and dumped when the
+ * process exits; sections are identified by their name in DebugInfo->Spare[0],
+ * or by their address for unnamed ones. The names are copied, since the
+ * modules that own them may be unloaded by the time the profile is dumped. */
+#define LOCK_STATS_SIZE 1024  /* must be a power of 2 */
+
+struct lock_stats
+{
+    const void *key;
+    char        name[64];      /* empty for unnamed sections */
+    LONG        acquisitions;
+    LONG        contentions;
+    LONGLONG    wait_time;     /* in 100ns units */
+};
+
+static struct lock_stats *lock_stats;
+static LONG lock_stats_init;
+static int lock_stats_enabled = -1;
 
 static inline LONG interlocked_inc( PLONG dest )
 {
@@ -59,6 +85,120 @@ static inline void small_pause(void)
 #endif
 }
 
+static inline ULONG get_spin_limit( RTL_CRITICAL_SECTION *crit )
+{
+    ULONG limit = crit->SpinCount;
+
+    if (crit->DebugInfo) limit = min( limit, crit->DebugInfo->EntryCount * 2 + MIN_SPIN_COUNT );
+    return limit;
+}
+
+/* move the spin estimate towards the iterations it took to get the lock,
+ * and back off when spinning didn't help; races only lose an update */
+static inline void update_spin_estimate( RTL_CRITICAL_SECTION *crit, ULONG count, BOOL acquired )
+{
+    LONG estimate;
+
+    if (!crit->DebugInfo) return;
+    estimate = crit->DebugInfo->EntryCount;
+    if (acquired) estimate += ((LONG)count - estimate) / 8;
+    else estimate -= estimate / 8;
+    crit->DebugInfo->EntryCount = estimate;
+}
+
+static inline BOOL lock_stats_on(void)
+{
+    if (lock_stats_enabled == -1) lock_stats_enabled = TRACE_ON(lockstats);
+    return lock_stats_enabled;
+}
+
+static struct lock_stats *get_lock_stats( RTL_CRITICAL_SECTION *crit )
+{
+    const char *name = crit->DebugInfo ? (const char *)crit->DebugInfo->Spare[0] : NULL;
+    const void *key = name ? (const void *)name : crit;
+    struct lock_stats *table = lock_stats, *entry;
+    unsigned int i, hash;
+
+    if (!table)
+    {
+        void *ptr = NULL;
+        SIZE_T size = LOCK_STATS_SIZE * sizeof(*table);
+
+        /* allocating enters the virtual memory section, don't recurse */
+        if (interlocked_cmpxchg( &lock_stats_init, 1, 0 )) return NULL;
+        if (NtAllocateVirtualMemory( NtCurrentProcess(), &ptr, 0, &size, MEM_COMMIT, PAGE_READWRITE ))
+            return NULL;
+        lock_stats = table = ptr;
+    }
+
+    hash = (ULONG_PTR)key >> 3;
+    for (i = 0; i < LOCK_STATS_SIZE; i++)
+    {
+        entry = &table[(hash + i) & (LOCK_STATS_SIZE - 1)];
+        if (entry->key == key) return entry;
+        if (entry->key) continue;
+        if (!interlocked_cmpxchg_ptr( (void **)&entry->key, (void *)key, NULL ))
+        {
+            /* the table is zero-initialized, so the name stays null-terminated */
+            if (name)
+                for (i = 0; i < sizeof(entry->name) - 1 && name[i]; i++) entry->name[i] = name[i];
+            return entry;
+        }
+        if (entry->key == key) return entry;
+    }
+    return NULL;  /* table is full */
+}
+
+static void record_lock_stats( RTL_CRITICAL_SECTION *crit, BOOL contended, LONGLONG wait_time )
+{
+    struct lock_stats *stats = get_lock_stats( crit );
+    LONGLONG total;
+
+    if (!stats) return;
+    interlocked_xchg_add( &stats->acquisitions, 1 );
+    if (!contended) return;
+    interlocked_xchg_add( &stats->contentions, 1 );
+    do total = stats->wait_time;
+    while (interlocked_cmpxchg64( &stats->wait_time, total + wait_time, total ) != total);
+}
+
+static int compare_lock_stats( const void *p1, const void *p2 )
+{
+    const struct lock_stats *stats1 = p1, *stats2 = p2;
+
+    if (stats1->wait_time != stats2->wait_time) return stats1->wait_time < stats2->wait_time ? 1 : -1;
+    return stats2->contentions - stats1->contentions;
+}
+
+/***********************************************************************
+ *           critsection_dump_statistics
+ *
+ * Dump the contention profile of the critical sections, worst first.
+ */
+void critsection_dump_statistics(void)
+{
+    struct lock_stats *stats = lock_stats;
+    unsigned int i;
+
+    if (!stats || !TRACE_ON(lockstats)) return;
+
+    qsort( stats, LOCK_STATS_SIZE, sizeof(*stats), compare_lock_stats );
+    for (i = 0; i < LOCK_STATS_SIZE; i++)
+    {
+        if (!stats[i].key || !stats[i].contentions) continue;
+        if (stats[i].name[0])
+            TRACE_(lockstats)( "section %s: acquired %u contended %u wait %s.%04u ms\n",
+                               debugstr_a(stats[i].name), stats[i].acquisitions, stats[i].contentions,
+                               wine_dbgstr_longlong( stats[i].wait_time / 10000 ),
+                               (UINT)(stats[i].wait_time % 10000) );
+        else
+            TRACE_(lockstats)( "section %p: acquired %u contended %u wait %s.%04u ms\n",
+                               stats[i].key, stats[i].acquisitions, stats[i].contentions,
+                               wine_dbgstr_longlong( stats[i].wait_time / 10000 ),
+                               (UINT)(stats[i].wait_time % 10000) );
+    }
+}
+
 #ifdef __linux__
 
 static int wait_op = 128; /*FUTEX_WAIT|FUTEX_PRIVATE_FLAG*/
@@ -308,7 +448,8 @@ NTSTATUS WINAPI RtlInitializeCriticalSectionAndSpinCount( RTL_CRITICAL_SECTION *
  */
 NTSTATUS WINAPI RtlInitializeCriticalSectionEx( RTL_CRITICAL_SECTION *crit, ULONG spincount, ULONG flags )
 {
-    if (flags & (RTL_CRITICAL_SECTION_FLAG_DYNAMIC_SPIN|RTL_CRITICAL_SECTION_FLAG_STATIC_INIT))
+    /* the spin count is always adjusted dynamically */
+    if (flags & RTL_CRITICAL_SECTION_FLAG_STATIC_INIT)
         FIXME("(%p,%u,0x%08x) semi-stub\n", crit, spincount, flags);
 
     /* FIXME: if RTL_CRITICAL_SECTION_FLAG_STATIC_INIT is given, we should use
@@ -527,20 +668,34 @@ NTSTATUS WINAPI RtlpUnWaitCriticalSection( RTL_CRITICAL_SECTION *crit )
  */
 NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
 {
+    LARGE_INTEGER start, end;
+    BOOL contended = FALSE;
+
     if (crit->SpinCount)
     {
-        ULONG count;
+        ULONG count, limit;
 
-        if (RtlTryEnterCriticalSection( crit )) return STATUS_SUCCESS;
-        for (count = crit->SpinCount; count > 0; count--)
+        if (RtlTryEnterCriticalSection( crit )) goto acquired;
+        if (lock_stats_on())
+        {
+            NtQuerySystemTime( &start );
+            contended = TRUE;
+        }
+        limit = get_spin_limit( crit );
+        for (count = 0; count < limit; count++)
         {
             if (crit->LockCount > 0) break;  /* more than one waiter, don't bother spinning */
             if (crit->LockCount == -1)       /* try again */
             {
-                if (interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1) goto done;
+                if (interlocked_cmpxchg( &crit->LockCount, 0, -1 ) == -1)
+                {
+                    update_spin_estimate( crit, count, TRUE );
+                    goto done;
+                }
             }
             small_pause();
         }
+        update_spin_estimate( crit, count, FALSE );
     }
 
     if (interlocked_inc( &crit->LockCount ))
@@ -548,7 +703,13 @@ NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
         if (crit->OwningThread == ULongToHandle(GetCurrentThreadId()))
         {
             crit->RecursionCount++;
-            return STATUS_SUCCESS;
+            goto acquired;
+        }
+
+        if (!contended && lock_stats_on())
+        {
+            NtQuerySystemTime( &start );
+            contended = TRUE;
         }
 
         /* Now wait for it */
@@ -557,6 +718,12 @@ NTSTATUS WINAPI RtlEnterCriticalSection( RTL_CRITICAL_SECTION *crit )
 done:
     crit->OwningThread   = ULongToHandle(GetCurrentThreadId());
     crit->RecursionCount = 1;
+acquired:
+    if (lock_stats_on())
+    {
+        if (contended) NtQuerySystemTime( &end );
+        record_lock_stats( crit, contended, contended ? end.QuadPart - start.QuadPart : 0 );
+    }
     return STATUS_SUCCESS;
 }
 
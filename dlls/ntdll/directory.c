@@ -1524,6 +1524,37 @@ static char *read_first_dent_name( int which, int fd, off_t second_offs, KERNEL_
     return de->d_ino ? de->d_name : NULL;
 }
 
+/* Buffer for getdents64 results, kept across calls so that the entries that
+ * didn't fit in the caller's buffer can be returned by the next call on the
+ * same directory without reading them again. dir_section must be held. */
+
+#define DIR_BATCH_SIZE 65536
+
+static struct
+{
+    char                *data;
+    struct file_identity dir;     /* directory the entries belong to */
+    off_t                pos;     /* directory position of the first remaining entry */
+    off_t                end_pos; /* directory position after the last entry */
+    int                  start;   /* offset of the first remaining entry in data */
+    int                  len;     /* length of valid data, 0 if nothing is cached */
+} dir_batch;
+
+/* save the entries that haven't been returned yet for the next call */
+static void save_dir_batch( const char *data, KERNEL_DIRENT64 *de, int res, off_t pos )
+{
+    KERNEL_DIRENT64 *last = de;
+
+    if (data != dir_batch.data || res <= 0) return;
+    while ((char *)last + last->d_reclen < (char *)de + res)
+        last = (KERNEL_DIRENT64 *)((char *)last + last->d_reclen);
+    dir_batch.dir     = curdir;
+    dir_batch.pos     = pos;
+    dir_batch.end_pos = last->d_off;
+    dir_batch.start   = (char *)de - data;
+    dir_batch.len     = dir_batch.start + res;
+}
+
 /***********************************************************************
  *           read_directory_getdents
  *
@@ -1541,10 +1572,17 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
     KERNEL_DIRENT64 *de, *de_first_two = NULL;
     union file_directory_info *info, *last_info = NULL;
     const char *filename;
-    BOOL data_buffer_changed;
+    BOOL data_buffer_changed, cached = FALSE;
     int res, swap_to;
 
-    if (size <= sizeof(local_buffer) || !(data = RtlAllocateHeap( GetProcessHeap(), 0, size )))
+    if (!dir_batch.data) dir_batch.data = RtlAllocateHeap( GetProcessHeap(), 0, DIR_BATCH_SIZE );
+
+    if (size <= DIR_BATCH_SIZE && dir_batch.data)
+    {
+        size = DIR_BATCH_SIZE;
+        data = dir_batch.data;
+    }
+    else if (size <= sizeof(local_buffer) || !(data = RtlAllocateHeap( GetProcessHeap(), 0, size )))
     {
         size = sizeof(local_buffer);
         data = local_buffer;
@@ -1557,14 +1595,30 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
         if (old_pos == -1)
         {
             io->u.Status = (errno == ENOENT) ? STATUS_NO_MORE_FILES : FILE_GetNtStatus();
+            dir_batch.len = 0;
             res = 0;
             goto done;
         }
+        cached = (data == dir_batch.data && dir_batch.len && dir_batch.pos == old_pos &&
+                  dir_batch.dir.dev == curdir.dev && dir_batch.dir.ino == curdir.ino);
     }
 
     io->u.Status = STATUS_SUCCESS;
     de = (KERNEL_DIRENT64 *)data;
 
+    if (cached)
+    {
+        /* continue with the entries left over by the previous call */
+        TRACE( "reusing %d bytes of entries at pos %s\n",
+               dir_batch.len - dir_batch.start, wine_dbgstr_longlong(old_pos) );
+        de = (KERNEL_DIRENT64 *)(data + dir_batch.start);
+        res = dir_batch.len - dir_batch.start;
+        lseek( fd, dir_batch.end_pos, SEEK_SET );
+        dir_batch.len = 0;
+        goto have_entries;
+    }
+    dir_batch.len = 0;
+
     /* if old_pos is not 0 we don't know how many entries have been returned already,
      * so maintain second_entry_pos to know when to return '..' */
     if (old_pos != 0 && (last_dir_id.dev != curdir.dev || last_dir_id.ino != curdir.ino))
@@ -1590,6 +1644,7 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
         goto done;
     }
 
+have_entries:
     if (old_pos == 0 && res > 0)
     {
         second_entry_pos = de->d_off;
@@ -1603,6 +1658,7 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
         res -= de->d_reclen;
         next_pos = de->d_off;
         filename = NULL;
+        data_buffer_changed = FALSE;
 
         /* we must return first 2 entries as "." and "..", but getdents64()
          * can return them anywhere, so swap first entries with "." and ".." */
@@ -1613,7 +1669,6 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
         else if (!strcmp( de->d_name, "." ) || !strcmp( de->d_name, ".." ))
         {
             swap_to = !strcmp( de->d_name, "." ) ? 0 : 1;
-            data_buffer_changed = FALSE;
 
             filename = read_first_dent_name( swap_to, fd, second_entry_pos, de_first_two,
                                              data, size, &data_buffer_changed );
@@ -1635,12 +1690,17 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
             if (io->u.Status == STATUS_BUFFER_OVERFLOW)
             {
                 lseek( fd, old_pos, SEEK_SET );  /* restore pos to previous entry */
+                if (!data_buffer_changed) save_dir_batch( data, de, res + de->d_reclen, old_pos );
                 break;
             }
             /* check if we still have enough space for the largest possible entry */
             if (single_entry || io->Information + max_dir_info_size(class) > length)
             {
-                if (res > 0) lseek( fd, next_pos, SEEK_SET );  /* set pos to next entry */
+                if (res > 0)
+                {
+                    lseek( fd, next_pos, SEEK_SET );  /* set pos to next entry */
+                    save_dir_batch( data, (KERNEL_DIRENT64 *)((char *)de + de->d_reclen), res, next_pos );
+                }
                 break;
             }
         }
@@ -1659,7 +1719,7 @@ static int read_directory_getdents( int fd, IO_STATUS_BLOCK *io, void *buffer, U
     else io->u.Status = restart_scan ? STATUS_NO_SUCH_FILE : STATUS_NO_MORE_FILES;
     res = 0;
 done:
-    if (data != local_buffer) RtlFreeHeap( GetProcessHeap(), 0, data );
+    if (data != local_buffer && data != dir_batch.data) RtlFreeHeap( GetProcessHeap(), 0, data );
     return res;
 }
 
@@ -2094,6 +2154,245 @@ NTSTATUS WINAPI NtQueryDirectoryFile( HANDLE handle, HANDLE event,
 }
 
 
+/* Cache of the names of recently scanned directories, used to resolve
+ * case-insensitive lookups without reading the whole directory again.
+ * A cache is only trusted as long as the modification time, inode and
+ * device of the directory are unchanged; directories modified during the
+ * last couple of seconds are not cached at all, since a change in the same
+ * time stamp tick couldn't be detected. Directories with too many names are
+ * remembered without their names, so that they aren't read again on every
+ * lookup only to find out that they don't fit. */
+
+#define MAX_DIR_CACHES      16
+#define MAX_DIR_CACHE_NAMES 65536
+#define DIR_CACHE_MIN_AGE   2  /* seconds */
+
+struct dir_cache_name
+{
+    struct dir_cache_name *next;       /* next in hash chain */
+    unsigned int           hash;
+    BOOL                   is_short;   /* generated short name of a long file name */
+    int                    len;        /* length of the lower-cased name */
+    const char            *unix_name;
+    WCHAR                  name[1];    /* lower-cased name, followed by the Unix name */
+};
+
+struct dir_cache
+{
+    struct list             entry;     /* entry in dir_caches, most recently used first */
+    char                   *path;
+    dev_t                   dev;
+    ino_t                   ino;
+    time_t                  mtime;
+    time_t                  ctime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    long                    mtime_nsec;
+#endif
+    BOOL                    too_large;  /* too many names, the directory has to be searched */
+    unsigned int            count;
+    unsigned int            hash_size;  /* power of 2 */
+    struct dir_cache_name **names;
+};
+
+static struct list dir_caches = LIST_INIT( dir_caches );
+static unsigned int nb_dir_caches;
+
+static unsigned int dir_cache_hash( const WCHAR *name, int len )
+{
+    unsigned int hash = 2166136261u;
+    while (len--) hash = (hash ^ tolowerW( *name++ )) * 16777619;
+    return hash;
+}
+
+static BOOL dir_cache_is_valid( const struct dir_cache *cache, const struct stat *st )
+{
+    return cache->dev == st->st_dev && cache->ino == st->st_ino &&
+           cache->mtime == st->st_mtime && cache->ctime == st->st_ctime
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+           && cache->mtime_nsec == st->st_mtim.tv_nsec
+#endif
+           ;
+}
+
+static void free_dir_cache_names( struct dir_cache *cache )
+{
+    struct dir_cache_name *ptr, *next;
+    unsigned int i;
+
+    for (i = 0; i < cache->hash_size; i++)
+    {
+        for (ptr = cache->names[i]; ptr; ptr = next)
+        {
+            next = ptr->next;
+            RtlFreeHeap( GetProcessHeap(), 0, ptr );
+        }
+    }
+    RtlFreeHeap( GetProcessHeap(), 0, cache->names );
+    cache->names = NULL;
+    cache->hash_size = 0;
+    cache->count = 0;
+}
+
+static void free_dir_cache( struct dir_cache *cache )
+{
+    list_remove( &cache->entry );
+    nb_dir_caches--;
+    free_dir_cache_names( cache );
+    RtlFreeHeap( GetProcessHeap(), 0, cache->path );
+    RtlFreeHeap( GetProcessHeap(), 0, cache );
+}
+
+static BOOL dir_cache_add( struct dir_cache *cache, const WCHAR *name, int len,
+                           const char *unix_name, BOOL is_short )
+{
+    struct dir_cache_name *ptr;
+    int i, unix_len = strlen( unix_name ) + 1;
+
+    if (!(ptr = RtlAllocateHeap( GetProcessHeap(), 0,
+                                 FIELD_OFFSET( struct dir_cache_name, name[len] ) + unix_len )))
+        return FALSE;
+    for (i = 0; i < len; i++) ptr->name[i] = tolowerW( name[i] );
+    ptr->len = len;
+    ptr->hash = dir_cache_hash( name, len );
+    ptr->is_short = is_short;
+    ptr->unix_name = (char *)&ptr->name[len];
+    memcpy( (char *)ptr->unix_name, unix_name, unix_len );
+    ptr->next = cache->names[ptr->hash & (cache->hash_size - 1)];
+    cache->names[ptr->hash & (cache->hash_size - 1)] = ptr;
+    cache->count++;
+    return TRUE;
+}
+
+/* read a directory into a new cache; must be called with dir_section held */
+static struct dir_cache *create_dir_cache( const char *path, const struct stat *st )
+{
+    WCHAR buffer[MAX_DIR_ENTRY_LEN], short_nameW[12];
+    struct dir_cache *cache;
+    UNICODE_STRING str;
+    BOOLEAN spaces;
+    struct dirent *de;
+    DIR *dir;
+    int len;
+
+    if (st->st_mtime + DIR_CACHE_MIN_AGE > time( NULL )) return NULL;
+
+    if (!(cache = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*cache) ))) return NULL;
+    list_add_head( &dir_caches, &cache->entry );
+    nb_dir_caches++;
+    cache->hash_size = 256;
+    cache->names = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, cache->hash_size * sizeof(*cache->names) );
+    cache->path = RtlAllocateHeap( GetProcessHeap(), 0, strlen(path) + 1 );
+    if (!cache->names || !cache->path) goto failed;
+    strcpy( cache->path, path );
+
+    if (!(dir = opendir( path ))) goto failed;
+    str.Buffer = buffer;
+    str.MaximumLength = sizeof(buffer);
+    while ((de = readdir( dir )))
+    {
+        if (cache->count >= MAX_DIR_CACHE_NAMES)
+        {
+            cache->too_large = TRUE;
+            break;
+        }
+        if (cache->count >= cache->hash_size * 2)
+        {
+            /* grow the hash table */
+            struct dir_cache_name **names, *ptr, *next;
+            unsigned int i, size = cache->hash_size * 4;
+
+            if (!(names = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(*names) ))) break;
+            for (i = 0; i < cache->hash_size; i++)
+            {
+                for (ptr = cache->names[i]; ptr; ptr = next)
+                {
+                    next = ptr->next;
+                    ptr->next = names[ptr->hash & (size - 1)];
+                    names[ptr->hash & (size - 1)] = ptr;
+                }
+            }
+            RtlFreeHeap( GetProcessHeap(), 0, cache->names );
+            cache->names = names;
+            cache->hash_size = size;
+        }
+
+        len = ntdll_umbstowcs( 0, de->d_name, strlen(de->d_name), buffer, MAX_DIR_ENTRY_LEN );
+        if (len <= 0) continue;
+        if (!dir_cache_add( cache, buffer, len, de->d_name, FALSE )) break;
+
+        str.Length = len * sizeof(WCHAR);
+        if (!RtlIsNameLegalDOS8Dot3( &str, NULL, &spaces ) || spaces)
+        {
+            len = hash_short_file_name( &str, short_nameW );
+            if (!dir_cache_add( cache, short_nameW, len, de->d_name, TRUE )) break;
+        }
+    }
+    closedir( dir );
+    if (cache->too_large) free_dir_cache_names( cache );
+    else if (de) goto failed;  /* didn't get all the names */
+
+    cache->dev   = st->st_dev;
+    cache->ino   = st->st_ino;
+    cache->mtime = st->st_mtime;
+    cache->ctime = st->st_ctime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM
+    cache->mtime_nsec = st->st_mtim.tv_nsec;
+#endif
+    if (cache->too_large) TRACE( "%s has too many names to be cached\n", debugstr_a(path) );
+    else TRACE( "cached %u names for %s\n", cache->count, debugstr_a(path) );
+
+    if (nb_dir_caches > MAX_DIR_CACHES)
+        free_dir_cache( LIST_ENTRY( list_tail( &dir_caches ), struct dir_cache, entry ));
+    return cache;
+
+failed:
+    free_dir_cache( cache );
+    return NULL;
+}
+
+/* get an up-to-date cache for a directory, which may be marked too_large;
+ * must be called with dir_section held */
+static struct dir_cache *get_dir_cache( const char *path )
+{
+    struct dir_cache *cache;
+    struct stat st;
+
+    if (stat( path, &st ) == -1 || !S_ISDIR( st.st_mode )) return NULL;
+
+    LIST_FOR_EACH_ENTRY( cache, &dir_caches, struct dir_cache, entry )
+    {
+        if (strcmp( cache->path, path )) continue;
+        if (!dir_cache_is_valid( cache, &st ))
+        {
+            TRACE( "%s changed, discarding cache\n", debugstr_a(path) );
+            free_dir_cache( cache );
+            break;
+        }
+        list_remove( &cache->entry );
+        list_add_head( &dir_caches, &cache->entry );
+        return cache;
+    }
+    return create_dir_cache( path, &st );
+}
+
+static const char *dir_cache_lookup( const struct dir_cache *cache, const WCHAR *name, int length,
+                                     BOOL check_short )
+{
+    unsigned int hash = dir_cache_hash( name, length );
+    const struct dir_cache_name *ptr, *found = NULL;
+
+    for (ptr = cache->names[hash & (cache->hash_size - 1)]; ptr; ptr = ptr->next)
+    {
+        if (ptr->hash != hash || ptr->len != length) continue;
+        if (ptr->is_short && !check_short) continue;
+        if (memicmpW( ptr->name, name, length )) continue;
+        if (!ptr->is_short) return ptr->unix_name;
+        if (!found) found = ptr;  /* long names take precedence */
+    }
+    return found ? found->unix_name : NULL;
+}
+
+
 /***********************************************************************
  *           find_file_in_dir
  *
@@ -2109,6 +2408,7 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     BOOLEAN spaces;
     DIR *dir;
     struct dirent *de;
+    struct dir_cache *cache;
     struct stat st;
     int ret, used_default, is_name_8_dot_3;
 
@@ -2201,6 +2501,21 @@ static NTSTATUS find_file_in_dir( char *unix_name, int pos, const WCHAR *name, i
     }
 #endif /* VFAT_IOCTL_READDIR_BOTH */
 
+    RtlEnterCriticalSection( &dir_section );
+    if ((cache = get_dir_cache( unix_name )) && !cache->too_large)
+    {
+        const char *found = dir_cache_lookup( cache, name, length, is_name_8_dot_3 );
+        if (found)
+        {
+            unix_name[pos - 1] = '/';
+            strcpy( unix_name + pos, found );
+        }
+        RtlLeaveCriticalSection( &dir_section );
+        if (found) goto success;
+        goto not_found;
+    }
+    RtlLeaveCriticalSection( &dir_section );
+
     if (!(dir = opendir( unix_name )))
     {
         if (errno == ENOENT) return STATUS_OBJECT_PATH_NOT_FOUND;
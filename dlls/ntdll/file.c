@@ -355,6 +355,124 @@ NTSTATUS FILE_GetNtStatus(void)
     }
 }
 
+/***********************************************************************
+ *                  Asynchronous I/O on regular files
+ *
+ * Regular files are always ready as far as poll() is concerned, so the
+ * server async queues can't be used for them. Instead, large overlapped
+ * transfers at an explicit offset are handed to the thread pool, which
+ * completes them in whatever order they finish. This requires an event,
+ * since waiting on the file handle itself would return immediately.
+ */
+
+#define FILE_ASYNC_MIN_SIZE 0x10000  /* smaller transfers are usually served from the page cache */
+
+struct file_async_io
+{
+    int               fd;
+    BOOL              write;
+    HANDLE            handle;
+    HANDLE            event;
+    HANDLE            thread;     /* thread to queue the user APC to */
+    PIO_APC_ROUTINE   apc;
+    void             *apc_user;
+    ULONG_PTR         cvalue;
+    IO_STATUS_BLOCK  *io;
+    void             *buffer;
+    ULONG             length;
+    off_t             offset;
+};
+
+static DWORD CALLBACK file_async_io_proc( void *arg )
+{
+    struct file_async_io *async = arg;
+    NTSTATUS status;
+    ssize_t result;
+
+    do
+    {
+        if (async->write) result = pwrite( async->fd, async->buffer, async->length, async->offset );
+        else result = pread( async->fd, async->buffer, async->length, async->offset );
+    } while (result == -1 && errno == EINTR);
+
+    if (result == -1)
+    {
+        if (async->write && errno == EFAULT) status = STATUS_INVALID_USER_BUFFER;
+        else status = FILE_GetNtStatus();
+        result = 0;
+    }
+    else status = (result || async->write) ? STATUS_SUCCESS : STATUS_END_OF_FILE;
+    close( async->fd );
+
+    TRACE( "%p %s %u bytes at %s => %x\n", async->handle, async->write ? "wrote" : "read",
+           (ULONG)result, wine_dbgstr_longlong(async->offset), status );
+
+    /* make sure the information is visible before the final status */
+    async->io->Information = result;
+    interlocked_xchg( (int *)&async->io->u.Status, status );
+    if (async->apc)
+    {
+        NtQueueApcThread( async->thread, (PNTAPCFUNC)async->apc,
+                          (ULONG_PTR)async->apc_user, (ULONG_PTR)async->io, 0 );
+        NtClose( async->thread );
+    }
+    if (async->event) NtSetEvent( async->event, NULL );
+    if (async->cvalue) NTDLL_AddCompletion( async->handle, async->cvalue, status, result );
+    RtlFreeHeap( GetProcessHeap(), 0, async );
+    return 0;
+}
+
+/***********************************************************************
+ *           queue_file_async_io
+ *
+ * Start an overlapped read or write on a regular file in the thread pool.
+ * Takes ownership of the Unix fd if needs_close is set.
+ * Returns STATUS_PENDING on success; on failure the I/O should be done synchronously.
+ */
+static NTSTATUS queue_file_async_io( HANDLE handle, int fd, int needs_close, HANDLE event,
+                                     PIO_APC_ROUTINE apc, void *apc_user, IO_STATUS_BLOCK *io,
+                                     void *buffer, ULONG length, off_t offset, BOOL write )
+{
+    struct file_async_io *async;
+    NTSTATUS status;
+
+    if (!(async = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*async) ))) return STATUS_NO_MEMORY;
+
+    async->thread = 0;
+    if (apc && (status = NtDuplicateObject( NtCurrentProcess(), GetCurrentThread(), NtCurrentProcess(),
+                                            &async->thread, 0, 0, DUPLICATE_SAME_ACCESS )))
+        goto error;
+
+    if (needs_close) async->fd = fd;
+    else if ((async->fd = dup( fd )) == -1)
+    {
+        status = FILE_GetNtStatus();
+        goto error;
+    }
+
+    async->write    = write;
+    async->handle   = handle;
+    async->event    = event;
+    async->apc      = apc;
+    async->apc_user = apc_user;
+    async->cvalue   = apc ? 0 : (ULONG_PTR)apc_user;
+    async->io       = io;
+    async->buffer   = buffer;
+    async->length   = length;
+    async->offset   = offset;
+
+    io->u.Status = STATUS_PENDING;
+    if (event) NtResetEvent( event, NULL );
+    if (!(status = RtlQueueWorkItem( file_async_io_proc, async, WT_EXECUTELONGFUNCTION )))
+        return STATUS_PENDING;
+
+    if (!needs_close) close( async->fd );
+error:
+    if (async->thread) NtClose( async->thread );
+    RtlFreeHeap( GetProcessHeap(), 0, async );
+    return status;
+}
+
 /***********************************************************************
  *             FILE_AsyncReadService      (INTERNAL)
  */
@@ -601,7 +719,15 @@ NTSTATUS WINAPI NtReadFile(HANDLE hFile, HANDLE hEvent,
 
     if (type == FD_TYPE_FILE && offset && offset->QuadPart != (LONGLONG)-2 /* FILE_USE_FILE_POINTER_POSITION */ )
     {
-        /* async I/O doesn't make sense on regular files */
+        if (!(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)) &&
+            length >= FILE_ASYNC_MIN_SIZE && offset->QuadPart >= 0 && hEvent &&
+            queue_file_async_io( hFile, unix_handle, needs_close, hEvent, apc, apc_user, io_status,
+                                 buffer, length, offset->QuadPart, FALSE ) == STATUS_PENDING)
+        {
+            TRACE("= PENDING\n");
+            return STATUS_PENDING;
+        }
+
         while ((result = pread( unix_handle, buffer, length, offset->QuadPart )) == -1)
         {
             if (errno != EINTR)
@@ -948,7 +1074,15 @@ NTSTATUS WINAPI NtWriteFile(HANDLE hFile, HANDLE hEvent,
 
     if (type == FD_TYPE_FILE && offset && offset->QuadPart != (LONGLONG)-2 /* FILE_USE_FILE_POINTER_POSITION */ )
     {
-        /* async I/O doesn't make sense on regular files */
+        if (!(options & (FILE_SYNCHRONOUS_IO_ALERT | FILE_SYNCHRONOUS_IO_NONALERT)) &&
+            length >= FILE_ASYNC_MIN_SIZE && offset->QuadPart >= 0 && hEvent &&
+            queue_file_async_io( hFile, unix_handle, needs_close, hEvent, apc, apc_user, io_status,
+                                 (void *)buffer, length, offset->QuadPart, TRUE ) == STATUS_PENDING)
+        {
+            TRACE("= PENDING\n");
+            return STATUS_PENDING;
+        }
+
         while ((result = pwrite( unix_handle, buffer, length, offset->QuadPart )) == -1)
         {
             if (errno != EINTR)
@@ -45,6 +45,7 @@
 #include "wine/server.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(heap);
+WINE_DECLARE_DEBUG_CHANNEL(heapstats);
 
 /* Note: the heap data structures are loosely based on what Pietrek describes in his
  * book 'Windows 95 System Programming Secrets', with some adaptations for
@@ -83,6 +84,7 @@ typedef struct
 /* Value for arena 'magic' field */
 #define ARENA_INUSE_MAGIC      0x455355
 #define ARENA_PENDING_MAGIC    0xbedead
+#define ARENA_CACHED_MAGIC     0x484643
 #define ARENA_FREE_MAGIC       0x45455246
 #define ARENA_LARGE_MAGIC      0x6752614c
 
@@ -120,6 +122,21 @@ static const SIZE_T HEAP_freeListSizes[] =
 };
 #define HEAP_NB_FREE_LISTS  (sizeof(HEAP_freeListSizes)/sizeof(HEAP_freeListSizes[0]))
 
+C_ASSERT( HEAP_NB_FREE_LISTS == WINE_HEAP_NB_SIZE_CLASSES );
+
+/* statistics kept when the heapstats debug channel is enabled */
+struct heap_stats
+{
+    LONG             alloc_count[HEAP_NB_FREE_LISTS]; /* allocations by size class */
+    LONG             total_allocs;      /* total number of allocations */
+    LONG             contention_count;  /* contended lock acquisitions */
+    SIZE_T           committed;         /* committed bytes, updated with the heap lock held */
+    SIZE_T           in_use;            /* bytes in use by the application, updated atomically */
+    LONG             free_blocks;       /* blocks on the free lists, updated with the heap lock held */
+};
+
+#define HEAP_STATS_DUMP_INTERVAL  0x10000  /* number of allocations between statistics dumps */
+
 typedef union
 {
     ARENA_FREE  arena;
@@ -156,6 +173,9 @@ typedef struct tagHEAP
     DWORD            magic;         /* Magic number */
     DWORD            pending_pos;   /* Position in pending free requests ring */
     ARENA_INUSE    **pending_free;  /* Ring buffer for pending free requests */
+    SLIST_HEADER    *lfh_buckets;   /* Low fragmentation heap block caches, NULL if not enabled */
+    ULONG            compat_mode;   /* Compatibility mode reported by RtlQueryHeapInformation */
+    struct heap_stats *stats;       /* Allocation statistics, NULL if not enabled */
     RTL_CRITICAL_SECTION critSection; /* Critical section for serialization */
     FREE_LIST_ENTRY *freeList;      /* Free lists */
 } HEAP;
@@ -166,6 +186,11 @@ typedef struct tagHEAP
 #define COMMIT_MASK          0xffff  /* bitmask for commit/decommit granularity */
 #define MAX_FREE_PENDING     1024    /* max number of free requests to delay */
 
+/* low fragmentation heap: freed small blocks are kept in lock-free per-size caches */
+#define LFH_MAX_BLOCK_SIZE   0x400   /* max size of the blocks that are cached */
+#define LFH_NB_BUCKETS       (LFH_MAX_BLOCK_SIZE / ALIGNMENT + 1)
+#define LFH_MAX_DEPTH        64      /* max number of cached blocks per bucket */
+
 /* some undocumented flags (names are made up) */
 #define HEAP_PAGE_ALLOCS      0x01000000
 #define HEAP_VALIDATE         0x10000000
@@ -289,7 +314,8 @@ static void subheap_notify_free_all(SUBHEAP const *subheap)
         {
             ARENA_INUSE const *pArena = (ARENA_INUSE const *)ptr;
             if (pArena->magic == ARENA_INUSE_MAGIC) notify_free(pArena + 1);
-            else if (pArena->magic != ARENA_PENDING_MAGIC) ERR("bad inuse_magic @%p\n", pArena);
+            else if (pArena->magic != ARENA_PENDING_MAGIC && pArena->magic != ARENA_CACHED_MAGIC)
+                ERR("bad inuse_magic @%p\n", pArena);
             ptr += sizeof(*pArena) + (pArena->size & ARENA_SIZE_MASK);
         }
     }
@@ -376,7 +402,8 @@ static void HEAP_Dump( HEAP *heap )
             {
                 ARENA_INUSE *pArena = (ARENA_INUSE *)ptr;
                 DPRINTF( "%p %08x %s %08x\n",
-                         pArena, pArena->magic, pArena->magic == ARENA_INUSE_MAGIC ? "used" : "pend",
+                         pArena, pArena->magic, pArena->magic == ARENA_INUSE_MAGIC ? "used" :
+                         (pArena->magic == ARENA_CACHED_MAGIC ? "lfh " : "pend"),
                          pArena->size & ARENA_SIZE_MASK );
                 ptr += sizeof(*pArena) + (pArena->size & ARENA_SIZE_MASK);
                 arenaSize += sizeof(ARENA_INUSE);
@@ -480,6 +507,7 @@ static inline void HEAP_InsertFreeBlock( HEAP *heap, ARENA_FREE *pArena, BOOL la
         list_add_after( &pEntry->arena.entry, &pArena->entry );
     }
     pArena->size |= ARENA_FLAG_FREE;
+    if (heap->stats) heap->stats->free_blocks++;
 }
 
 
@@ -526,6 +554,7 @@ static inline BOOL HEAP_Commit( SUBHEAP *subheap, ARENA_INUSE *pArena, SIZE_T da
         return FALSE;
     }
     subheap->commitSize += size;
+    if (subheap->heap->stats) subheap->heap->stats->committed += size;
     return TRUE;
 }
 
@@ -555,6 +584,7 @@ static inline BOOL HEAP_Decommit( SUBHEAP *subheap, void *ptr )
         return FALSE;
     }
     subheap->commitSize -= decommit_size;
+    if (subheap->heap->stats) subheap->heap->stats->committed -= decommit_size;
     return TRUE;
 }
 
@@ -592,6 +622,7 @@ static void HEAP_CreateFreeBlock( SUBHEAP *subheap, void *ptr, SIZE_T size )
         /* Remove the next arena from the free list */
         ARENA_FREE *pNext = (ARENA_FREE *)((char *)ptr + size);
         list_remove( &pNext->entry );
+        if (subheap->heap->stats) subheap->heap->stats->free_blocks--;
         size += (pNext->size & ARENA_SIZE_MASK) + sizeof(*pNext);
         mark_block_free( pNext, sizeof(ARENA_FREE), flags );
     }
@@ -647,6 +678,7 @@ static void HEAP_MakeInUseBlockFree( SUBHEAP *subheap, ARENA_INUSE *pArena )
         size += (pFree->size & ARENA_SIZE_MASK) + sizeof(ARENA_FREE);
         /* Remove it from the free list */
         list_remove( &pFree->entry );
+        if (heap->stats) heap->stats->free_blocks--;
     }
     else pFree = (ARENA_FREE *)pArena;
 
@@ -669,6 +701,11 @@ static void HEAP_MakeInUseBlockFree( SUBHEAP *subheap, ARENA_INUSE *pArena )
         list_remove( &pFree->entry );
         /* Remove the subheap from the list */
         list_remove( &subheap->entry );
+        if (heap->stats)
+        {
+            heap->stats->free_blocks--;
+            heap->stats->committed -= subheap->commitSize;
+        }
         /* Free the memory */
         subheap->magic = 0;
         NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
@@ -728,6 +765,7 @@ static void *allocate_large_block( HEAP *heap, DWORD flags, SIZE_T size )
     arena->magic = ARENA_LARGE_MAGIC;
     mark_block_tail( (char *)(arena + 1) + size, block_size - sizeof(*arena) - size, flags );
     list_add_tail( &heap->large_list, &arena->entry );
+    if (heap->stats) heap->stats->committed += block_size;
     notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
     return arena + 1;
 }
@@ -743,6 +781,7 @@ static void free_large_block( HEAP *heap, DWORD flags, void *ptr )
     SIZE_T size = 0;
 
     list_remove( &arena->entry );
+    if (heap->stats) heap->stats->committed -= arena->block_size;
     NtFreeVirtualMemory( NtCurrentProcess(), &address, &size, MEM_RELEASE );
 }
 
@@ -905,6 +944,7 @@ static SUBHEAP *HEAP_CreateSubHeap( HEAP *heap, LPVOID address, DWORD flags,
         subheap->magic      = SUBHEAP_MAGIC;
         subheap->headerSize = ROUND_SIZE( sizeof(SUBHEAP) );
         list_add_head( &heap->subheap_list, &subheap->entry );
+        if (heap->stats) heap->stats->committed += commitSize;
     }
     else
     {
@@ -1203,7 +1243,8 @@ static BOOL HEAP_ValidateInUseArena( const SUBHEAP *subheap, const ARENA_INUSE *
     }
 
     /* Check magic number */
-    if (pArena->magic != ARENA_INUSE_MAGIC && pArena->magic != ARENA_PENDING_MAGIC)
+    if (pArena->magic != ARENA_INUSE_MAGIC && pArena->magic != ARENA_PENDING_MAGIC &&
+        pArena->magic != ARENA_CACHED_MAGIC)
     {
         if (quiet == NOISY) {
             ERR("Heap %p: invalid in-use arena magic %08x for %p\n", subheap->heap, pArena->magic, pArena );
@@ -1418,7 +1459,7 @@ static BOOL validate_block_pointer( HEAP *heap, SUBHEAP **ret_subheap, const ARE
         ret = HEAP_ValidateInUseArena( subheap, arena, QUIET );
     else if ((ULONG_PTR)arena % ALIGNMENT != ARENA_OFFSET)
         WARN( "Heap %p: unaligned arena pointer %p\n", subheap->heap, arena );
-    else if (arena->magic == ARENA_PENDING_MAGIC)
+    else if (arena->magic == ARENA_PENDING_MAGIC || arena->magic == ARENA_CACHED_MAGIC)
         WARN( "Heap %p: block %p used after free\n", subheap->heap, arena + 1 );
     else if (arena->magic != ARENA_INUSE_MAGIC)
         WARN( "Heap %p: invalid in-use arena magic %08x for %p\n", subheap->heap, arena->magic, arena );
@@ -1519,6 +1560,286 @@ void heap_set_debug_flags( HANDLE handle )
 }
 
 
+/***********************************************************************
+ *           heap_lock
+ *
+ * Acquire the heap lock, counting contended acquisitions if statistics are enabled.
+ */
+static inline void heap_lock( HEAP *heap, DWORD flags )
+{
+    if (flags & HEAP_NO_SERIALIZE) return;
+    if (heap->stats)
+    {
+        if (RtlTryEnterCriticalSection( &heap->critSection )) return;
+        interlocked_xchg_add( &heap->stats->contention_count, 1 );
+    }
+    RtlEnterCriticalSection( &heap->critSection );
+}
+
+
+/***********************************************************************
+ *           get_heap_statistics
+ *
+ * Gather the heap statistics. The heap lock must be held by the caller.
+ */
+static void get_heap_statistics( HEAP *heap, WINE_HEAP_STATISTICS *info )
+{
+    SUBHEAP *subheap;
+    ARENA_LARGE *large;
+    struct list *ptr;
+    unsigned int i;
+
+    memset( info, 0, sizeof(*info) );
+
+    LIST_FOR_EACH_ENTRY( subheap, &heap->subheap_list, SUBHEAP, entry )
+    {
+        char *block = (char *)subheap->base + subheap->headerSize;
+
+        info->committed += subheap->commitSize;
+        while (block < (char *)subheap->base + subheap->size)
+        {
+            if (*(DWORD *)block & ARENA_FLAG_FREE)
+            {
+                ARENA_FREE *arena = (ARENA_FREE *)block;
+                block += sizeof(*arena) + (arena->size & ARENA_SIZE_MASK);
+            }
+            else
+            {
+                ARENA_INUSE *arena = (ARENA_INUSE *)block;
+                if (arena->magic == ARENA_INUSE_MAGIC)
+                    info->in_use += (arena->size & ARENA_SIZE_MASK) - arena->unused_bytes;
+                block += sizeof(*arena) + (arena->size & ARENA_SIZE_MASK);
+            }
+        }
+    }
+
+    LIST_FOR_EACH_ENTRY( large, &heap->large_list, ARENA_LARGE, entry )
+    {
+        info->committed += large->block_size;
+        info->in_use += large->data_size;
+    }
+
+    /* the free lists are a single list with a dummy entry at the start of each size class */
+    i = 0;
+    LIST_FOR_EACH( ptr, &heap->freeList[0].arena.entry )
+    {
+        if (i < HEAP_NB_FREE_LISTS - 1 && ptr == &heap->freeList[i + 1].arena.entry) i++;
+        else info->free_list_length[i]++;
+    }
+
+    if (heap->lfh_buckets)
+        for (i = 0; i < LFH_NB_BUCKETS; i++)
+            info->cached_blocks += RtlQueryDepthSList( &heap->lfh_buckets[i] );
+
+    if (heap->stats)
+    {
+        for (i = 0; i < HEAP_NB_FREE_LISTS; i++) info->alloc_count[i] = heap->stats->alloc_count[i];
+        info->contention_count = heap->stats->contention_count;
+    }
+}
+
+
+/***********************************************************************
+ *           dump_heap_statistics
+ */
+static void dump_heap_statistics( HEAP *heap )
+{
+    WINE_HEAP_STATISTICS info;
+    unsigned int i;
+
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heap->critSection );
+    get_heap_statistics( heap, &info );
+    if (!(heap->flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heap->critSection );
+
+    TRACE_(heapstats)( "heap %p: committed %08lx in use %08lx cached %u contended %u\n",
+                       heap, info.committed, info.in_use, info.cached_blocks, info.contention_count );
+    for (i = 0; i < HEAP_NB_FREE_LISTS; i++)
+        TRACE_(heapstats)( "heap %p: size <= %08lx allocs %u free blocks %u\n", heap,
+                           HEAP_freeListSizes[i], info.alloc_count[i], info.free_list_length[i] );
+}
+
+
+/***********************************************************************
+ *           dump_heap_counters
+ *
+ * Dump the incrementally maintained counters, without walking the heap.
+ */
+static void dump_heap_counters( HEAP *heap )
+{
+    TRACE_(heapstats)( "heap %p: committed %08lx in use %08lx free blocks %u allocs %u contended %u\n",
+                       heap, heap->stats->committed, heap->stats->in_use, heap->stats->free_blocks,
+                       heap->stats->total_allocs, heap->stats->contention_count );
+}
+
+
+/***********************************************************************
+ *           update_in_use
+ *
+ * Adjust the in use counter. It can't rely on the heap lock since the
+ * low fragmentation heap allocates without it.
+ */
+static inline void update_in_use( HEAP *heap, SIZE_T add, SIZE_T remove )
+{
+    SIZE_T old;
+
+    if (!heap->stats) return;
+    do old = heap->stats->in_use;
+    while (interlocked_cmpxchg_ptr( (void **)&heap->stats->in_use,
+                                    (void *)(old + add - remove), (void *)old ) != (void *)old);
+}
+
+
+/***********************************************************************
+ *           record_alloc
+ *
+ * Count an allocation in the heap statistics. Returns TRUE when the counters
+ * should be dumped; the caller does it once the heap lock has been released.
+ */
+static inline BOOL record_alloc( HEAP *heap, SIZE_T size, SIZE_T rounded_size )
+{
+    if (!heap->stats) return FALSE;
+    update_in_use( heap, size, 0 );
+    interlocked_xchg_add( &heap->stats->alloc_count[get_freelist_index( rounded_size + sizeof(ARENA_INUSE) )], 1 );
+    return !((interlocked_xchg_add( &heap->stats->total_allocs, 1 ) + 1) % HEAP_STATS_DUMP_INTERVAL);
+}
+
+
+/***********************************************************************
+ *           enable_heap_stats
+ */
+static void enable_heap_stats( HEAP *heap )
+{
+    void *ptr = NULL;
+    SIZE_T size = sizeof(*heap->stats);
+
+    struct heap_stats *stats;
+    struct list *entry;
+
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), &ptr, 4, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return;
+
+    /* account for the initial sub-heap, the heap is still empty */
+    stats = ptr;
+    stats->committed = heap->subheap.commitSize;
+    LIST_FOR_EACH( entry, &heap->freeList[0].arena.entry ) stats->free_blocks++;
+    stats->free_blocks -= HEAP_NB_FREE_LISTS - 1;  /* the dummy list heads */
+    heap->stats = stats;
+}
+
+
+/***********************************************************************
+ *           heap_dump_statistics
+ *
+ * Dump the statistics of all the heaps of the process.
+ */
+void heap_dump_statistics(void)
+{
+    HEAP *heap;
+
+    if (!TRACE_ON(heapstats) || !processHeap) return;
+
+    RtlEnterCriticalSection( &processHeap->critSection );
+    dump_heap_statistics( processHeap );
+    LIST_FOR_EACH_ENTRY( heap, &processHeap->entry, HEAP, entry ) dump_heap_statistics( heap );
+    RtlLeaveCriticalSection( &processHeap->critSection );
+}
+
+
+/***********************************************************************
+ *           get_lfh_bucket
+ *
+ * Return the low fragmentation heap cache for a given block size.
+ */
+static inline SLIST_HEADER *get_lfh_bucket( HEAP *heap, SIZE_T size )
+{
+    return &heap->lfh_buckets[size / ALIGNMENT];
+}
+
+
+/***********************************************************************
+ *           lfh_alloc_block
+ *
+ * Allocate a block from the low fragmentation heap caches, without taking the heap lock.
+ */
+static void *lfh_alloc_block( HEAP *heap, DWORD flags, SIZE_T size, SIZE_T rounded_size )
+{
+    ARENA_INUSE *arena;
+    SLIST_ENTRY *entry;
+
+    if (!(entry = RtlInterlockedPopEntrySList( get_lfh_bucket( heap, rounded_size ) ))) return NULL;
+
+    arena = (ARENA_INUSE *)entry - 1;
+    arena->magic = ARENA_INUSE_MAGIC;
+    arena->unused_bytes = (arena->size & ARENA_SIZE_MASK) - size;
+
+    notify_alloc( arena + 1, size, flags & HEAP_ZERO_MEMORY );
+    initialize_block( arena + 1, size, arena->unused_bytes, flags );
+    return arena + 1;
+}
+
+
+/***********************************************************************
+ *           lfh_free_block
+ *
+ * Return a small block to the low fragmentation heap caches instead of freeing it.
+ * The block must have been checked with validate_block_pointer() by the caller.
+ */
+static BOOL lfh_free_block( HEAP *heap, ARENA_INUSE *arena )
+{
+    SLIST_HEADER *bucket;
+    SIZE_T size;
+
+    if ((size = arena->size & ARENA_SIZE_MASK) > LFH_MAX_BLOCK_SIZE) return FALSE;
+
+    bucket = get_lfh_bucket( heap, size );
+    if (RtlQueryDepthSList( bucket ) >= LFH_MAX_DEPTH) return FALSE;
+
+    arena->magic = ARENA_CACHED_MAGIC;
+    RtlInterlockedPushEntrySList( bucket, (SLIST_ENTRY *)(arena + 1) );
+    return TRUE;
+}
+
+
+/***********************************************************************
+ *           enable_lfh
+ *
+ * Switch a heap to the low fragmentation mode.
+ */
+static NTSTATUS enable_lfh( HEAP *heap )
+{
+    SLIST_HEADER *buckets = NULL;
+    SIZE_T size = LFH_NB_BUCKETS * sizeof(*buckets);
+    unsigned int i;
+
+    if (heap->compat_mode == 2) return STATUS_SUCCESS;
+
+    /* not supported for fixed size, unserialized or debug heaps */
+    if (!(heap->flags & HEAP_GROWABLE) || (heap->flags & HEAP_NO_SERIALIZE)) return STATUS_UNSUCCESSFUL;
+    if (heap->flags & (HEAP_VALIDATE | HEAP_TAIL_CHECKING_ENABLED | HEAP_FREE_CHECKING_ENABLED))
+        return STATUS_UNSUCCESSFUL;
+    /* the delayed free and valgrind checks are internal, the application still gets success */
+    if (heap->pending_free || RUNNING_ON_VALGRIND)
+    {
+        TRACE( "keeping the standard allocator for heap %p\n", heap );
+        heap->compat_mode = 2;
+        return STATUS_SUCCESS;
+    }
+
+    if (NtAllocateVirtualMemory( NtCurrentProcess(), (void **)&buckets, 4, &size, MEM_COMMIT, PAGE_READWRITE ))
+        return STATUS_NO_MEMORY;
+    for (i = 0; i < LFH_NB_BUCKETS; i++) RtlInitializeSListHead( &buckets[i] );
+
+    if (interlocked_cmpxchg_ptr( (void **)&heap->lfh_buckets, buckets, NULL ))
+    {
+        size = 0;
+        NtFreeVirtualMemory( NtCurrentProcess(), (void **)&buckets, &size, MEM_RELEASE );
+    }
+    heap->compat_mode = 2;
+    TRACE( "enabled low fragmentation mode for heap %p\n", heap );
+    return STATUS_SUCCESS;
+}
+
+
 /***********************************************************************
  *           RtlCreateHeap   (NTDLL.@)
  *
@@ -1552,6 +1873,7 @@ HANDLE WINAPI RtlCreateHeap( ULONG flags, PVOID addr, SIZE_T totalSize, SIZE_T c
     if (!(subheap = HEAP_CreateSubHeap( NULL, addr, flags, commitSize, totalSize ))) return 0;
 
     heap_set_debug_flags( subheap->heap );
+    if (TRACE_ON(heapstats)) enable_heap_stats( subheap->heap );
 
     /* link it into the per-process heap list */
     if (processHeap)
@@ -1596,6 +1918,8 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
 
     if (heap == processHeap) return heap; /* cannot delete the main process heap */
 
+    if (heapPtr->stats) dump_heap_statistics( heapPtr );
+
     /* remove it from the per-process list */
     RtlEnterCriticalSection( &processHeap->critSection );
     list_remove( &heapPtr->entry );
@@ -1627,6 +1951,18 @@ HANDLE WINAPI RtlDestroyHeap( HANDLE heap )
         addr = heapPtr->pending_free;
         NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
     }
+    if (heapPtr->lfh_buckets)
+    {
+        size = 0;
+        addr = heapPtr->lfh_buckets;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
+    if (heapPtr->stats)
+    {
+        size = 0;
+        addr = heapPtr->stats;
+        NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
+    }
     size = 0;
     addr = heapPtr->subheap.base;
     NtFreeVirtualMemory( NtCurrentProcess(), &addr, &size, MEM_RELEASE );
@@ -1658,6 +1994,7 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
     SUBHEAP *subheap;
     HEAP *heapPtr = HEAP_GetPtr( heap );
     SIZE_T rounded_size;
+    BOOL dump;
 
     /* Validate the parameters */
 
@@ -1672,12 +2009,25 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
     }
     if (rounded_size < HEAP_MIN_DATA_SIZE) rounded_size = HEAP_MIN_DATA_SIZE;
 
-    if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
+    if (heapPtr->lfh_buckets && rounded_size <= LFH_MAX_BLOCK_SIZE)
+    {
+        void *ret = lfh_alloc_block( heapPtr, flags, size, rounded_size );
+        if (ret)
+        {
+            if (record_alloc( heapPtr, size, rounded_size )) dump_heap_counters( heapPtr );
+            TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
+            return ret;
+        }
+    }
+
+    heap_lock( heapPtr, flags );
 
     if (rounded_size >= HEAP_MIN_LARGE_BLOCK_SIZE && (flags & HEAP_GROWABLE))
     {
         void *ret = allocate_large_block( heap, flags, size );
+        BOOL dump = ret && record_alloc( heapPtr, size, rounded_size );
         if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
+        if (dump) dump_heap_counters( heapPtr );
         if (!ret && (flags & HEAP_GENERATE_EXCEPTIONS)) RtlRaiseStatus( STATUS_NO_MEMORY );
         TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, ret );
         return ret;
@@ -1697,6 +2047,7 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
     /* Remove the arena from the free list */
 
     list_remove( &pArena->entry );
+    if (heapPtr->stats) heapPtr->stats->free_blocks--;
 
     /* Build the in-use arena */
 
@@ -1714,8 +2065,10 @@ PVOID WINAPI RtlAllocateHeap( HANDLE heap, ULONG flags, SIZE_T size )
 
     notify_alloc( pInUse + 1, size, flags & HEAP_ZERO_MEMORY );
     initialize_block( pInUse + 1, size, pInUse->unused_bytes, flags );
+    dump = record_alloc( heapPtr, size, rounded_size );
 
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
+    if (dump) dump_heap_counters( heapPtr );
 
     TRACE("(%p,%08x,%08lx): returning %p\n", heap, flags, size, pInUse + 1 );
     return pInUse + 1;
@@ -1755,7 +2108,7 @@ BOOLEAN WINAPI RtlFreeHeap( HANDLE heap, ULONG flags, PVOID ptr )
 
     flags &= HEAP_NO_SERIALIZE;
     flags |= heapPtr->flags;
-    if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
+    heap_lock( heapPtr, flags );
 
     /* Inform valgrind we are trying to free memory, so it can throw up an error message */
     notify_free( ptr );
@@ -1764,9 +2117,12 @@ BOOLEAN WINAPI RtlFreeHeap( HANDLE heap, ULONG flags, PVOID ptr )
     pInUse  = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pInUse )) goto error;
 
+    if (heapPtr->stats)
+        update_in_use( heapPtr, 0, subheap ? (pInUse->size & ARENA_SIZE_MASK) - pInUse->unused_bytes
+                                           : ((ARENA_LARGE *)ptr - 1)->data_size );
     if (!subheap)
         free_large_block( heapPtr, flags, ptr );
-    else
+    else if (!heapPtr->lfh_buckets || !lfh_free_block( heapPtr, pInUse ))
         HEAP_MakeInUseBlockFree( subheap, pInUse );
 
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
@@ -1801,7 +2157,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     ARENA_INUSE *pArena;
     HEAP *heapPtr;
     SUBHEAP *subheap;
-    SIZE_T oldBlockSize, oldActualSize, rounded_size;
+    SIZE_T oldBlockSize, oldActualSize, old_size, rounded_size;
     void *ret;
 
     if (!ptr) return NULL;
@@ -1816,7 +2172,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
     flags &= HEAP_GENERATE_EXCEPTIONS | HEAP_NO_SERIALIZE | HEAP_ZERO_MEMORY |
              HEAP_REALLOC_IN_PLACE_ONLY;
     flags |= heapPtr->flags;
-    if (!(flags & HEAP_NO_SERIALIZE)) RtlEnterCriticalSection( &heapPtr->critSection );
+    heap_lock( heapPtr, flags );
 
     rounded_size = ROUND_SIZE(size) + HEAP_TAIL_EXTRA_SIZE(flags);
     if (rounded_size < size) goto oom;  /* overflow */
@@ -1824,6 +2180,8 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
 
     pArena = (ARENA_INUSE *)ptr - 1;
     if (!validate_block_pointer( heapPtr, &subheap, pArena )) goto error;
+    old_size = subheap ? (pArena->size & ARENA_SIZE_MASK) - pArena->unused_bytes
+                       : ((ARENA_LARGE *)ptr - 1)->data_size;
     if (!subheap)
     {
         if (!(ret = realloc_large_block( heapPtr, flags, ptr, size ))) goto oom;
@@ -1854,6 +2212,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
             /* The next block is free and large enough */
             ARENA_FREE *pFree = (ARENA_FREE *)pNext;
             list_remove( &pFree->entry );
+            if (heapPtr->stats) heapPtr->stats->free_blocks--;
             pArena->size += (pFree->size & ARENA_SIZE_MASK) + sizeof(*pFree);
             if (!HEAP_Commit( subheap, pArena, rounded_size )) goto oom;
             notify_realloc( pArena + 1, oldActualSize, size );
@@ -1872,6 +2231,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
             /* Build the in-use arena */
 
             list_remove( &pNew->entry );
+            if (heapPtr->stats) heapPtr->stats->free_blocks--;
             pInUse = (ARENA_INUSE *)pNew;
             pInUse->size = (pInUse->size & ~ARENA_FLAG_FREE)
                            + sizeof(ARENA_FREE) - sizeof(ARENA_INUSE);
@@ -1910,6 +2270,7 @@ PVOID WINAPI RtlReAllocateHeap( HANDLE heap, ULONG flags, PVOID ptr, SIZE_T size
 
     ret = pArena + 1;
 done:
+    update_in_use( heapPtr, size, old_size );
     if (!(flags & HEAP_NO_SERIALIZE)) RtlLeaveCriticalSection( &heapPtr->critSection );
     TRACE("(%p,%08x,%p,%08lx): returning %p\n", heap, flags, ptr, size, ret );
     return ret;
@@ -2122,7 +2483,8 @@ NTSTATUS WINAPI RtlWalkHeap( HANDLE heap, PVOID entry_ptr )
         }
 
         if (((ARENA_INUSE *)ptr - 1)->magic == ARENA_INUSE_MAGIC ||
-            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_PENDING_MAGIC)
+            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_PENDING_MAGIC ||
+            ((ARENA_INUSE *)ptr - 1)->magic == ARENA_CACHED_MAGIC)
         {
             ARENA_INUSE *pArena = (ARENA_INUSE *)ptr - 1;
             ptr += pArena->size & ARENA_SIZE_MASK;
@@ -2235,7 +2597,9 @@ ULONG WINAPI RtlGetProcessHeaps( ULONG count, HANDLE *heaps )
 NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
                                          PVOID info, SIZE_T size_in, PSIZE_T size_out)
 {
-    switch (info_class)
+    HEAP *heapPtr;
+
+    switch ((ULONG)info_class)
     {
     case HeapCompatibilityInformation:
         if (size_out) *size_out = sizeof(ULONG);
@@ -2243,7 +2607,57 @@ NTSTATUS WINAPI RtlQueryHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS inf
         if (size_in < sizeof(ULONG))
             return STATUS_BUFFER_TOO_SMALL;
 
-        *(ULONG *)info = 0; /* standard heap */
+        heapPtr = HEAP_GetPtr( heap );
+
+        *(ULONG *)info = heapPtr ? heapPtr->compat_mode : 0;
+        return STATUS_SUCCESS;
+
+    case HeapWineStatistics:
+        if (size_out) *size_out = sizeof(WINE_HEAP_STATISTICS);
+
+        if (size_in < sizeof(WINE_HEAP_STATISTICS))
+            return STATUS_BUFFER_TOO_SMALL;
+
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        RtlEnterCriticalSection( &heapPtr->critSection );
+        get_heap_statistics( heapPtr, info );
+        RtlLeaveCriticalSection( &heapPtr->critSection );
+        return STATUS_SUCCESS;
+
+    default:
+        FIXME("Unknown heap information class %u\n", info_class);
+        return STATUS_INVALID_INFO_CLASS;
+    }
+}
+
+/***********************************************************************
+ *           RtlSetHeapInformation    (NTDLL.@)
+ */
+NTSTATUS WINAPI RtlSetHeapInformation( HANDLE heap, HEAP_INFORMATION_CLASS info_class,
+                                       PVOID info, SIZE_T size )
+{
+    HEAP *heapPtr;
+
+    switch (info_class)
+    {
+    case HeapCompatibilityInformation:
+        if (size < sizeof(ULONG)) return STATUS_BUFFER_TOO_SMALL;
+        if (!(heapPtr = HEAP_GetPtr( heap ))) return STATUS_INVALID_HANDLE;
+
+        switch (*(ULONG *)info)
+        {
+        case 0:  /* standard heap, the low fragmentation mode can't be disabled */
+            return heapPtr->compat_mode ? STATUS_UNSUCCESSFUL : STATUS_SUCCESS;
+        case 2:  /* low fragmentation heap */
+            return enable_lfh( heapPtr );
+        default:
+            FIXME("Unsupported heap compatibility mode %u\n", *(ULONG *)info);
+            return STATUS_UNSUCCESSFUL;
+        }
+
+    case HeapEnableTerminationOnCorruption:
+        FIXME("HeapEnableTerminationOnCorruption not supported\n");
         return STATUS_SUCCESS;
 
     default:
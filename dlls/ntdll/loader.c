@@ -2357,6 +2357,10 @@ void WINAPI LdrShutdownProcess(void)
 {
     TRACE("()\n");
     process_detach( TRUE, (LPVOID)1 );
+    heap_dump_statistics();
+    critsection_dump_statistics();
+    fd_cache_dump_statistics();
+    reg_cache_dump_statistics();
 }
 
 /******************************************************************
@@ -2683,6 +2687,7 @@ void WINAPI LdrInitializeThunk( void *kernel_start, ULONG_PTR unknown2,
     if (!peb->ProcessParameters->WindowTitle.Buffer)
         peb->ProcessParameters->WindowTitle = wm->ldr.FullDllName;
     version_init( wm->ldr.FullDllName.Buffer );
+    reg_cache_init( wm->ldr.FullDllName.Buffer );
 
     LdrQueryImageFileExecutionOptions( &peb->ProcessParameters->ImagePathName, globalflagW,
                                        REG_DWORD, &peb->NtGlobalFlag, sizeof(peb->NtGlobalFlag), NULL );
@@ -73,6 +73,12 @@ extern void virtual_init(void) DECLSPEC_HIDDEN;
 extern void virtual_init_threading(void) DECLSPEC_HIDDEN;
 extern void fill_cpu_info(void) DECLSPEC_HIDDEN;
 extern void heap_set_debug_flags( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void heap_dump_statistics(void) DECLSPEC_HIDDEN;
+extern void critsection_dump_statistics(void) DECLSPEC_HIDDEN;
+extern void fd_cache_dump_statistics(void) DECLSPEC_HIDDEN;
+extern void reg_cache_init( const WCHAR *appname ) DECLSPEC_HIDDEN;
+extern void reg_cache_dump_statistics(void) DECLSPEC_HIDDEN;
+extern void reg_cache_close_handle( HANDLE handle ) DECLSPEC_HIDDEN;
 
 /* server support */
 extern timeout_t server_start_time DECLSPEC_HIDDEN;
@@ -90,6 +96,7 @@ extern sigset_t server_block_set DECLSPEC_HIDDEN;
 extern void server_enter_uninterrupted_section( RTL_CRITICAL_SECTION *cs, sigset_t *sigset ) DECLSPEC_HIDDEN;
 extern void server_leave_uninterrupted_section( RTL_CRITICAL_SECTION *cs, sigset_t *sigset ) DECLSPEC_HIDDEN;
 extern int server_remove_fd_from_cache( HANDLE handle ) DECLSPEC_HIDDEN;
+extern void server_dup_cached_fd( HANDLE src, HANDLE dst ) DECLSPEC_HIDDEN;
 extern int server_get_unix_fd( HANDLE handle, unsigned int access, int *unix_fd,
                                int *needs_close, enum server_fd_type *type, unsigned int *options ) DECLSPEC_HIDDEN;
 extern int server_pipe( int fd[2] ) DECLSPEC_HIDDEN;
@@ -320,6 +320,10 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
                                    ACCESS_MASK access, ULONG attributes, ULONG options )
 {
     NTSTATUS ret;
+
+    if ((options & DUPLICATE_CLOSE_SOURCE) && source_process == NtCurrentProcess())
+        reg_cache_close_handle( source );
+
     SERVER_START_REQ( dup_handle )
     {
         req->src_process = wine_server_obj_handle( source_process );
@@ -332,6 +336,9 @@ NTSTATUS WINAPI NtDuplicateObject( HANDLE source_process, HANDLE source,
         if (!(ret = wine_server_call( req )))
         {
             if (dest) *dest = wine_server_ptr_handle( reply->handle );
+            /* a duplicate with the same access can share the cached fd of the source */
+            if (reply->self && dest_process == NtCurrentProcess() && (options & DUPLICATE_SAME_ACCESS))
+                server_dup_cached_fd( source, wine_server_ptr_handle( reply->handle ) );
             if (reply->closed)
             {
                 if (reply->self)
@@ -378,6 +385,7 @@ NTSTATUS close_handle( HANDLE handle )
  */
 NTSTATUS WINAPI NtClose( HANDLE Handle )
 {
+    reg_cache_close_handle( Handle );
     return close_handle( Handle );
 }
 
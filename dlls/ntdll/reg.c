@@ -38,15 +38,384 @@
 #include "wine/library.h"
 #include "ntdll_misc.h"
 #include "wine/debug.h"
+#include "wine/list.h"
 #include "wine/unicode.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(reg);
+WINE_DECLARE_DEBUG_CHANNEL(regcache);
 
 /* maximum length of a key name in bytes (without terminating null) */
 #define MAX_NAME_LENGTH  (255 * sizeof(WCHAR))
 /* maximum length of a value name in bytes (without terminating null) */
 #define MAX_VALUE_LENGTH (16383 * sizeof(WCHAR))
 
+#define IS_OPTION_TRUE(ch) ((ch) == 'y' || (ch) == 'Y' || (ch) == 't' || (ch) == 'T' || (ch) == '1')
+
+/*
+ * Client-side value cache
+ *
+ * When enabled with the CacheRegistryValues option, NtQueryValueKey results are
+ * kept per key handle so that repeated reads don't need a server round trip.
+ * Each cached key is watched through a duplicate of its handle with a
+ * set_registry_notification request; the shared wait threads drop the cached
+ * values once the server signals a change. Changes made by the process itself
+ * flush the cache synchronously, so only changes made by other processes are
+ * seen with a small delay.
+ */
+
+#define REG_CACHE_MAX_KEYS    63    /* keys being watched at the same time */
+#define REG_CACHE_MAX_VALUES  32    /* values cached per key */
+#define REG_CACHE_MAX_DATA    1024  /* larger values are always read from the server */
+
+struct reg_cache_value
+{
+    struct list  entry;      /* entry in the key list, most recently used first */
+    NTSTATUS     status;     /* STATUS_SUCCESS or STATUS_OBJECT_NAME_NOT_FOUND */
+    ULONG        type;       /* value type */
+    DWORD        data_len;   /* length of the value data */
+    USHORT       name_len;   /* length of the value name in bytes */
+    WCHAR        name[1];    /* value name, followed by the data */
+};
+
+struct reg_cache_key
+{
+    HANDLE       handle;     /* handle the values are read through, 0 once closed */
+    HANDLE       key;        /* our duplicate of the handle, carrying the notification */
+    HANDLE       event;      /* notification event, 0 if the entry is free */
+    HANDLE       wait;       /* registered wait on the event */
+    struct list  values;     /* cached values */
+    unsigned int count;      /* number of cached values */
+};
+
+static BOOL reg_cache_enabled;
+static struct reg_cache_key reg_cache_keys[REG_CACHE_MAX_KEYS];
+static unsigned int reg_cache_generation;   /* incremented whenever cached data is dropped */
+static unsigned int reg_cache_evict;        /* next key to evict when all entries are in use */
+static unsigned int reg_cache_hits, reg_cache_misses, reg_cache_flushes;
+
+static RTL_CRITICAL_SECTION reg_cache_section;
+static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
+{
+    0, 0, &reg_cache_section,
+    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
+      0, 0, { (DWORD_PTR)(__FILE__ ": reg_cache_section") }
+};
+static RTL_CRITICAL_SECTION reg_cache_section = { &critsect_debug, -1, 0, 0, 0, 0 };
+
+/* free the cached values of a key; must be called with reg_cache_section held */
+static void flush_cache_key( struct reg_cache_key *key )
+{
+    struct reg_cache_value *value, *next;
+
+    LIST_FOR_EACH_ENTRY_SAFE( value, next, &key->values, struct reg_cache_value, entry )
+    {
+        list_remove( &value->entry );
+        RtlFreeHeap( GetProcessHeap(), 0, value );
+    }
+    key->count = 0;
+    reg_cache_generation++;
+}
+
+/* stop caching a key; the notification callback releases the entry */
+static void close_cache_key( struct reg_cache_key *key )
+{
+    flush_cache_key( key );
+    key->handle = 0;
+    NtSetEvent( key->event, NULL );
+}
+
+/* called in a wait thread when the server signals a change in a cached key */
+static void CALLBACK reg_cache_notify( void *arg, BOOLEAN timeout )
+{
+    struct reg_cache_key *key = arg;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    TRACE_(regcache)( "dropping key %p\n", key->handle );
+    if (key->handle) reg_cache_flushes++;
+    flush_cache_key( key );
+    RtlDeregisterWaitEx( key->wait, NULL );
+    NtClose( key->key );
+    NtClose( key->event );
+    key->handle = key->key = key->event = key->wait = 0;
+    RtlLeaveCriticalSection( &reg_cache_section );
+}
+
+/* find the cache entry of a handle; must be called with reg_cache_section held */
+static struct reg_cache_key *find_cache_key( HANDLE handle )
+{
+    unsigned int i;
+
+    if (!handle) return NULL;
+    for (i = 0; i < REG_CACHE_MAX_KEYS; i++)
+        if (reg_cache_keys[i].handle == handle) return &reg_cache_keys[i];
+    return NULL;
+}
+
+/* start watching a key; must be called with reg_cache_section held */
+static struct reg_cache_key *create_cache_key( HANDLE handle )
+{
+    struct reg_cache_key *key = NULL;
+    unsigned int i;
+    NTSTATUS ret;
+
+    for (i = 0; i < REG_CACHE_MAX_KEYS; i++)
+    {
+        if (reg_cache_keys[i].event) continue;
+        key = &reg_cache_keys[i];
+        break;
+    }
+    if (!key)
+    {
+        /* make room for the next one */
+        for (i = 0; i < REG_CACHE_MAX_KEYS; i++)
+        {
+            struct reg_cache_key *victim = &reg_cache_keys[reg_cache_evict++ % REG_CACHE_MAX_KEYS];
+            if (!victim->handle) continue;
+            close_cache_key( victim );
+            break;
+        }
+        return NULL;
+    }
+
+    /* use our own handle so that we don't interfere with the notifications of the app */
+    if (NtDuplicateObject( NtCurrentProcess(), handle, NtCurrentProcess(), &key->key,
+                           0, 0, DUPLICATE_SAME_ACCESS ))
+        return NULL;
+    if (NtCreateEvent( &key->event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE ))
+        goto error;
+
+    SERVER_START_REQ( set_registry_notification )
+    {
+        req->hkey    = wine_server_obj_handle( key->key );
+        req->event   = wine_server_obj_handle( key->event );
+        req->subtree = FALSE;
+        req->filter  = REG_NOTIFY_CHANGE_LAST_SET;
+        ret = wine_server_call( req );
+    }
+    SERVER_END_REQ;
+    if (ret) goto error;
+
+    list_init( &key->values );
+    key->count = 0;
+    if (RtlRegisterWait( &key->wait, key->event, reg_cache_notify, key, INFINITE,
+                         WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD ))
+        goto error;
+
+    key->handle = handle;
+    return key;
+
+error:
+    NtClose( key->key );
+    if (key->event) NtClose( key->event );
+    key->key = key->event = 0;
+    return NULL;
+}
+
+/***********************************************************************
+ *           get_cached_value
+ *
+ * Look up a value in the cache. On a miss the key starts being watched and
+ * the current generation is returned, to be passed to put_cached_value.
+ */
+static BOOL get_cached_value( HANDLE handle, const UNICODE_STRING *name, ULONG *type,
+                              void *data, DWORD size, DWORD *total, NTSTATUS *status,
+                              unsigned int *generation )
+{
+    struct reg_cache_key *key;
+    struct reg_cache_value *value;
+
+    *generation = ~0u;
+    if (!reg_cache_enabled || !handle) return FALSE;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    if ((key = find_cache_key( handle )))
+    {
+        LIST_FOR_EACH_ENTRY( value, &key->values, struct reg_cache_value, entry )
+        {
+            if (value->name_len != name->Length) continue;
+            if (memicmpW( value->name, name->Buffer, name->Length / sizeof(WCHAR) )) continue;
+            list_remove( &value->entry );
+            list_add_head( &key->values, &value->entry );
+            *status = value->status;
+            *type   = value->type;
+            *total  = value->data_len;
+            if (data) memcpy( data, (char *)value->name + value->name_len, min( size, value->data_len ));
+            reg_cache_hits++;
+            RtlLeaveCriticalSection( &reg_cache_section );
+            return TRUE;
+        }
+    }
+    else key = create_cache_key( handle );
+
+    reg_cache_misses++;
+    if (key) *generation = reg_cache_generation;
+    RtlLeaveCriticalSection( &reg_cache_section );
+    return FALSE;
+}
+
+/***********************************************************************
+ *           put_cached_value
+ *
+ * Store the result of a get_key_value request, unless the cache was flushed
+ * since the matching get_cached_value call.
+ */
+static void put_cached_value( HANDLE handle, const UNICODE_STRING *name, NTSTATUS status,
+                              ULONG type, const void *data, DWORD total, unsigned int generation )
+{
+    struct reg_cache_key *key;
+    struct reg_cache_value *value;
+
+    if (!reg_cache_enabled || generation == ~0u) return;
+    if (status != STATUS_SUCCESS && status != STATUS_OBJECT_NAME_NOT_FOUND) return;
+    if (status) total = 0;
+    else if (!data || total > REG_CACHE_MAX_DATA) return;
+
+    if (!(value = RtlAllocateHeap( GetProcessHeap(), 0,
+                                   FIELD_OFFSET( struct reg_cache_value, name ) + name->Length + total )))
+        return;
+    value->status   = status;
+    value->type     = type;
+    value->data_len = total;
+    value->name_len = name->Length;
+    memcpy( value->name, name->Buffer, name->Length );
+    memcpy( (char *)value->name + name->Length, data, total );
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    if (generation == reg_cache_generation && (key = find_cache_key( handle )))
+    {
+        if (key->count == REG_CACHE_MAX_VALUES)
+        {
+            struct reg_cache_value *last = LIST_ENTRY( list_tail( &key->values ), struct reg_cache_value, entry );
+            list_remove( &last->entry );
+            RtlFreeHeap( GetProcessHeap(), 0, last );
+            key->count--;
+        }
+        list_add_head( &key->values, &value->entry );
+        key->count++;
+        value = NULL;
+    }
+    RtlLeaveCriticalSection( &reg_cache_section );
+    RtlFreeHeap( GetProcessHeap(), 0, value );
+}
+
+/***********************************************************************
+ *           flush_reg_cache
+ *
+ * Drop all cached values after the process changed the registry itself.
+ */
+static void flush_reg_cache(void)
+{
+    unsigned int i;
+
+    if (!reg_cache_enabled) return;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    for (i = 0; i < REG_CACHE_MAX_KEYS; i++)
+        if (reg_cache_keys[i].handle) flush_cache_key( &reg_cache_keys[i] );
+    reg_cache_generation++;
+    RtlLeaveCriticalSection( &reg_cache_section );
+}
+
+/***********************************************************************
+ *           reg_cache_close_handle
+ *
+ * Forget the cached values of a handle that is being closed.
+ */
+void reg_cache_close_handle( HANDLE handle )
+{
+    struct reg_cache_key *key;
+
+    if (!reg_cache_enabled || !handle) return;
+
+    RtlEnterCriticalSection( &reg_cache_section );
+    if ((key = find_cache_key( handle ))) close_cache_key( key );
+    RtlLeaveCriticalSection( &reg_cache_section );
+}
+
+/***********************************************************************
+ *           reg_cache_init
+ *
+ * Enable the value cache if the CacheRegistryValues option is set.
+ */
+void reg_cache_init( const WCHAR *appname )
+{
+    static const WCHAR configW[] = {'S','o','f','t','w','a','r','e','\\','W','i','n','e',0};
+    static const WCHAR appdefaultsW[] = {'A','p','p','D','e','f','a','u','l','t','s','\\',0};
+    static const WCHAR cacheW[] = {'C','a','c','h','e','R','e','g','i','s','t','r','y',
+                                   'V','a','l','u','e','s',0};
+    char tmp[80];
+    OBJECT_ATTRIBUTES attr;
+    UNICODE_STRING nameW, valueW;
+    HANDLE root, hkey, config_key;
+    DWORD dummy;
+    BOOL found = FALSE;
+
+    RtlOpenCurrentUser( KEY_ALL_ACCESS, &root );
+    attr.Length = sizeof(attr);
+    attr.RootDirectory = root;
+    attr.ObjectName = &nameW;
+    attr.Attributes = 0;
+    attr.SecurityDescriptor = NULL;
+    attr.SecurityQualityOfService = NULL;
+    RtlInitUnicodeString( &nameW, configW );
+    RtlInitUnicodeString( &valueW, cacheW );
+
+    /* @@ Wine registry key: HKCU\Software\Wine */
+    if (NtOpenKey( &config_key, KEY_ALL_ACCESS, &attr )) config_key = 0;
+    NtClose( root );
+    if (!config_key) return;
+
+    if (appname && *appname)
+    {
+        const WCHAR *p;
+        WCHAR appkey[MAX_PATH+20];
+
+        if ((p = strrchrW( appname, '/' ))) appname = p + 1;
+        if ((p = strrchrW( appname, '\\' ))) appname = p + 1;
+
+        strcpyW( appkey, appdefaultsW );
+        strcatW( appkey, appname );
+        RtlInitUnicodeString( &nameW, appkey );
+        attr.RootDirectory = config_key;
+
+        /* @@ Wine registry key: HKCU\Software\Wine\AppDefaults\app.exe */
+        if (!NtOpenKey( &hkey, KEY_ALL_ACCESS, &attr ))
+        {
+            if (!NtQueryValueKey( hkey, &valueW, KeyValuePartialInformation, tmp, sizeof(tmp), &dummy ))
+            {
+                WCHAR *str = (WCHAR *)((KEY_VALUE_PARTIAL_INFORMATION *)tmp)->Data;
+                reg_cache_enabled = IS_OPTION_TRUE( str[0] );
+                found = TRUE;
+            }
+            NtClose( hkey );
+        }
+    }
+
+    if (!found && !NtQueryValueKey( config_key, &valueW, KeyValuePartialInformation, tmp, sizeof(tmp), &dummy ))
+    {
+        WCHAR *str = (WCHAR *)((KEY_VALUE_PARTIAL_INFORMATION *)tmp)->Data;
+        reg_cache_enabled = IS_OPTION_TRUE( str[0] );
+    }
+    NtClose( config_key );
+
+    TRACE_(regcache)( "value cache %s\n", reg_cache_enabled ? "enabled" : "disabled" );
+}
+
+/***********************************************************************
+ *           reg_cache_dump_statistics
+ *
+ * Print the value cache hit rate when the regcache debug channel is enabled.
+ */
+void reg_cache_dump_statistics(void)
+{
+    unsigned int total = reg_cache_hits + reg_cache_misses;
+
+    if (!TRACE_ON(regcache) || !reg_cache_enabled) return;
+    TRACE_(regcache)( "hits %u misses %u (%u%% of the round trips saved) keys dropped on change %u\n",
+                      reg_cache_hits, reg_cache_misses,
+                      total ? (unsigned int)((ULONGLONG)reg_cache_hits * 100 / total) : 0, reg_cache_flushes );
+}
+
 /******************************************************************************
  * NtCreateKey [NTDLL.@]
  * ZwCreateKey [NTDLL.@]
@@ -168,6 +537,7 @@ NTSTATUS WINAPI NtDeleteKey( HANDLE hkey )
         ret = wine_server_call( req );
     }
     SERVER_END_REQ;
+    flush_reg_cache();
     return ret;
 }
 
@@ -199,6 +569,7 @@ NTSTATUS WINAPI NtDeleteValueKey( HANDLE hkey, const UNICODE_STRING *name )
         ret = wine_server_call( req );
     }
     SERVER_END_REQ;
+    flush_reg_cache();
     return ret;
 }
 
@@ -479,7 +850,9 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
 {
     NTSTATUS ret;
     UCHAR *data_ptr;
-    unsigned int fixed_size = 0, min_size = 0;
+    unsigned int fixed_size = 0, min_size = 0, generation;
+    DWORD data_size, total = 0;
+    ULONG type = 0;
 
     TRACE( "(%p,%s,%d,%p,%d)\n", handle, debugstr_us(name), info_class, info, length );
 
@@ -517,21 +890,33 @@ NTSTATUS WINAPI NtQueryValueKey( HANDLE handle, const UNICODE_STRING *name,
         return STATUS_INVALID_PARAMETER;
     }
 
-    SERVER_START_REQ( get_key_value )
+    data_size = (length > fixed_size && data_ptr) ? length - fixed_size : 0;
+
+    if (!get_cached_value( handle, name, &type, data_ptr, data_size, &total, &ret, &generation ))
     {
-        req->hkey = wine_server_obj_handle( handle );
-        wine_server_add_data( req, name->Buffer, name->Length );
-        if (length > fixed_size && data_ptr) wine_server_set_reply( req, data_ptr, length - fixed_size );
-        if (!(ret = wine_server_call( req )))
+        SERVER_START_REQ( get_key_value )
         {
-            copy_key_value_info( info_class, info, length, reply->type,
-                                 name->Length, reply->total );
-            *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : reply->total);
-            if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
-            else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
+            req->hkey = wine_server_obj_handle( handle );
+            wine_server_add_data( req, name->Buffer, name->Length );
+            if (data_size) wine_server_set_reply( req, data_ptr, data_size );
+            if (!(ret = wine_server_call( req )))
+            {
+                type  = reply->type;
+                total = reply->total;
+            }
         }
+        SERVER_END_REQ;
+        /* only complete data can be cached */
+        put_cached_value( handle, name, ret, type, total <= data_size ? data_ptr : NULL, total, generation );
+    }
+
+    if (!ret)
+    {
+        copy_key_value_info( info_class, info, length, type, name->Length, total );
+        *result_len = fixed_size + (info_class == KeyValueBasicInformation ? 0 : total);
+        if (length < min_size) ret = STATUS_BUFFER_TOO_SMALL;
+        else if (length < *result_len) ret = STATUS_BUFFER_OVERFLOW;
     }
-    SERVER_END_REQ;
     return ret;
 }
 
@@ -615,6 +1000,7 @@ NTSTATUS WINAPI NtLoadKey( const OBJECT_ATTRIBUTES *attr, OBJECT_ATTRIBUTES *fil
         ret = wine_server_call( req );
     }
     SERVER_END_REQ;
+    flush_reg_cache();
 
     NtClose(hive);
    
@@ -783,6 +1169,7 @@ NTSTATUS WINAPI NtSetValueKey( HANDLE hkey, const UNICODE_STRING *name, ULONG Ti
         ret = wine_server_call( req );
     }
     SERVER_END_REQ;
+    flush_reg_cache();
     return ret;
 }
 
@@ -815,6 +1202,7 @@ NTSTATUS WINAPI NtUnloadKey(IN POBJECT_ATTRIBUTES attr)
         ret = wine_server_call(req);
     }
     SERVER_END_REQ;
+    flush_reg_cache();
 
     return ret;
 }
@@ -79,6 +79,7 @@
 #include "ntdll_misc.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(server);
+WINE_DECLARE_DEBUG_CHANNEL(fdcache);
 
 /* Some versions of glibc don't define this */
 #ifndef SCM_RIGHTS
@@ -452,6 +453,11 @@ struct fd_cache_entry
 static struct fd_cache_entry *fd_cache[FD_CACHE_ENTRIES];
 static struct fd_cache_entry fd_cache_initial_block[FD_CACHE_BLOCK_SIZE];
 
+/* statistics, protected by fd_cache_section */
+static unsigned int fd_cache_hits;
+static unsigned int fd_cache_misses;
+static unsigned int fd_cache_dups;
+
 static inline unsigned int handle_to_index( HANDLE handle, unsigned int *entry )
 {
     unsigned int idx = (wine_server_obj_handle(handle) >> 2) - 1;
@@ -535,6 +541,46 @@ int server_remove_fd_from_cache( HANDLE handle )
 }
 
 
+/***********************************************************************
+ *           server_dup_cached_fd
+ *
+ * Give a duplicate of a handle in the current process a copy of the cached fd
+ * of the source handle, so that using it doesn't require a server round trip.
+ * Only valid if the duplicate has the same access rights as the source.
+ */
+void server_dup_cached_fd( HANDLE src, HANDLE dst )
+{
+    sigset_t sigset;
+    enum server_fd_type type;
+    unsigned int access, options;
+    int fd;
+
+    server_enter_uninterrupted_section( &fd_cache_section, &sigset );
+    if ((fd = get_cached_fd( src, &type, &access, &options )) != -1 &&
+        (fd = dup( fd )) != -1)
+    {
+        if (add_fd_to_cache( dst, fd, type, access, options )) fd_cache_dups++;
+        else close( fd );
+    }
+    server_leave_uninterrupted_section( &fd_cache_section, &sigset );
+}
+
+
+/***********************************************************************
+ *           fd_cache_dump_statistics
+ *
+ * Print the fd cache hit rate when the fdcache debug channel is enabled.
+ */
+void fd_cache_dump_statistics(void)
+{
+    unsigned int total = fd_cache_hits + fd_cache_misses;
+
+    if (!TRACE_ON(fdcache)) return;
+    TRACE_(fdcache)( "hits %u misses %u (%u%% hit rate) duplicated %u\n", fd_cache_hits, fd_cache_misses,
+                     total ? (unsigned int)((ULONGLONG)fd_cache_hits * 100 / total) : 0, fd_cache_dups );
+}
+
+
 /***********************************************************************
  *           server_get_unix_fd
  *
@@ -555,7 +601,12 @@ int server_get_unix_fd( HANDLE handle, unsigned int wanted_access, int *unix_fd,
     server_enter_uninterrupted_section( &fd_cache_section, &sigset );
 
     fd = get_cached_fd( handle, type, &access, options );
-    if (fd != -1) goto done;
+    if (fd != -1)
+    {
+        fd_cache_hits++;
+        goto done;
+    }
+    fd_cache_misses++;
 
     SERVER_START_REQ( get_handle_fd )
     {
@@ -485,10 +485,11 @@ static void read_file_test(void)
     IO_STATUS_BLOCK iosb, iosb2;
     DWORD written;
     int apc_count = 0;
-    char buffer[128];
+    char buffer[128], *large;
     LARGE_INTEGER offset;
     HANDLE event = CreateEventA( NULL, TRUE, FALSE, NULL );
     BOOL ret;
+    int i;
 
     buffer[0] = 1;
 
@@ -797,6 +798,58 @@ static void read_file_test(void)
         SleepEx( 1, TRUE ); /* alertable sleep */
         ok( !apc_count, "apc was called\n" );
     }
+
+    /* large transfers may complete asynchronously */
+    large = HeapAlloc( GetProcessHeap(), 0, 0x40000 );
+    for (i = 0; i < 0x40000; i++) large[i] = i * 7;
+    apc_count = 0;
+    U(iosb).Status = 0xdeadbabe;
+    iosb.Information = 0xdeadbeef;
+    offset.QuadPart = 0x1000;
+    ResetEvent( event );
+    status = pNtWriteFile( handle, event, apc, &apc_count, &iosb, large, 0x40000, &offset, NULL );
+    ok( status == STATUS_SUCCESS || status == STATUS_PENDING, "wrong status %x\n", status );
+    if (status == STATUS_PENDING) WaitForSingleObject( event, 5000 );
+    ok( U(iosb).Status == STATUS_SUCCESS, "wrong status %x\n", U(iosb).Status );
+    ok( iosb.Information == 0x40000, "wrong info %lu\n", iosb.Information );
+    ok( is_signaled( event ), "event is signaled\n" );
+    SleepEx( 1, TRUE ); /* alertable sleep */
+    ok( apc_count == 1, "apc was not called\n" );
+
+    memset( large, 0, 0x40000 );
+    apc_count = 0;
+    U(iosb).Status = 0xdeadbabe;
+    iosb.Information = 0xdeadbeef;
+    offset.QuadPart = 0x1000;
+    ResetEvent( event );
+    status = pNtReadFile( handle, event, apc, &apc_count, &iosb, large, 0x40000, &offset, NULL );
+    ok( status == STATUS_SUCCESS || status == STATUS_PENDING, "wrong status %x\n", status );
+    if (status == STATUS_PENDING) WaitForSingleObject( event, 5000 );
+    ok( U(iosb).Status == STATUS_SUCCESS, "wrong status %x\n", U(iosb).Status );
+    ok( iosb.Information == 0x40000, "wrong info %lu\n", iosb.Information );
+    ok( is_signaled( event ), "event is signaled\n" );
+    SleepEx( 1, TRUE ); /* alertable sleep */
+    ok( apc_count == 1, "apc was not called\n" );
+    for (i = 0; i < 0x40000; i++) if (large[i] != (char)(i * 7)) break;
+    ok( i == 0x40000, "wrong data at %x\n", i );
+
+    /* large read beyond eof */
+    apc_count = 0;
+    U(iosb).Status = 0xdeadbabe;
+    iosb.Information = 0xdeadbeef;
+    offset.QuadPart = 0x80000;
+    ResetEvent( event );
+    status = pNtReadFile( handle, event, apc, &apc_count, &iosb, large, 0x40000, &offset, NULL );
+    if (status == STATUS_PENDING)
+    {
+        WaitForSingleObject( event, 5000 );
+        ok( U(iosb).Status == STATUS_END_OF_FILE, "wrong status %x\n", U(iosb).Status );
+        ok( iosb.Information == 0, "wrong info %lu\n", iosb.Information );
+        SleepEx( 1, TRUE ); /* alertable sleep */
+        ok( apc_count == 1, "apc was not called\n" );
+    }
+    else ok( status == STATUS_END_OF_FILE, "wrong status %x\n", status );
+    HeapFree( GetProcessHeap(), 0, large );
     CloseHandle( handle );
 
     /* now a non-overlapped file */
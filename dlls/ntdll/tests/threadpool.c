@@ -0,0 +1,272 @@
+/*
+ * Unit test suite for thread pool functions
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "ntdll_test.h"
+
+static NTSTATUS (WINAPI *pTpAllocPool)(TP_POOL **,PVOID);
+static NTSTATUS (WINAPI *pTpAllocTimer)(TP_TIMER **,PTP_TIMER_CALLBACK,PVOID,TP_CALLBACK_ENVIRON *);
+static NTSTATUS (WINAPI *pTpAllocWork)(TP_WORK **,PTP_WORK_CALLBACK,PVOID,TP_CALLBACK_ENVIRON *);
+static BOOL     (WINAPI *pTpIsTimerSet)(TP_TIMER *);
+static void     (WINAPI *pTpPostWork)(TP_WORK *);
+static void     (WINAPI *pTpReleasePool)(TP_POOL *);
+static void     (WINAPI *pTpReleaseTimer)(TP_TIMER *);
+static void     (WINAPI *pTpReleaseWork)(TP_WORK *);
+static void     (WINAPI *pTpSetPoolMaxThreads)(TP_POOL *,DWORD);
+static void     (WINAPI *pTpSetTimer)(TP_TIMER *,LARGE_INTEGER *,LONG,LONG);
+static NTSTATUS (WINAPI *pTpSimpleTryPost)(PTP_SIMPLE_CALLBACK,PVOID,TP_CALLBACK_ENVIRON *);
+static void     (WINAPI *pTpWaitForTimer)(TP_TIMER *,BOOL);
+static void     (WINAPI *pTpWaitForWork)(TP_WORK *,BOOL);
+
+#define NTDLL_GET_PROC(func) \
+    do \
+    { \
+        p ## func = (void *)GetProcAddress(module, #func); \
+        if (!p ## func) trace("Failed to get address for %s\n", #func); \
+    } \
+    while (0)
+
+static BOOL init_threadpool(void)
+{
+    HMODULE module = GetModuleHandleA("ntdll");
+    NTDLL_GET_PROC(TpAllocPool);
+    NTDLL_GET_PROC(TpAllocTimer);
+    NTDLL_GET_PROC(TpAllocWork);
+    NTDLL_GET_PROC(TpIsTimerSet);
+    NTDLL_GET_PROC(TpPostWork);
+    NTDLL_GET_PROC(TpReleasePool);
+    NTDLL_GET_PROC(TpReleaseTimer);
+    NTDLL_GET_PROC(TpReleaseWork);
+    NTDLL_GET_PROC(TpSetPoolMaxThreads);
+    NTDLL_GET_PROC(TpSetTimer);
+    NTDLL_GET_PROC(TpSimpleTryPost);
+    NTDLL_GET_PROC(TpWaitForTimer);
+    NTDLL_GET_PROC(TpWaitForWork);
+
+    if (!pTpAllocPool)
+    {
+        win_skip("Threadpool functions not supported, skipping tests\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+#undef NTDLL_GET_PROC
+
+static void CALLBACK simple_cb(TP_CALLBACK_INSTANCE *instance, void *userdata)
+{
+    HANDLE semaphore = userdata;
+    ReleaseSemaphore(semaphore, 1, NULL);
+}
+
+static void test_tp_simple(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_POOL *pool;
+    HANDLE semaphore;
+    NTSTATUS status;
+    DWORD result;
+
+    semaphore = CreateSemaphoreA(NULL, 0, 1, NULL);
+    ok(semaphore != NULL, "CreateSemaphoreA failed %u\n", GetLastError());
+
+    /* post the callback to the default pool */
+    status = pTpSimpleTryPost(simple_cb, semaphore, NULL);
+    ok(!status, "TpSimpleTryPost failed with status %x\n", status);
+    result = WaitForSingleObject(semaphore, 1000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+
+    /* and to a private pool */
+    pool = NULL;
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    ok(pool != NULL, "expected pool != NULL\n");
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+    status = pTpSimpleTryPost(simple_cb, semaphore, &environment);
+    ok(!status, "TpSimpleTryPost failed with status %x\n", status);
+    result = WaitForSingleObject(semaphore, 1000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+
+    pTpReleasePool(pool);
+    CloseHandle(semaphore);
+}
+
+static void CALLBACK work_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    Sleep(10);
+    InterlockedIncrement(userdata);
+}
+
+static void CALLBACK work2_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    InterlockedExchangeAdd(userdata, 0x10000);
+}
+
+static void CALLBACK blocking_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_WORK *work)
+{
+    HANDLE *events = userdata;
+    SetEvent(events[0]);
+    WaitForSingleObject(events[1], INFINITE);
+}
+
+static void test_tp_work(void)
+{
+    TP_CALLBACK_ENVIRON environment;
+    TP_WORK *work, *work2, *work3, *blocking;
+    TP_POOL *pool, *single_pool;
+    HANDLE events[2];
+    NTSTATUS status;
+    DWORD result;
+    static LONG count;  /* callbacks may still be pending after the work object is released */
+    int i;
+
+    status = pTpAllocPool(&pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    pTpSetPoolMaxThreads(pool, 2);
+
+    memset(&environment, 0, sizeof(environment));
+    environment.Version = 1;
+    environment.Pool = pool;
+
+    work = NULL;
+    status = pTpAllocWork(&work, work_cb, &count, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    ok(work != NULL, "expected work != NULL\n");
+    status = pTpAllocWork(&work2, work2_cb, &count, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+
+    /* every post results in one callback */
+    count = 0;
+    for (i = 0; i < 5; i++) pTpPostWork(work);
+    for (i = 0; i < 3; i++) pTpPostWork(work2);
+    pTpWaitForWork(work, FALSE);
+    pTpWaitForWork(work2, FALSE);
+    ok(count == 0x30005, "expected count 0x30005, got %x\n", count);
+
+    /* cancelling pending callbacks, the only thread of the pool is kept busy
+     * so that none of them can start before they are cancelled */
+    status = pTpAllocPool(&single_pool, NULL);
+    ok(!status, "TpAllocPool failed with status %x\n", status);
+    pTpSetPoolMaxThreads(single_pool, 1);
+    environment.Pool = single_pool;
+
+    events[0] = CreateEventA(NULL, FALSE, FALSE, NULL);
+    events[1] = CreateEventA(NULL, TRUE, FALSE, NULL);
+    status = pTpAllocWork(&blocking, blocking_cb, events, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+    status = pTpAllocWork(&work3, work_cb, &count, &environment);
+    ok(!status, "TpAllocWork failed with status %x\n", status);
+
+    count = 0;
+    pTpPostWork(blocking);
+    result = WaitForSingleObject(events[0], 1000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+    for (i = 0; i < 10; i++) pTpPostWork(work3);
+    pTpWaitForWork(work3, TRUE);
+    SetEvent(events[1]);
+    pTpWaitForWork(blocking, FALSE);
+    pTpWaitForWork(work3, FALSE);
+    ok(count == 0, "expected all callbacks to be cancelled, got %u\n", count);
+
+    pTpReleaseWork(work3);
+    pTpReleaseWork(blocking);
+    pTpReleasePool(single_pool);
+    CloseHandle(events[0]);
+    CloseHandle(events[1]);
+    environment.Pool = pool;
+
+    /* releasing the work object doesn't cancel the pending callbacks */
+    count = 0;
+    pTpPostWork(work);
+    pTpPostWork(work);
+    pTpReleaseWork(work);
+    pTpWaitForWork(work2, FALSE);
+    pTpReleaseWork(work2);
+    pTpReleasePool(pool);
+    for (i = 0; i < 100 && count < 2; i++) Sleep(10);
+    ok(count == 2, "expected count 2, got %u\n", count);
+}
+
+static void CALLBACK timer_cb(TP_CALLBACK_INSTANCE *instance, void *userdata, TP_TIMER *timer)
+{
+    HANDLE semaphore = userdata;
+    ReleaseSemaphore(semaphore, 1, NULL);
+}
+
+static void test_tp_timer(void)
+{
+    LARGE_INTEGER when;
+    TP_TIMER *timer;
+    HANDLE semaphore;
+    NTSTATUS status;
+    DWORD result, ticks;
+    int i;
+
+    semaphore = CreateSemaphoreA(NULL, 0, 1, NULL);
+    ok(semaphore != NULL, "CreateSemaphoreA failed %u\n", GetLastError());
+
+    timer = NULL;
+    status = pTpAllocTimer(&timer, timer_cb, semaphore, NULL);
+    ok(!status, "TpAllocTimer failed with status %x\n", status);
+    ok(timer != NULL, "expected timer != NULL\n");
+    ok(!pTpIsTimerSet(timer), "timer should not be set\n");
+
+    /* one shot relative timer */
+    ticks = GetTickCount();
+    when.QuadPart = (ULONGLONG)200 * -10000;
+    pTpSetTimer(timer, &when, 0, 0);
+    ok(pTpIsTimerSet(timer), "timer should be set\n");
+    result = WaitForSingleObject(semaphore, 1000);
+    ok(result == WAIT_OBJECT_0, "WaitForSingleObject returned %u\n", result);
+    ticks = GetTickCount() - ticks;
+    ok(ticks >= 150, "expected at least 150ms, got %u\n", ticks);
+    result = WaitForSingleObject(semaphore, 300);
+    ok(result == WAIT_TIMEOUT, "WaitForSingleObject returned %u\n", result);
+
+    /* periodic timer */
+    when.QuadPart = 0;
+    pTpSetTimer(timer, &when, 50, 0);
+    for (i = 0; i < 3; i++)
+    {
+        result = WaitForSingleObject(semaphore, 1000);
+        ok(result == WAIT_OBJECT_0, "%d: WaitForSingleObject returned %u\n", i, result);
+    }
+
+    /* cancelling the timer */
+    pTpSetTimer(timer, NULL, 0, 0);
+    ok(!pTpIsTimerSet(timer), "timer should not be set\n");
+    pTpWaitForTimer(timer, FALSE);
+    WaitForSingleObject(semaphore, 0);
+    result = WaitForSingleObject(semaphore, 200);
+    ok(result == WAIT_TIMEOUT, "WaitForSingleObject returned %u\n", result);
+
+    pTpReleaseTimer(timer);
+    CloseHandle(semaphore);
+}
+
+START_TEST(threadpool)
+{
+    if (!init_threadpool())
+        return;
+
+    test_tp_simple();
+    test_tp_work();
+    test_tp_timer();
+}
@@ -38,22 +38,9 @@
 WINE_DEFAULT_DEBUG_CHANNEL(threadpool);
 
 #define WORKER_TIMEOUT 30000 /* 30 seconds */
-
-static LONG num_workers;
-static LONG num_work_items;
-static LONG num_busy_workers;
-
-static struct list work_item_list = LIST_INIT(work_item_list);
-static HANDLE work_item_event;
-
-static RTL_CRITICAL_SECTION threadpool_cs;
-static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
-{
-    0, 0, &threadpool_cs,
-    { &critsect_debug.ProcessLocksList, &critsect_debug.ProcessLocksList },
-    0, 0, { (DWORD_PTR)(__FILE__ ": threadpool_cs") }
-};
-static RTL_CRITICAL_SECTION threadpool_cs = { &critsect_debug, -1, 0, 0, 0, 0 };
+#define EXTRA_WORKER_TIMEOUT 1000 /* 1 second, for workers beyond the CPU count */
+#define STARVATION_DELAY 100 /* ms before adding a worker beyond the CPU count */
+#define DEFAULT_MAX_WORKERS 500
 
 static HANDLE compl_port = NULL;
 static RTL_CRITICAL_SECTION threadpool_compl_cs;
@@ -65,13 +52,76 @@ static RTL_CRITICAL_SECTION_DEBUG critsect_compl_debug =
 };
 static RTL_CRITICAL_SECTION threadpool_compl_cs = { &critsect_compl_debug, -1, 0, 0, 0, 0 };
 
-struct work_item
+/* a pool of worker threads; either the default pool or one created with TpAllocPool.
+ * Workers are started right away up to the number of CPUs; beyond that, a worker
+ * is only added when callbacks have been left waiting for STARVATION_DELAY, so
+ * that blocked callbacks can't stall the pool, up to max_workers. */
+struct threadpool
 {
-    struct list entry;
-    PRTL_WORK_ITEM_ROUTINE function;
-    PVOID context;
+    LONG                 refcount;
+    BOOL                 shutdown;      /* pool released by its owner */
+    RTL_CRITICAL_SECTION cs;
+    struct list          pending;       /* objects with pending callbacks */
+    HANDLE               semaphore;     /* wakes up idle workers */
+    int                  max_workers;
+    int                  min_workers;
+    int                  num_workers;
+    int                  num_waiting;   /* workers blocked on the semaphore */
+    int                  num_wakeups;   /* semaphore releases not yet consumed */
+    HANDLE               starvation_timer;  /* timer queue timer while armed */
+};
+
+enum threadpool_objtype
+{
+    TP_OBJECT_TYPE_SIMPLE,
+    TP_OBJECT_TYPE_WORK,
+    TP_OBJECT_TYPE_TIMER
+};
+
+/* a callback object; TP_WORK and TP_TIMER pointers refer to one of these */
+struct threadpool_object
+{
+    LONG                    refcount;
+    enum threadpool_objtype type;
+    struct threadpool      *pool;
+    PVOID                   userdata;
+    BOOL                    long_function;  /* WT_EXECUTELONGFUNCTION, gets a worker right away */
+    /* the following fields are protected by the pool lock */
+    struct list             pending_entry;  /* entry in pool->pending */
+    int                     num_pending;    /* posted callbacks not yet started */
+    int                     num_running;    /* callbacks being executed */
+    int                     num_waiters;    /* threads waiting for the callbacks */
+    HANDLE                  finished_event;
+    union
+    {
+        struct
+        {
+            PTP_SIMPLE_CALLBACK    callback;
+            PRTL_WORK_ITEM_ROUTINE function;  /* set for RtlQueueWorkItem */
+        } simple;
+        struct
+        {
+            PTP_WORK_CALLBACK callback;
+        } work;
+        struct
+        {
+            PTP_TIMER_CALLBACK  callback;
+            struct timer_set   *set;          /* current settings, protected by the pool lock */
+        } timer;
+    } u;
+};
+
+/* a TpSetTimer call, kept until the timer is set again */
+struct timer_set
+{
+    struct threadpool_object *object;
+    HANDLE                    timer;      /* timer queue timer */
+    LONG                      period;
+    BOOL                      expired;    /* a one-shot timer that already fired */
 };
 
+static struct threadpool *default_threadpool;
+
 static inline LONG interlocked_inc( PLONG dest )
 {
     return interlocked_xchg_add( dest, 1 ) + 1;
@@ -82,82 +132,333 @@ static inline LONG interlocked_dec( PLONG dest )
     return interlocked_xchg_add( dest, -1 ) - 1;
 }
 
-static void WINAPI worker_thread_proc(void * param)
+static NTSTATUS threadpool_alloc( struct threadpool **out )
 {
-    interlocked_inc(&num_workers);
+    struct threadpool *pool;
+    NTSTATUS status;
+
+    if (!(pool = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*pool) )))
+        return STATUS_NO_MEMORY;
 
-    /* free the work item memory sooner to reduce memory usage */
-    while (TRUE)
+    status = NtCreateSemaphore( &pool->semaphore, SEMAPHORE_ALL_ACCESS, NULL, 0, INT_MAX );
+    if (status)
     {
-        if (num_work_items > 0)
+        RtlFreeHeap( GetProcessHeap(), 0, pool );
+        return status;
+    }
+
+    pool->refcount    = 1;
+    pool->shutdown    = FALSE;
+    RtlInitializeCriticalSection( &pool->cs );
+    list_init( &pool->pending );
+    pool->max_workers = DEFAULT_MAX_WORKERS;
+    pool->min_workers = 0;
+    pool->num_workers = 0;
+    pool->num_waiting = 0;
+    pool->num_wakeups = 0;
+    pool->starvation_timer = NULL;
+
+    TRACE( "allocated pool %p\n", pool );
+    *out = pool;
+    return STATUS_SUCCESS;
+}
+
+static void threadpool_release( struct threadpool *pool )
+{
+    if (interlocked_dec( &pool->refcount )) return;
+
+    TRACE( "destroying pool %p\n", pool );
+    assert( pool->shutdown );
+    assert( list_empty( &pool->pending ) );
+    NtClose( pool->semaphore );
+    RtlDeleteCriticalSection( &pool->cs );
+    RtlFreeHeap( GetProcessHeap(), 0, pool );
+}
+
+/* returns the pool selected by the callback environment, with an added reference */
+static struct threadpool *threadpool_get( TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool *pool;
+
+    if (environment && environment->Pool)
+        pool = (struct threadpool *)environment->Pool;
+    else
+    {
+        if (!default_threadpool)
         {
-            struct list *item;
-            RtlEnterCriticalSection(&threadpool_cs);
-            item = list_head(&work_item_list);
-            if (item)
+            if (threadpool_alloc( &pool )) return NULL;
+            if (interlocked_cmpxchg_ptr( (void **)&default_threadpool, pool, NULL ))
             {
-                struct work_item *work_item_ptr = LIST_ENTRY(item, struct work_item, entry);
-                struct work_item work_item;
-                list_remove(&work_item_ptr->entry);
-                interlocked_dec(&num_work_items);
-
-                RtlLeaveCriticalSection(&threadpool_cs);
+                /* somebody beat us to it */
+                pool->shutdown = TRUE;
+                threadpool_release( pool );
+            }
+        }
+        pool = default_threadpool;
+    }
 
-                work_item = *work_item_ptr;
-                RtlFreeHeap(GetProcessHeap(), 0, work_item_ptr);
+    interlocked_inc( &pool->refcount );
+    return pool;
+}
 
-                TRACE("executing %p(%p)\n", work_item.function, work_item.context);
+static void threadpool_object_release( struct threadpool_object *object )
+{
+    if (interlocked_dec( &object->refcount )) return;
 
-                interlocked_inc(&num_busy_workers);
+    TRACE( "destroying object %p\n", object );
+    if (object->finished_event) NtClose( object->finished_event );
+    threadpool_release( object->pool );
+    RtlFreeHeap( GetProcessHeap(), 0, object );
+}
 
-                /* do the work */
-                work_item.function(work_item.context);
+static void threadpool_object_execute( struct threadpool_object *object )
+{
+    TP_CALLBACK_INSTANCE *instance = (TP_CALLBACK_INSTANCE *)object;
 
-                interlocked_dec(&num_busy_workers);
-            }
-            else
-                RtlLeaveCriticalSection(&threadpool_cs);
+    switch (object->type)
+    {
+    case TP_OBJECT_TYPE_SIMPLE:
+        if (object->u.simple.function)
+        {
+            TRACE( "executing %p(%p)\n", object->u.simple.function, object->userdata );
+            object->u.simple.function( object->userdata );
         }
         else
         {
-            NTSTATUS status;
-            LARGE_INTEGER timeout;
-            timeout.QuadPart = -(WORKER_TIMEOUT * (ULONGLONG)10000);
-            status = NtWaitForSingleObject(work_item_event, FALSE, &timeout);
-            if (status != STATUS_WAIT_0)
-                break;
+            TRACE( "executing simple callback %p(%p, %p)\n",
+                   object->u.simple.callback, instance, object->userdata );
+            object->u.simple.callback( instance, object->userdata );
         }
+        break;
+
+    case TP_OBJECT_TYPE_WORK:
+        TRACE( "executing work callback %p(%p, %p, %p)\n",
+               object->u.work.callback, instance, object->userdata, object );
+        object->u.work.callback( instance, object->userdata, (TP_WORK *)object );
+        break;
+
+    case TP_OBJECT_TYPE_TIMER:
+        TRACE( "executing timer callback %p(%p, %p, %p)\n",
+               object->u.timer.callback, instance, object->userdata, object );
+        object->u.timer.callback( instance, object->userdata, (TP_TIMER *)object );
+        break;
     }
+}
 
-    interlocked_dec(&num_workers);
+static void WINAPI threadpool_worker_proc( void *param )
+{
+    struct threadpool *pool = param;
+    int ncpus = NtCurrentTeb()->Peb->NumberOfProcessors;
 
-    RtlExitUserThread(0);
+    RtlEnterCriticalSection( &pool->cs );
+    for (;;)
+    {
+        struct threadpool_object *object;
+        struct list *ptr;
+        LARGE_INTEGER timeout;
+        NTSTATUS status;
+
+        if ((ptr = list_head( &pool->pending )))
+        {
+            object = LIST_ENTRY( ptr, struct threadpool_object, pending_entry );
+
+            /* objects with several pending callbacks go to the back of the
+             * queue, so that a busy object cannot starve the others */
+            list_remove( &object->pending_entry );
+            if (--object->num_pending) list_add_tail( &pool->pending, &object->pending_entry );
+            object->num_running++;
+            RtlLeaveCriticalSection( &pool->cs );
+
+            threadpool_object_execute( object );
+
+            RtlEnterCriticalSection( &pool->cs );
+            if (!--object->num_running && !object->num_pending && object->num_waiters)
+                NtSetEvent( object->finished_event, NULL );
+            /* the pool reference held by this worker keeps the pool alive */
+            threadpool_object_release( object );
+            continue;
+        }
+
+        if (pool->shutdown) break;
+
+        /* keep about one idle worker per CPU around, let the others go quickly */
+        timeout.QuadPart = (pool->num_workers > ncpus ? EXTRA_WORKER_TIMEOUT : WORKER_TIMEOUT)
+                           * (ULONGLONG)-10000;
+        pool->num_waiting++;
+        RtlLeaveCriticalSection( &pool->cs );
+
+        status = NtWaitForSingleObject( pool->semaphore, FALSE, &timeout );
+
+        RtlEnterCriticalSection( &pool->cs );
+        pool->num_waiting--;
+        if (status == STATUS_WAIT_0)
+            pool->num_wakeups--;
+        else if (list_empty( &pool->pending ) && pool->num_workers > pool->min_workers)
+            break;
+    }
+    pool->num_workers--;
+    RtlLeaveCriticalSection( &pool->cs );
 
-    /* never reached */
+    threadpool_release( pool );
+    RtlExitUserThread( 0 );
 }
 
-static NTSTATUS add_work_item_to_queue(struct work_item *work_item)
+/* start a new worker thread; must be called with the pool lock held */
+static NTSTATUS threadpool_add_worker( struct threadpool *pool )
 {
+    HANDLE thread;
     NTSTATUS status;
 
-    RtlEnterCriticalSection(&threadpool_cs);
-    list_add_tail(&work_item_list, &work_item->entry);
-    num_work_items++;
-    RtlLeaveCriticalSection(&threadpool_cs);
+    interlocked_inc( &pool->refcount );
+    status = RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE, NULL, 0, 0,
+                                  threadpool_worker_proc, pool, &thread, NULL );
+    if (status)
+    {
+        interlocked_dec( &pool->refcount );
+        return status;
+    }
+    NtClose( thread );
+    pool->num_workers++;
+    return STATUS_SUCCESS;
+}
+
+static void threadpool_arm_starvation_timer( struct threadpool *pool );
 
-    if (!work_item_event)
+/* called by the timer queue when callbacks have been waiting for a worker for a while */
+static void CALLBACK threadpool_starvation_proc( PVOID param, BOOLEAN fired )
+{
+    struct threadpool *pool = param;
+    HANDLE timer;
+
+    RtlEnterCriticalSection( &pool->cs );
+    timer = pool->starvation_timer;
+    pool->starvation_timer = NULL;
+    if (!list_empty( &pool->pending ) && pool->num_waiting <= pool->num_wakeups &&
+        pool->num_workers < pool->max_workers)
     {
-        HANDLE sem;
-        status = NtCreateSemaphore(&sem, SEMAPHORE_ALL_ACCESS, NULL, 1, INT_MAX);
-        if (interlocked_cmpxchg_ptr( &work_item_event, sem, 0 ))
-            NtClose(sem);  /* somebody beat us to it */
+        TRACE( "pool %p is starving, adding a worker to the %d busy ones\n", pool, pool->num_workers );
+        if (!threadpool_add_worker( pool )) threadpool_arm_starvation_timer( pool );
     }
-    else
-        status = NtReleaseSemaphore(work_item_event, 1, NULL);
+    RtlLeaveCriticalSection( &pool->cs );
+
+    RtlDeleteTimer( NULL, timer, NULL );
+    threadpool_release( pool );
+}
 
+/* check again later whether the pending callbacks got a worker; must be called with the pool lock held */
+static void threadpool_arm_starvation_timer( struct threadpool *pool )
+{
+    if (pool->starvation_timer) return;
+    interlocked_inc( &pool->refcount );
+    if (RtlCreateTimer( &pool->starvation_timer, NULL, threadpool_starvation_proc, pool,
+                        STARVATION_DELAY, 0, WT_EXECUTEINTIMERTHREAD ))
+    {
+        pool->starvation_timer = NULL;
+        interlocked_dec( &pool->refcount );
+    }
+}
+
+/* queue a callback for the object, waking up or starting a worker for it */
+static NTSTATUS threadpool_object_submit( struct threadpool_object *object )
+{
+    struct threadpool *pool = object->pool;
+    int ncpus = NtCurrentTeb()->Peb->NumberOfProcessors;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    RtlEnterCriticalSection( &pool->cs );
+
+    if (pool->num_waiting > pool->num_wakeups)
+    {
+        pool->num_wakeups++;
+        NtReleaseSemaphore( pool->semaphore, 1, NULL );
+    }
+    else if (pool->num_workers < pool->max_workers &&
+             (pool->num_workers < ncpus || object->long_function))
+    {
+        status = threadpool_add_worker( pool );
+        /* we don't care if we couldn't create the thread if there is at
+         * least one other available to process the request */
+        if (status && pool->num_workers) status = STATUS_SUCCESS;
+    }
+    else if (pool->num_workers < pool->max_workers)
+        threadpool_arm_starvation_timer( pool );
+
+    if (!status)
+    {
+        interlocked_inc( &object->refcount );
+        if (!object->num_pending++) list_add_tail( &pool->pending, &object->pending_entry );
+    }
+
+    RtlLeaveCriticalSection( &pool->cs );
     return status;
 }
 
+/* wait for the callbacks of the object to complete, optionally cancelling the pending ones */
+static void threadpool_object_wait( struct threadpool_object *object, BOOL cancel_pending )
+{
+    struct threadpool *pool = object->pool;
+    int cancelled = 0;
+
+    RtlEnterCriticalSection( &pool->cs );
+
+    if (cancel_pending && object->num_pending)
+    {
+        cancelled = object->num_pending;
+        object->num_pending = 0;
+        list_remove( &object->pending_entry );
+    }
+
+    while (object->num_pending || object->num_running)
+    {
+        if (!object->finished_event &&
+            NtCreateEvent( &object->finished_event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE ))
+        {
+            ERR( "failed to create event for object %p\n", object );
+            object->finished_event = NULL;
+            break;
+        }
+        NtResetEvent( object->finished_event, NULL );
+        object->num_waiters++;
+        RtlLeaveCriticalSection( &pool->cs );
+
+        NtWaitForSingleObject( object->finished_event, FALSE, NULL );
+
+        RtlEnterCriticalSection( &pool->cs );
+        object->num_waiters--;
+    }
+
+    RtlLeaveCriticalSection( &pool->cs );
+
+    /* the caller still owns a reference, so this can't destroy the object */
+    while (cancelled--) threadpool_object_release( object );
+}
+
+static NTSTATUS threadpool_object_alloc( struct threadpool_object **out, enum threadpool_objtype type,
+                                         PVOID userdata, TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool_object *object;
+
+    if (environment && (environment->CleanupGroup || environment->RaceDll ||
+                        environment->FinalizationCallback || environment->ActivationContext))
+        FIXME( "unsupported callback environment %p\n", environment );
+
+    if (!(object = RtlAllocateHeap( GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*object) )))
+        return STATUS_NO_MEMORY;
+
+    if (!(object->pool = threadpool_get( environment )))
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, object );
+        return STATUS_NO_MEMORY;
+    }
+
+    object->refcount = 1;
+    object->type     = type;
+    object->userdata = userdata;
+
+    *out = object;
+    return STATUS_SUCCESS;
+}
+
 /***********************************************************************
  *              RtlQueueWorkItem   (NTDLL.@)
  *
@@ -182,52 +483,22 @@ static NTSTATUS add_work_item_to_queue(struct work_item *work_item)
  */
 NTSTATUS WINAPI RtlQueueWorkItem(PRTL_WORK_ITEM_ROUTINE Function, PVOID Context, ULONG Flags)
 {
-    HANDLE thread;
+    struct threadpool_object *object;
     NTSTATUS status;
-    struct work_item *work_item = RtlAllocateHeap(GetProcessHeap(), 0, sizeof(struct work_item));
-
-    if (!work_item)
-        return STATUS_NO_MEMORY;
 
-    work_item->function = Function;
-    work_item->context = Context;
+    TRACE("%p %p %x\n", Function, Context, Flags);
 
     if (Flags & ~WT_EXECUTELONGFUNCTION)
         FIXME("Flags 0x%x not supported\n", Flags);
 
-    status = add_work_item_to_queue(work_item);
+    status = threadpool_object_alloc( &object, TP_OBJECT_TYPE_SIMPLE, Context, NULL );
+    if (status) return status;
 
-    /* FIXME: tune this algorithm to not be as aggressive with creating threads
-     * if WT_EXECUTELONGFUNCTION isn't specified */
-    if ((status == STATUS_SUCCESS) &&
-        ((num_workers == 0) || (num_workers == num_busy_workers)))
-    {
-        status = RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE,
-                                    NULL, 0, 0,
-                                    worker_thread_proc, NULL, &thread, NULL );
-        if (status == STATUS_SUCCESS)
-            NtClose( thread );
-
-        /* NOTE: we don't care if we couldn't create the thread if there is at
-         * least one other available to process the request */
-        if ((num_workers > 0) && (status != STATUS_SUCCESS))
-            status = STATUS_SUCCESS;
-    }
-
-    if (status != STATUS_SUCCESS)
-    {
-        RtlEnterCriticalSection(&threadpool_cs);
-
-        interlocked_dec(&num_work_items);
-        list_remove(&work_item->entry);
-        RtlFreeHeap(GetProcessHeap(), 0, work_item);
-
-        RtlLeaveCriticalSection(&threadpool_cs);
-
-        return status;
-    }
-
-    return STATUS_SUCCESS;
+    object->u.simple.function = Function;
+    object->long_function = (Flags & WT_EXECUTELONGFUNCTION) != 0;
+    status = threadpool_object_submit( object );
+    threadpool_object_release( object );
+    return status;
 }
 
 /***********************************************************************
@@ -321,76 +592,288 @@ static inline PLARGE_INTEGER get_nt_timeout( PLARGE_INTEGER pTime, ULONG timeout
     return pTime;
 }
 
+/************************** Registered waits **************************/
+
+#define EXPIRE_INFINITE (~(ULONGLONG)0)
+
+/* a thread waiting on behalf of up to MAXIMUM_WAIT_OBJECTS - 1 registered waits */
+struct wait_bucket
+{
+    struct list entry;          /* entry in wait_buckets */
+    struct list waits;          /* waits in the wait set */
+    struct list removed;        /* deregistered waits the thread may still reference */
+    int         count;          /* number of waits in both lists */
+    BOOL        alertable;      /* wait alertably, for WT_EXECUTEINIOTHREAD waits */
+    HANDLE      update_event;   /* signaled when the wait set changes */
+};
+
+/* all the fields are protected by waitqueue_cs */
 struct wait_work_item
 {
+    struct list entry;              /* entry in one of the bucket lists */
+    struct wait_bucket *bucket;     /* NULL once out of the wait set */
     HANDLE Object;
-    HANDLE CancelEvent;
     WAITORTIMERCALLBACK Callback;
     PVOID Context;
     ULONG Milliseconds;
     ULONG Flags;
+    ULONGLONG Expire;               /* absolute time of the next timeout */
     HANDLE CompletionEvent;
-    LONG DeleteCount;
-    BOOLEAN CallbackInProgress;
+    int RefCount;
+    BOOL Deleted;
+    BOOL CallbackInProgress;
+    BOOLEAN TimerOrWaitFired;
+};
+
+static struct list wait_buckets = LIST_INIT(wait_buckets);
+
+static RTL_CRITICAL_SECTION waitqueue_cs;
+static RTL_CRITICAL_SECTION_DEBUG waitqueue_debug =
+{
+    0, 0, &waitqueue_cs,
+    { &waitqueue_debug.ProcessLocksList, &waitqueue_debug.ProcessLocksList },
+    0, 0, { (DWORD_PTR)(__FILE__ ": waitqueue_cs") }
 };
+static RTL_CRITICAL_SECTION waitqueue_cs = { &waitqueue_debug, -1, 0, 0, 0, 0 };
 
-static void delete_wait_work_item(struct wait_work_item *wait_work_item)
+static void wait_work_item_set_expire(struct wait_work_item *wait_work_item)
 {
-    NtClose( wait_work_item->CancelEvent );
+    LARGE_INTEGER now;
+
+    if (wait_work_item->Milliseconds == INFINITE)
+    {
+        wait_work_item->Expire = EXPIRE_INFINITE;
+        return;
+    }
+    NtQuerySystemTime( &now );
+    wait_work_item->Expire = now.QuadPart + (ULONGLONG)wait_work_item->Milliseconds * 10000;
+}
+
+static void wait_work_item_release(struct wait_work_item *wait_work_item)
+{
+    if (--wait_work_item->RefCount) return;
     RtlFreeHeap( GetProcessHeap(), 0, wait_work_item );
 }
 
-static DWORD CALLBACK wait_thread_proc(LPVOID Arg)
+/* take the wait out of its bucket; only the wait thread does this */
+static void wait_work_item_remove(struct wait_work_item *wait_work_item)
+{
+    list_remove( &wait_work_item->entry );
+    wait_work_item->bucket->count--;
+    wait_work_item->bucket = NULL;
+    wait_work_item_release( wait_work_item );
+}
+
+static void wait_work_item_fire(struct wait_work_item *wait_work_item, BOOLEAN TimerOrWaitFired)
+{
+    TRACE( "%s for object %p, calling callback %p with context %p\n",
+           TimerOrWaitFired ? "wait timed out" : "object signaled", wait_work_item->Object,
+           wait_work_item->Callback, wait_work_item->Context );
+
+    wait_work_item->CallbackInProgress = TRUE;
+    wait_work_item->TimerOrWaitFired = TimerOrWaitFired;
+    wait_work_item->RefCount++;
+    if (wait_work_item->Flags & WT_EXECUTEONLYONCE)
+        wait_work_item_remove( wait_work_item );
+}
+
+static void wait_work_item_run(struct wait_work_item *wait_work_item)
+{
+    wait_work_item->Callback( wait_work_item->Context, wait_work_item->TimerOrWaitFired );
+
+    RtlEnterCriticalSection( &waitqueue_cs );
+    wait_work_item->CallbackInProgress = FALSE;
+    if (wait_work_item->Deleted)
+    {
+        if (wait_work_item->CompletionEvent)
+            NtSetEvent( wait_work_item->CompletionEvent, NULL );
+    }
+    else if (wait_work_item->bucket)
+    {
+        /* put the object back into the wait set */
+        wait_work_item_set_expire( wait_work_item );
+        if (!(wait_work_item->Flags & WT_EXECUTEINWAITTHREAD))
+            NtSetEvent( wait_work_item->bucket->update_event, NULL );
+    }
+    wait_work_item_release( wait_work_item );
+    RtlLeaveCriticalSection( &waitqueue_cs );
+}
+
+static DWORD CALLBACK wait_work_item_proc(LPVOID Arg)
+{
+    wait_work_item_run( Arg );
+    return 0;
+}
+
+/* find out which handle made the wait fail, and drop it from the wait set */
+static void wait_bucket_remove_invalid(struct wait_work_item **items, ULONG count)
 {
-    struct wait_work_item *wait_work_item = Arg;
+    OBJECT_BASIC_INFORMATION info;
+    BOOL found = FALSE;
+    ULONG i;
+
+    for (i = 1; i < count; i++)
+    {
+        if (!NtQueryObject( items[i]->Object, ObjectBasicInformation, &info, sizeof(info), NULL ))
+            continue;
+        WARN( "invalid handle %p, removing wait %p\n", items[i]->Object, items[i] );
+        if (items[i]->bucket) wait_work_item_remove( items[i] );
+        found = TRUE;
+    }
+    if (found) return;
+
+    ERR( "wait failed without an invalid handle, removing all waits\n" );
+    for (i = 1; i < count; i++)
+        if (items[i]->bucket) wait_work_item_remove( items[i] );
+}
+
+static void WINAPI wait_thread_proc(LPVOID Arg)
+{
+    struct wait_bucket *bucket = Arg;
+    struct wait_work_item *items[MAXIMUM_WAIT_OBJECTS];
+    struct wait_work_item *fired[MAXIMUM_WAIT_OBJECTS];
+    HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+    struct wait_work_item *wait_work_item, *next;
+    LARGE_INTEGER now, timeout;
+    ULONGLONG expire;
+    ULONG count, nb_fired = 0, i;
     NTSTATUS status;
-    BOOLEAN alertable = (wait_work_item->Flags & WT_EXECUTEINIOTHREAD) != 0;
-    HANDLE handles[2] = { wait_work_item->Object, wait_work_item->CancelEvent };
-    LARGE_INTEGER timeout;
-    HANDLE completion_event;
 
-    TRACE("\n");
+    TRACE( "starting wait thread for bucket %p\n", bucket );
 
-    while (TRUE)
+    RtlEnterCriticalSection( &waitqueue_cs );
+    for (;;)
     {
-        status = NtWaitForMultipleObjects( 2, handles, FALSE, alertable,
-                                           get_nt_timeout( &timeout, wait_work_item->Milliseconds ) );
-        if (status == STATUS_WAIT_0 || status == STATUS_TIMEOUT)
+        /* drop the waits that got deregistered while we were waiting */
+        LIST_FOR_EACH_ENTRY_SAFE( wait_work_item, next, &bucket->removed, struct wait_work_item, entry )
+            wait_work_item_remove( wait_work_item );
+
+        NtQuerySystemTime( &now );
+        LIST_FOR_EACH_ENTRY_SAFE( wait_work_item, next, &bucket->waits, struct wait_work_item, entry )
         {
-            BOOLEAN TimerOrWaitFired;
+            if (wait_work_item->CallbackInProgress) continue;
+            if (wait_work_item->Expire <= now.QuadPart)
+            {
+                wait_work_item_fire( wait_work_item, TRUE );
+                fired[nb_fired++] = wait_work_item;
+            }
+        }
 
-            if (status == STATUS_WAIT_0)
+        for (i = 0; i < nb_fired; i++)
+        {
+            wait_work_item = fired[i];
+            if (wait_work_item->Flags & WT_EXECUTEINWAITTHREAD)
             {
-                TRACE( "object %p signaled, calling callback %p with context %p\n",
-                    wait_work_item->Object, wait_work_item->Callback,
-                    wait_work_item->Context );
-                TimerOrWaitFired = FALSE;
+                RtlLeaveCriticalSection( &waitqueue_cs );
+                wait_work_item_run( wait_work_item );
+                RtlEnterCriticalSection( &waitqueue_cs );
+                continue;
             }
-            else
+            status = RtlQueueWorkItem( wait_work_item_proc, wait_work_item,
+                                       wait_work_item->Flags & (WT_EXECUTEINIOTHREAD | WT_EXECUTEINPERSISTENTTHREAD |
+                                                                WT_EXECUTELONGFUNCTION | WT_TRANSFER_IMPERSONATION) );
+            if (status)
             {
-                TRACE( "wait for object %p timed out, calling callback %p with context %p\n",
-                    wait_work_item->Object, wait_work_item->Callback,
-                    wait_work_item->Context );
-                TimerOrWaitFired = TRUE;
+                ERR( "failed to queue callback for wait %p, status %08x\n", wait_work_item, status );
+                wait_work_item->CallbackInProgress = FALSE;
+                /* don't fire the timeout again right away */
+                if (wait_work_item->bucket) wait_work_item_set_expire( wait_work_item );
+                wait_work_item_release( wait_work_item );
             }
-            wait_work_item->CallbackInProgress = TRUE;
-            wait_work_item->Callback( wait_work_item->Context, TimerOrWaitFired );
-            wait_work_item->CallbackInProgress = FALSE;
+        }
+        nb_fired = 0;
 
-            if (wait_work_item->Flags & WT_EXECUTEONLYONCE)
-                break;
+        if (!bucket->count) break;
+
+        /* the callbacks run in the pool; objects come back into the wait set once they're done */
+        handles[0] = bucket->update_event;
+        count = 1;
+        expire = EXPIRE_INFINITE;
+        LIST_FOR_EACH_ENTRY( wait_work_item, &bucket->waits, struct wait_work_item, entry )
+        {
+            if (wait_work_item->CallbackInProgress) continue;
+            if (wait_work_item->Expire < expire) expire = wait_work_item->Expire;
+            handles[count] = wait_work_item->Object;
+            items[count++] = wait_work_item;
         }
+        RtlLeaveCriticalSection( &waitqueue_cs );
+
+        timeout.QuadPart = expire;
+        status = NtWaitForMultipleObjects( count, handles, FALSE, bucket->alertable,
+                                           expire == EXPIRE_INFINITE ? NULL : &timeout );
+
+        RtlEnterCriticalSection( &waitqueue_cs );
+        if (status >= STATUS_WAIT_0 + 1 && status < STATUS_WAIT_0 + count)
+            i = status - STATUS_WAIT_0;
+        else if (status >= STATUS_ABANDONED_WAIT_0 + 1 && status < STATUS_ABANDONED_WAIT_0 + count)
+            i = status - STATUS_ABANDONED_WAIT_0;
         else
-            break;
+        {
+            if (status & 0xc0000000) wait_bucket_remove_invalid( items, count );
+            continue;
+        }
+
+        /* deregistered waits are still on the removed list, so the item is valid */
+        if (!items[i]->Deleted)
+        {
+            wait_work_item_fire( items[i], FALSE );
+            fired[nb_fired++] = items[i];
+        }
     }
 
-    completion_event = wait_work_item->CompletionEvent;
-    if (completion_event) NtSetEvent( completion_event, NULL );
+    TRACE( "no waits left in bucket %p, exiting\n", bucket );
+    list_remove( &bucket->entry );
+    RtlLeaveCriticalSection( &waitqueue_cs );
 
-    if (interlocked_inc( &wait_work_item->DeleteCount ) == 2 )
-        delete_wait_work_item( wait_work_item );
+    NtClose( bucket->update_event );
+    RtlFreeHeap( GetProcessHeap(), 0, bucket );
+    RtlExitUserThread( 0 );
+}
 
-    return 0;
+/* returns a bucket with room for one more wait; must be called with waitqueue_cs held */
+static NTSTATUS get_wait_bucket(struct wait_bucket **ret, BOOL alertable)
+{
+    struct wait_bucket *bucket;
+    HANDLE thread;
+    NTSTATUS status;
+
+    LIST_FOR_EACH_ENTRY( bucket, &wait_buckets, struct wait_bucket, entry )
+    {
+        if (bucket->alertable == alertable && bucket->count < MAXIMUM_WAIT_OBJECTS - 1)
+        {
+            *ret = bucket;
+            return STATUS_SUCCESS;
+        }
+    }
+
+    if (!(bucket = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*bucket) )))
+        return STATUS_NO_MEMORY;
+
+    status = NtCreateEvent( &bucket->update_event, EVENT_ALL_ACCESS, NULL, SynchronizationEvent, FALSE );
+    if (status)
+    {
+        RtlFreeHeap( GetProcessHeap(), 0, bucket );
+        return status;
+    }
+    list_init( &bucket->waits );
+    list_init( &bucket->removed );
+    bucket->count = 0;
+    bucket->alertable = alertable;
+
+    /* the thread can't look at the bucket before we release waitqueue_cs */
+    status = RtlCreateUserThread( GetCurrentProcess(), NULL, FALSE, NULL, 0, 0,
+                                  wait_thread_proc, bucket, &thread, NULL );
+    if (status)
+    {
+        NtClose( bucket->update_event );
+        RtlFreeHeap( GetProcessHeap(), 0, bucket );
+        return status;
+    }
+    NtClose( thread );
+
+    list_add_tail( &wait_buckets, &bucket->entry );
+    *ret = bucket;
+    return STATUS_SUCCESS;
 }
 
 /***********************************************************************
@@ -417,12 +900,18 @@ static DWORD CALLBACK wait_thread_proc(LPVOID Arg)
  *|WT_EXECUTEINPERSISTENTTHREAD - Executes the work item in a thread that is persistent.
  *|WT_EXECUTELONGFUNCTION - Hints that the execution can take a long time.
  *|WT_TRANSFER_IMPERSONATION - Executes the function with the current access token.
+ *
+ *  The waits are shared between wait threads, each of them handling up to
+ *  MAXIMUM_WAIT_OBJECTS - 1 objects; the callbacks are executed in the
+ *  thread pool unless WT_EXECUTEINWAITTHREAD is specified. Waits with
+ *  WT_EXECUTEINIOTHREAD get their own wait threads, which wait alertably.
  */
 NTSTATUS WINAPI RtlRegisterWait(PHANDLE NewWaitObject, HANDLE Object,
                                 RTL_WAITORTIMERCALLBACKFUNC Callback,
                                 PVOID Context, ULONG Milliseconds, ULONG Flags)
 {
     struct wait_work_item *wait_work_item;
+    struct wait_bucket *bucket;
     NTSTATUS status;
 
     TRACE( "(%p, %p, %p, %p, %d, 0x%x)\n", NewWaitObject, Object, Callback, Context, Milliseconds, Flags );
@@ -436,23 +925,26 @@ NTSTATUS WINAPI RtlRegisterWait(PHANDLE NewWaitObject, HANDLE Object,
     wait_work_item->Context = Context;
     wait_work_item->Milliseconds = Milliseconds;
     wait_work_item->Flags = Flags;
-    wait_work_item->CallbackInProgress = FALSE;
-    wait_work_item->DeleteCount = 0;
     wait_work_item->CompletionEvent = NULL;
+    wait_work_item->RefCount = 2;  /* the caller and the wait bucket */
+    wait_work_item->Deleted = FALSE;
+    wait_work_item->CallbackInProgress = FALSE;
+    wait_work_item_set_expire( wait_work_item );
 
-    status = NtCreateEvent( &wait_work_item->CancelEvent, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
-    if (status != STATUS_SUCCESS)
+    RtlEnterCriticalSection( &waitqueue_cs );
+    status = get_wait_bucket( &bucket, (Flags & WT_EXECUTEINIOTHREAD) != 0 );
+    if (status == STATUS_SUCCESS)
     {
-        RtlFreeHeap( GetProcessHeap(), 0, wait_work_item );
-        return status;
+        wait_work_item->bucket = bucket;
+        list_add_tail( &bucket->waits, &wait_work_item->entry );
+        bucket->count++;
+        NtSetEvent( bucket->update_event, NULL );
     }
+    RtlLeaveCriticalSection( &waitqueue_cs );
 
-    Flags = Flags & (WT_EXECUTEINIOTHREAD | WT_EXECUTEINPERSISTENTTHREAD |
-                     WT_EXECUTELONGFUNCTION | WT_TRANSFER_IMPERSONATION);
-    status = RtlQueueWorkItem( wait_thread_proc, wait_work_item, Flags );
     if (status != STATUS_SUCCESS)
     {
-        delete_wait_work_item( wait_work_item );
+        RtlFreeHeap( GetProcessHeap(), 0, wait_work_item );
         return status;
     }
 
@@ -477,41 +969,49 @@ NTSTATUS WINAPI RtlDeregisterWaitEx(HANDLE WaitHandle, HANDLE CompletionEvent)
 {
     struct wait_work_item *wait_work_item = WaitHandle;
     NTSTATUS status = STATUS_SUCCESS;
+    HANDLE event = NULL;
 
     TRACE( "(%p)\n", WaitHandle );
 
-    NtSetEvent( wait_work_item->CancelEvent, NULL );
+    RtlEnterCriticalSection( &waitqueue_cs );
+
+    wait_work_item->Deleted = TRUE;
+    if (wait_work_item->bucket)
+    {
+        /* the wait thread drops it the next time it wakes up */
+        list_remove( &wait_work_item->entry );
+        list_add_tail( &wait_work_item->bucket->removed, &wait_work_item->entry );
+        NtSetEvent( wait_work_item->bucket->update_event, NULL );
+    }
+
     if (wait_work_item->CallbackInProgress)
     {
-        if (CompletionEvent != NULL)
+        if (CompletionEvent == INVALID_HANDLE_VALUE)
         {
-            if (CompletionEvent == INVALID_HANDLE_VALUE)
-            {
-                status = NtCreateEvent( &CompletionEvent, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
-                if (status != STATUS_SUCCESS)
-                    return status;
-                interlocked_xchg_ptr( &wait_work_item->CompletionEvent, CompletionEvent );
-                if (wait_work_item->CallbackInProgress)
-                    NtWaitForSingleObject( CompletionEvent, FALSE, NULL );
-                NtClose( CompletionEvent );
-            }
-            else
-            {
-                interlocked_xchg_ptr( &wait_work_item->CompletionEvent, CompletionEvent );
-                if (wait_work_item->CallbackInProgress)
-                    status = STATUS_PENDING;
-            }
+            status = NtCreateEvent( &event, EVENT_ALL_ACCESS, NULL, NotificationEvent, FALSE );
+            if (status == STATUS_SUCCESS)
+                wait_work_item->CompletionEvent = event;
         }
         else
+        {
+            wait_work_item->CompletionEvent = CompletionEvent;
             status = STATUS_PENDING;
+        }
     }
+    else if (CompletionEvent && CompletionEvent != INVALID_HANDLE_VALUE)
+        NtSetEvent( CompletionEvent, NULL );
 
-    if (interlocked_inc( &wait_work_item->DeleteCount ) == 2 )
+    if (event)
     {
-        status = STATUS_SUCCESS;
-        delete_wait_work_item( wait_work_item );
+        RtlLeaveCriticalSection( &waitqueue_cs );
+        NtWaitForSingleObject( event, FALSE, NULL );
+        NtClose( event );
+        RtlEnterCriticalSection( &waitqueue_cs );
     }
 
+    wait_work_item_release( wait_work_item );
+    RtlLeaveCriticalSection( &waitqueue_cs );
+
     return status;
 }
 
@@ -1035,3 +1535,320 @@ NTSTATUS WINAPI RtlDeleteTimer(HANDLE TimerQueue, HANDLE Timer,
 
     return status;
 }
+
+/************************** Thread pool API **************************/
+
+static inline struct threadpool *impl_from_TP_POOL( TP_POOL *pool )
+{
+    return (struct threadpool *)pool;
+}
+
+static inline struct threadpool_object *impl_from_TP_WORK( TP_WORK *work )
+{
+    struct threadpool_object *object = (struct threadpool_object *)work;
+    assert( object->type == TP_OBJECT_TYPE_WORK );
+    return object;
+}
+
+static inline struct threadpool_object *impl_from_TP_TIMER( TP_TIMER *timer )
+{
+    struct threadpool_object *object = (struct threadpool_object *)timer;
+    assert( object->type == TP_OBJECT_TYPE_TIMER );
+    return object;
+}
+
+/***********************************************************************
+ *           TpAllocPool    (NTDLL.@)
+ */
+NTSTATUS WINAPI TpAllocPool( TP_POOL **out, PVOID reserved )
+{
+    struct threadpool *pool;
+    NTSTATUS status;
+
+    TRACE( "%p %p\n", out, reserved );
+
+    if (reserved) FIXME( "reserved argument is nonzero (%p)\n", reserved );
+
+    if (!(status = threadpool_alloc( &pool )))
+        *out = (TP_POOL *)pool;
+    return status;
+}
+
+/***********************************************************************
+ *           TpReleasePool    (NTDLL.@)
+ *
+ * Idle workers exit right away, busy ones once the pending callbacks
+ * are done. The pool is destroyed with its last object.
+ */
+void WINAPI TpReleasePool( TP_POOL *pool )
+{
+    struct threadpool *this = impl_from_TP_POOL( pool );
+    int count;
+
+    TRACE( "%p\n", pool );
+
+    RtlEnterCriticalSection( &this->cs );
+    this->shutdown = TRUE;
+    if ((count = this->num_waiting - this->num_wakeups) > 0)
+    {
+        this->num_wakeups += count;
+        NtReleaseSemaphore( this->semaphore, count, NULL );
+    }
+    RtlLeaveCriticalSection( &this->cs );
+
+    threadpool_release( this );
+}
+
+/***********************************************************************
+ *           TpSetPoolMaxThreads    (NTDLL.@)
+ */
+void WINAPI TpSetPoolMaxThreads( TP_POOL *pool, DWORD maximum )
+{
+    struct threadpool *this = impl_from_TP_POOL( pool );
+
+    TRACE( "%p %u\n", pool, maximum );
+
+    RtlEnterCriticalSection( &this->cs );
+    this->max_workers = max( maximum, 1 );
+    this->min_workers = min( this->min_workers, this->max_workers );
+    RtlLeaveCriticalSection( &this->cs );
+}
+
+/***********************************************************************
+ *           TpSetPoolMinThreads    (NTDLL.@)
+ */
+BOOL WINAPI TpSetPoolMinThreads( TP_POOL *pool, DWORD minimum )
+{
+    struct threadpool *this = impl_from_TP_POOL( pool );
+    NTSTATUS status = STATUS_SUCCESS;
+
+    TRACE( "%p %u\n", pool, minimum );
+
+    RtlEnterCriticalSection( &this->cs );
+    while ((DWORD)this->num_workers < minimum)
+    {
+        if ((status = threadpool_add_worker( this ))) break;
+    }
+    if (!status)
+    {
+        this->min_workers = minimum;
+        this->max_workers = max( this->min_workers, this->max_workers );
+    }
+    RtlLeaveCriticalSection( &this->cs );
+
+    return !status;
+}
+
+/***********************************************************************
+ *           TpSimpleTryPost    (NTDLL.@)
+ */
+NTSTATUS WINAPI TpSimpleTryPost( PTP_SIMPLE_CALLBACK callback, PVOID userdata,
+                                 TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool_object *object;
+    NTSTATUS status;
+
+    TRACE( "%p %p %p\n", callback, userdata, environment );
+
+    status = threadpool_object_alloc( &object, TP_OBJECT_TYPE_SIMPLE, userdata, environment );
+    if (status) return status;
+
+    object->u.simple.callback = callback;
+    status = threadpool_object_submit( object );
+    threadpool_object_release( object );
+    return status;
+}
+
+/***********************************************************************
+ *           TpAllocWork    (NTDLL.@)
+ */
+NTSTATUS WINAPI TpAllocWork( TP_WORK **out, PTP_WORK_CALLBACK callback, PVOID userdata,
+                             TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool_object *object;
+    NTSTATUS status;
+
+    TRACE( "%p %p %p %p\n", out, callback, userdata, environment );
+
+    status = threadpool_object_alloc( &object, TP_OBJECT_TYPE_WORK, userdata, environment );
+    if (status) return status;
+
+    object->u.work.callback = callback;
+    *out = (TP_WORK *)object;
+    return STATUS_SUCCESS;
+}
+
+/***********************************************************************
+ *           TpPostWork    (NTDLL.@)
+ */
+void WINAPI TpPostWork( TP_WORK *work )
+{
+    struct threadpool_object *this = impl_from_TP_WORK( work );
+    NTSTATUS status;
+
+    TRACE( "%p\n", work );
+
+    if ((status = threadpool_object_submit( this )))
+        ERR( "failed to post work %p, status %08x\n", work, status );
+}
+
+/***********************************************************************
+ *           TpWaitForWork    (NTDLL.@)
+ */
+void WINAPI TpWaitForWork( TP_WORK *work, BOOL cancel_pending )
+{
+    struct threadpool_object *this = impl_from_TP_WORK( work );
+
+    TRACE( "%p %d\n", work, cancel_pending );
+
+    threadpool_object_wait( this, cancel_pending );
+}
+
+/***********************************************************************
+ *           TpReleaseWork    (NTDLL.@)
+ */
+void WINAPI TpReleaseWork( TP_WORK *work )
+{
+    struct threadpool_object *this = impl_from_TP_WORK( work );
+
+    TRACE( "%p\n", work );
+
+    threadpool_object_release( this );
+}
+
+static void CALLBACK threadpool_timer_proc( PVOID param, BOOLEAN fired )
+{
+    struct timer_set *set = param;
+    struct threadpool_object *object = set->object;
+    NTSTATUS status;
+
+    if (!set->period)
+    {
+        RtlEnterCriticalSection( &object->pool->cs );
+        set->expired = TRUE;
+        RtlLeaveCriticalSection( &object->pool->cs );
+    }
+    if ((status = threadpool_object_submit( object )))
+        ERR( "failed to queue callback for timer %p, status %08x\n", object, status );
+}
+
+/***********************************************************************
+ *           TpAllocTimer    (NTDLL.@)
+ */
+NTSTATUS WINAPI TpAllocTimer( TP_TIMER **out, PTP_TIMER_CALLBACK callback, PVOID userdata,
+                              TP_CALLBACK_ENVIRON *environment )
+{
+    struct threadpool_object *object;
+    NTSTATUS status;
+
+    TRACE( "%p %p %p %p\n", out, callback, userdata, environment );
+
+    status = threadpool_object_alloc( &object, TP_OBJECT_TYPE_TIMER, userdata, environment );
+    if (status) return status;
+
+    object->u.timer.callback = callback;
+    *out = (TP_TIMER *)object;
+    return STATUS_SUCCESS;
+}
+
+/***********************************************************************
+ *           TpSetTimer    (NTDLL.@)
+ *
+ * A negative timeout is relative, a positive one absolute, and a NULL
+ * timeout cancels the timer. Callbacks already queued still run.
+ */
+void WINAPI TpSetTimer( TP_TIMER *timer, LARGE_INTEGER *timeout, LONG period, LONG window )
+{
+    struct threadpool_object *this = impl_from_TP_TIMER( timer );
+    struct timer_set *old, *new = NULL;
+
+    TRACE( "%p %p %d %d\n", timer, timeout, period, window );
+
+    if (window) FIXME( "ignoring window %d\n", window );
+
+    if (timeout)
+    {
+        ULONGLONG due = 0;
+        LARGE_INTEGER now;
+        NTSTATUS status;
+
+        if (timeout->QuadPart < 0)
+            due = (-timeout->QuadPart + 9999) / 10000;
+        else if (timeout->QuadPart > 0)
+        {
+            NtQuerySystemTime( &now );
+            if (timeout->QuadPart > now.QuadPart)
+                due = (timeout->QuadPart - now.QuadPart + 9999) / 10000;
+        }
+
+        if (!(new = RtlAllocateHeap( GetProcessHeap(), 0, sizeof(*new) )))
+            status = STATUS_NO_MEMORY;
+        else
+        {
+            new->object  = this;
+            new->period  = period;
+            new->expired = FALSE;
+            status = RtlCreateTimer( &new->timer, NULL, threadpool_timer_proc, new,
+                                     min( due, INFINITE - 1 ), period, WT_EXECUTEINTIMERTHREAD );
+        }
+        if (status)
+        {
+            ERR( "failed to set timer %p, status %08x\n", timer, status );
+            RtlFreeHeap( GetProcessHeap(), 0, new );
+            new = NULL;
+        }
+    }
+
+    RtlEnterCriticalSection( &this->pool->cs );
+    old = this->u.timer.set;
+    this->u.timer.set = new;
+    RtlLeaveCriticalSection( &this->pool->cs );
+
+    if (old)
+    {
+        RtlDeleteTimer( NULL, old->timer, INVALID_HANDLE_VALUE );
+        RtlFreeHeap( GetProcessHeap(), 0, old );
+    }
+}
+
+/***********************************************************************
+ *           TpIsTimerSet    (NTDLL.@)
+ */
+BOOL WINAPI TpIsTimerSet( TP_TIMER *timer )
+{
+    struct threadpool_object *this = impl_from_TP_TIMER( timer );
+    BOOL ret;
+
+    TRACE( "%p\n", timer );
+
+    RtlEnterCriticalSection( &this->pool->cs );
+    ret = this->u.timer.set && !this->u.timer.set->expired;
+    RtlLeaveCriticalSection( &this->pool->cs );
+    return ret;
+}
+
+/***********************************************************************
+ *           TpWaitForTimer    (NTDLL.@)
+ */
+void WINAPI TpWaitForTimer( TP_TIMER *timer, BOOL cancel_pending )
+{
+    struct threadpool_object *this = impl_from_TP_TIMER( timer );
+
+    TRACE( "%p %d\n", timer, cancel_pending );
+
+    threadpool_object_wait( this, cancel_pending );
+}
+
+/***********************************************************************
+ *           TpReleaseTimer    (NTDLL.@)
+ */
+void WINAPI TpReleaseTimer( TP_TIMER *timer )
+{
+    struct threadpool_object *this = impl_from_TP_TIMER( timer );
+
+    TRACE( "%p\n", timer );
+
+    /* make sure the timer queue doesn't reference the object anymore */
+    TpSetTimer( timer, NULL, 0, 0 );
+    threadpool_object_release( this );
+}
@@ -52,6 +52,7 @@
 #include "wine/server.h"
 #include "wine/exception.h"
 #include "wine/list.h"
+#include "wine/rbtree.h"
 #include "wine/debug.h"
 #include "ntdll_misc.h"
 
@@ -70,6 +71,7 @@ WINE_DECLARE_DEBUG_CHANNEL(module);
 struct file_view
 {
     struct list   entry;       /* Entry in global view list */
+    struct wine_rb_entry tree_entry; /* Entry in global view tree */
     void         *base;        /* Base address */
     size_t        size;        /* Size in bytes */
     HANDLE        mapping;     /* Handle to the file mapping */
@@ -101,6 +103,7 @@ static const BYTE VIRTUAL_Win32Flags[16] =
 };
 
 static struct list views_list = LIST_INIT(views_list);
+static struct wine_rb_tree views_tree;
 
 static RTL_CRITICAL_SECTION csVirtual;
 static RTL_CRITICAL_SECTION_DEBUG critsect_debug =
@@ -249,6 +252,81 @@ static void VIRTUAL_Dump(void)
 #endif
 
 
+/***********************************************************************
+ *           views_tree_alloc
+ */
+static void *views_tree_alloc( size_t size )
+{
+    return RtlAllocateHeap( virtual_heap, 0, size );
+}
+
+
+/***********************************************************************
+ *           views_tree_realloc
+ */
+static void *views_tree_realloc( void *ptr, size_t size )
+{
+    return RtlReAllocateHeap( virtual_heap, 0, ptr, size );
+}
+
+
+/***********************************************************************
+ *           views_tree_free
+ */
+static void views_tree_free( void *ptr )
+{
+    RtlFreeHeap( virtual_heap, 0, ptr );
+}
+
+
+/***********************************************************************
+ *           compare_view
+ *
+ * Compare a base address to the base address of a view, for the view tree.
+ */
+static int compare_view( const void *addr, const struct wine_rb_entry *entry )
+{
+    const struct file_view *view = WINE_RB_ENTRY_VALUE( entry, const struct file_view, tree_entry );
+
+    if (addr < view->base) return -1;
+    return addr > view->base;
+}
+
+static const struct wine_rb_functions views_tree_functions =
+{
+    views_tree_alloc,
+    views_tree_realloc,
+    views_tree_free,
+    compare_view,
+};
+
+
+/***********************************************************************
+ *           find_view_before
+ *
+ * Find the view with the highest base address that is not above addr.
+ * The csVirtual section must be held by caller.
+ */
+static struct file_view *find_view_before( const void *addr )
+{
+    struct wine_rb_entry *ptr = views_tree.root;
+    struct file_view *ret = NULL;
+
+    while (ptr)
+    {
+        struct file_view *view = WINE_RB_ENTRY_VALUE( ptr, struct file_view, tree_entry );
+
+        if (view->base > addr) ptr = ptr->left;
+        else
+        {
+            ret = view;
+            ptr = ptr->right;
+        }
+    }
+    return ret;
+}
+
+
 /***********************************************************************
  *           VIRTUAL_FindView
  *
@@ -263,17 +341,13 @@ static void VIRTUAL_Dump(void)
  */
 static struct file_view *VIRTUAL_FindView( const void *addr, size_t size )
 {
-    struct file_view *view;
+    struct file_view *view = find_view_before( addr );
 
-    LIST_FOR_EACH_ENTRY( view, &views_list, struct file_view, entry )
-    {
-        if (view->base > addr) break;  /* no matching view */
-        if ((const char *)view->base + view->size <= (const char *)addr) continue;
-        if ((const char *)view->base + view->size < (const char *)addr + size) break;  /* size too large */
-        if ((const char *)addr + size < (const char *)addr) break; /* overflow */
-        return view;
-    }
-    return NULL;
+    if (!view) return NULL;  /* no matching view */
+    if ((const char *)view->base + view->size <= (const char *)addr) return NULL;
+    if ((const char *)view->base + view->size < (const char *)addr + size) return NULL;  /* size too large */
+    if ((const char *)addr + size < (const char *)addr) return NULL; /* overflow */
+    return view;
 }
 
 
@@ -296,14 +370,20 @@ static inline UINT_PTR get_mask( ULONG zero_bits )
  */
 static struct file_view *find_view_range( const void *addr, size_t size )
 {
-    struct file_view *view;
+    struct file_view *view = find_view_before( addr );
+    struct list *ptr;
 
-    LIST_FOR_EACH_ENTRY( view, &views_list, struct file_view, entry )
+    if (view)
     {
-        if ((const char *)view->base >= (const char *)addr + size) break;
         if ((const char *)view->base + view->size > (const char *)addr) return view;
+        ptr = list_next( &views_list, &view->entry );
     }
-    return NULL;
+    else ptr = list_head( &views_list );
+
+    if (!ptr) return NULL;
+    view = LIST_ENTRY( ptr, struct file_view, entry );
+    if ((const char *)view->base >= (const char *)addr + size) return NULL;
+    return view;
 }
 
 
@@ -315,6 +395,7 @@ static struct file_view *find_view_range( const void *addr, size_t size )
  */
 static void *find_free_area( void *base, void *end, size_t size, size_t mask, int top_down )
 {
+    struct file_view *first;
     struct list *ptr;
     void *start;
 
@@ -323,7 +404,9 @@ static void *find_free_area( void *base, void *end, size_t size, size_t mask, in
         start = ROUND_ADDR( (char *)end - size, mask );
         if (start >= end || start < base) return NULL;
 
-        for (ptr = views_list.prev; ptr != &views_list; ptr = ptr->prev)
+        /* skip the views that are entirely above the area */
+        first = find_view_before( (char *)start + size - 1 );
+        for (ptr = first ? &first->entry : &views_list; ptr != &views_list; ptr = ptr->prev)
         {
             struct file_view *view = LIST_ENTRY( ptr, struct file_view, entry );
 
@@ -339,7 +422,9 @@ static void *find_free_area( void *base, void *end, size_t size, size_t mask, in
         start = ROUND_ADDR( (char *)base + mask, mask );
         if (start >= end || (char *)end - (char *)start < size) return NULL;
 
-        for (ptr = views_list.next; ptr != &views_list; ptr = ptr->next)
+        /* skip the views that are entirely below the area */
+        first = find_view_before( start );
+        for (ptr = first ? &first->entry : views_list.next; ptr != &views_list; ptr = ptr->next)
         {
             struct file_view *view = LIST_ENTRY( ptr, struct file_view, entry );
 
@@ -444,6 +529,7 @@ static inline void unmap_area( void *addr, size_t size )
 static void delete_view( struct file_view *view ) /* [in] View */
 {
     if (!(view->protect & VPROT_SYSTEM)) unmap_area( view->base, view->size );
+    wine_rb_remove( &views_tree, view->base );
     list_remove( &view->entry );
     if (view->mapping) close_handle( view->mapping );
     RtlFreeHeap( virtual_heap, 0, view );
@@ -457,7 +543,7 @@ static void delete_view( struct file_view *view ) /* [in] View */
  */
 static NTSTATUS create_view( struct file_view **view_ret, void *base, size_t size, unsigned int vprot )
 {
-    struct file_view *view;
+    struct file_view *view, *prev;
     struct list *ptr;
     int unix_prot = VIRTUAL_GetUnixProt( vprot );
 
@@ -481,12 +567,8 @@ static NTSTATUS create_view( struct file_view **view_ret, void *base, size_t siz
 
     /* Insert it in the linked list */
 
-    LIST_FOR_EACH( ptr, &views_list )
-    {
-        struct file_view *next = LIST_ENTRY( ptr, struct file_view, entry );
-        if (next->base > base) break;
-    }
-    list_add_before( ptr, &view->entry );
+    if ((prev = find_view_before( base ))) list_add_after( &prev->entry, &view->entry );
+    else list_add_head( &views_list, &view->entry );
 
     /* Check for overlapping views. This can happen if the previous view
      * was a system view that got unmapped behind our back. In that case
@@ -517,6 +599,15 @@ static NTSTATUS create_view( struct file_view **view_ret, void *base, size_t siz
         }
     }
 
+    /* Now that overlapping views are gone, insert it in the tree */
+
+    if (wine_rb_put( &views_tree, base, &view->tree_entry ) == -1)
+    {
+        list_remove( &view->entry );
+        RtlFreeHeap( virtual_heap, 0, view );
+        return STATUS_NO_MEMORY;
+    }
+
     *view_ret = view;
     VIRTUAL_DEBUG_DUMP_VIEW( view );
 
@@ -1442,6 +1533,11 @@ void virtual_init(void)
     assert( heap_base != (void *)-1 );
     virtual_heap = RtlCreateHeap( HEAP_NO_SERIALIZE, heap_base, VIRTUAL_HEAP_SIZE,
                                   VIRTUAL_HEAP_SIZE, NULL, NULL );
+    if (wine_rb_init( &views_tree, &views_tree_functions ) == -1)
+    {
+        ERR( "failed to initialize the view tree\n" );
+        exit(1);
+    }
     create_view( &heap_view, heap_base, VIRTUAL_HEAP_SIZE, VPROT_COMMITTED | VPROT_READ | VPROT_WRITE );
 
     /* make the DOS area accessible (except the low 64K) to hide bugs in broken apps like Excel 2003 */
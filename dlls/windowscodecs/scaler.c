@@ -19,6 +19,7 @@
 #include "config.h"
 
 #include <stdarg.h>
+#include <math.h>
 
 #define COBJMACROS
 
@@ -33,6 +34,16 @@
 
 WINE_DEFAULT_DEBUG_CHANNEL(wincodecs);
 
+#define FILTER_SHIFT 14
+
+/* precomputed weights for one axis of a filtered scale */
+struct filter_table {
+    UINT *start;    /* first source pixel for each destination pixel */
+    UINT *count;    /* number of source pixels for each destination pixel */
+    INT *weights;   /* max_count weights for each destination pixel */
+    UINT max_count;
+};
+
 typedef struct BitmapScaler {
     IWICBitmapScaler IWICBitmapScaler_iface;
     LONG ref;
@@ -43,9 +54,19 @@ typedef struct BitmapScaler {
     UINT bpp;
     void (*fn_get_required_source_rect)(struct BitmapScaler*,UINT,UINT,WICRect*);
     void (*fn_copy_scanline)(struct BitmapScaler*,UINT,UINT,UINT,BYTE**,UINT,UINT,BYTE*);
+    struct filter_table x_filter, y_filter;
+    INT *tmp_row;
     CRITICAL_SECTION lock; /* must be held when initialized */
 } BitmapScaler;
 
+static void free_filter_table(struct filter_table *table)
+{
+    HeapFree(GetProcessHeap(), 0, table->start);
+    HeapFree(GetProcessHeap(), 0, table->count);
+    HeapFree(GetProcessHeap(), 0, table->weights);
+    memset(table, 0, sizeof(*table));
+}
+
 static inline BitmapScaler *impl_from_IWICBitmapScaler(IWICBitmapScaler *iface)
 {
     return CONTAINING_RECORD(iface, BitmapScaler, IWICBitmapScaler_iface);
@@ -97,6 +118,9 @@ static ULONG WINAPI BitmapScaler_Release(IWICBitmapScaler *iface)
         This->lock.DebugInfo->Spare[0] = 0;
         DeleteCriticalSection(&This->lock);
         if (This->source) IWICBitmapSource_Release(This->source);
+        free_filter_table(&This->x_filter);
+        free_filter_table(&This->y_filter);
+        HeapFree(GetProcessHeap(), 0, This->tmp_row);
         HeapFree(GetProcessHeap(), 0, This);
     }
 
@@ -191,6 +215,165 @@ static void NearestNeighbor_CopyScanline(BitmapScaler *This,
     }
 }
 
+static double linear_kernel(double x)
+{
+    x = fabs(x);
+    return x < 1.0 ? 1.0 - x : 0.0;
+}
+
+/* Catmull-Rom spline (Keys cubic with a = -0.5) */
+static double cubic_kernel(double x)
+{
+    x = fabs(x);
+    if (x < 1.0) return (1.5 * x - 2.5) * x * x + 1.0;
+    if (x < 2.0) return ((-0.5 * x + 2.5) * x - 4.0) * x + 2.0;
+    return 0.0;
+}
+
+static void add_filter_weight(UINT *start, UINT *count, double *weights, UINT pos)
+{
+    if (*count && pos == *start + *count - 1) return;
+    if (!*count) *start = pos;
+    weights[(*count)++] = 0.0;
+}
+
+/* Compute the source pixels and weights for each destination pixel along one
+ * axis. Fant does area averaging when shrinking, the other modes use their
+ * kernel widened by the shrink factor; source pixels are clamped to the edges. */
+static HRESULT init_filter_table(struct filter_table *table, UINT dst_len, UINT src_len,
+    WICBitmapInterpolationMode mode)
+{
+    double scale = (double)src_len / dst_len, width = max(scale, 1.0), support;
+    double (*kernel)(double) = (mode == WICBitmapInterpolationModeCubic) ? cubic_kernel : linear_kernel;
+    BOOL area = (mode == WICBitmapInterpolationModeFant && scale >= 1.0);
+    double *weights, lo, hi;
+    UINT i;
+    int j;
+
+    if (!dst_len || !src_len) return E_INVALIDARG;
+
+    support = area ? scale / 2 : (kernel == cubic_kernel ? 2.0 : 1.0) * width;
+    table->max_count = (UINT)ceil(support * 2) + 2;
+
+    table->start = HeapAlloc(GetProcessHeap(), 0, dst_len * sizeof(UINT));
+    table->count = HeapAlloc(GetProcessHeap(), 0, dst_len * sizeof(UINT));
+    table->weights = HeapAlloc(GetProcessHeap(), 0, dst_len * table->max_count * sizeof(INT));
+    weights = HeapAlloc(GetProcessHeap(), 0, table->max_count * sizeof(double));
+    if (!table->start || !table->count || !table->weights || !weights)
+    {
+        HeapFree(GetProcessHeap(), 0, weights);
+        free_filter_table(table);
+        return E_OUTOFMEMORY;
+    }
+
+    for (i = 0; i < dst_len; i++)
+    {
+        double center = (i + 0.5) * scale, total = 0.0;
+        UINT *start = &table->start[i], *count = &table->count[i], k, largest = 0;
+        INT *fixed = table->weights + i * table->max_count, sum = 0;
+
+        /* pixel j covers [j, j + 1) */
+        if (area)
+        {
+            lo = floor(center - support);
+            hi = center + support;
+        }
+        else
+        {
+            lo = floor(center - support - 0.5) + 1;
+            hi = center + support - 0.5;
+        }
+
+        *count = 0;
+        for (j = lo; j < hi; j++)
+        {
+            UINT pos = max(0, min((int)src_len - 1, j));
+            double w;
+
+            if (area)
+                w = min(center + support, j + 1.0) - max(center - support, (double)j);
+            else
+                w = kernel((j + 0.5 - center) / width);
+
+            add_filter_weight(start, count, weights, pos);
+            weights[*count - 1] += w;
+            total += w;
+        }
+
+        for (k = 0; k < *count; k++)
+        {
+            fixed[k] = floor(weights[k] * (1 << FILTER_SHIFT) / total + 0.5);
+            sum += fixed[k];
+            if (fixed[k] > fixed[largest]) largest = k;
+        }
+        fixed[largest] += (1 << FILTER_SHIFT) - sum;
+    }
+
+    HeapFree(GetProcessHeap(), 0, weights);
+    return S_OK;
+}
+
+static void Filtered_GetRequiredSourceRect(BitmapScaler *This,
+    UINT x, UINT y, WICRect *src_rect)
+{
+    src_rect->X = This->x_filter.start[x];
+    src_rect->Y = This->y_filter.start[y];
+    src_rect->Width = This->x_filter.count[x];
+    src_rect->Height = This->y_filter.count[y];
+}
+
+static void Filtered_CopyScanline(BitmapScaler *This,
+    UINT dst_x, UINT dst_y, UINT dst_width,
+    BYTE **src_data, UINT src_data_x, UINT src_data_y, BYTE *pbBuffer)
+{
+    UINT bytesperpixel = This->bpp/8;
+    UINT first, len, i, k, c;
+    const INT *weights;
+    INT *tmp = This->tmp_row;
+
+    /* vertical pass over the source columns needed for this span, keeping
+     * 6 bits of fraction */
+    first = This->x_filter.start[dst_x];
+    len = (This->x_filter.start[dst_x+dst_width-1] + This->x_filter.count[dst_x+dst_width-1] - first) * bytesperpixel;
+    weights = This->y_filter.weights + dst_y * This->y_filter.max_count;
+
+    for (i = 0; i < len; i++) tmp[i] = 0;
+    for (k = 0; k < This->y_filter.count[dst_y]; k++)
+    {
+        const BYTE *src = src_data[This->y_filter.start[dst_y] + k - src_data_y] +
+                          (first - src_data_x) * bytesperpixel;
+        for (i = 0; i < len; i++) tmp[i] += src[i] * weights[k];
+    }
+    for (i = 0; i < len; i++) tmp[i] = (tmp[i] + (1 << 7)) >> 8;
+
+    /* horizontal pass */
+    for (i = 0; i < dst_width; i++)
+    {
+        const INT *row = tmp + (This->x_filter.start[dst_x+i] - first) * bytesperpixel;
+        weights = This->x_filter.weights + (dst_x + i) * This->x_filter.max_count;
+
+        for (c = 0; c < bytesperpixel; c++)
+        {
+            INT val = 0;
+            for (k = 0; k < This->x_filter.count[dst_x+i]; k++)
+                val += row[k * bytesperpixel + c] * weights[k];
+            val = (val + (1 << (FILTER_SHIFT + 5))) >> (FILTER_SHIFT + 6);
+            pbBuffer[i * bytesperpixel + c] = max(0, min(val, 255));
+        }
+    }
+}
+
+/* formats that can be filtered one byte at a time */
+static BOOL is_filterable_format(const WICPixelFormatGUID *format)
+{
+    return IsEqualGUID(format, &GUID_WICPixelFormat8bppGray) ||
+           IsEqualGUID(format, &GUID_WICPixelFormat24bppBGR) ||
+           IsEqualGUID(format, &GUID_WICPixelFormat32bppBGR) ||
+           IsEqualGUID(format, &GUID_WICPixelFormat32bppBGRA) ||
+           IsEqualGUID(format, &GUID_WICPixelFormat32bppPBGRA) ||
+           IsEqualGUID(format, &GUID_WICPixelFormat32bppCMYK);
+}
+
 static HRESULT WINAPI BitmapScaler_CopyPixels(IWICBitmapScaler *iface,
     const WICRect *prc, UINT cbStride, UINT cbBufferSize, BYTE *pbBuffer)
 {
@@ -336,10 +519,49 @@ static HRESULT WINAPI BitmapScaler_Initialize(IWICBitmapScaler *iface,
     {
         switch (mode)
         {
+        case WICBitmapInterpolationModeLinear:
+        case WICBitmapInterpolationModeCubic:
+        case WICBitmapInterpolationModeFant:
+            if ((This->bpp % 8) == 0 && !is_filterable_format(&src_pixelformat) &&
+                !IsEqualGUID(&src_pixelformat, &GUID_WICPixelFormat8bppIndexed))
+            {
+                FIXME("unsupported pixel format %s for mode %i\n", debugstr_guid(&src_pixelformat), mode);
+                goto nearest_neighbor;
+            }
+            if (is_filterable_format(&src_pixelformat))
+            {
+                IWICBitmapSource_AddRef(pISource);
+                This->source = pISource;
+            }
+            else
+            {
+                hr = WICConvertBitmapSource(&GUID_WICPixelFormat32bppBGRA,
+                    pISource, &This->source);
+                This->bpp = 32;
+            }
+            if (SUCCEEDED(hr))
+                hr = init_filter_table(&This->x_filter, This->width, This->src_width, mode);
+            if (SUCCEEDED(hr))
+                hr = init_filter_table(&This->y_filter, This->height, This->src_height, mode);
+            if (SUCCEEDED(hr) &&
+                !(This->tmp_row = HeapAlloc(GetProcessHeap(), 0, This->src_width * (This->bpp/8) * sizeof(INT))))
+                hr = E_OUTOFMEMORY;
+            if (FAILED(hr))
+            {
+                if (This->source) IWICBitmapSource_Release(This->source);
+                This->source = NULL;
+                free_filter_table(&This->x_filter);
+                free_filter_table(&This->y_filter);
+                break;
+            }
+            This->fn_get_required_source_rect = Filtered_GetRequiredSourceRect;
+            This->fn_copy_scanline = Filtered_CopyScanline;
+            break;
         default:
             FIXME("unsupported mode %i\n", mode);
             /* fall-through */
         case WICBitmapInterpolationModeNearestNeighbor:
+        nearest_neighbor:
             if ((This->bpp % 8) == 0)
             {
                 IWICBitmapSource_AddRef(pISource);
@@ -391,6 +613,9 @@ HRESULT BitmapScaler_Create(IWICBitmapScaler **scaler)
     This->src_height = 0;
     This->mode = 0;
     This->bpp = 0;
+    memset(&This->x_filter, 0, sizeof(This->x_filter));
+    memset(&This->y_filter, 0, sizeof(This->y_filter));
+    This->tmp_row = NULL;
     InitializeCriticalSection(&This->lock);
     This->lock.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": BitmapScaler.lock");
 
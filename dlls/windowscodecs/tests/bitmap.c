@@ -367,6 +367,147 @@ static void test_createbitmapfromsource(void)
     IWICBitmap_Release(bitmap2);
 }
 
+static void test_bitmapscaler(void)
+{
+    static const WICBitmapInterpolationMode modes[] = {
+        WICBitmapInterpolationModeNearestNeighbor, WICBitmapInterpolationModeLinear,
+        WICBitmapInterpolationModeCubic, WICBitmapInterpolationModeFant};
+    static const UINT sizes[][2] = {{7,3}, {2,2}, {13,13}, {1,5}};
+    HRESULT hr;
+    IWICBitmap *bitmap;
+    IWICBitmapScaler *scaler;
+    IWICBitmapLock *lock;
+    WICPixelFormatGUID pixelformat;
+    BYTE *lock_buffer, returned_data[13*13*4];
+    UINT lock_buffer_size, lock_buffer_stride, width, height, i, j, k;
+
+    hr = IWICImagingFactory_CreateBitmap(factory, 4, 4, &GUID_WICPixelFormat32bppBGRA,
+        WICBitmapCacheOnLoad, &bitmap);
+    ok(hr == S_OK, "IWICImagingFactory_CreateBitmap failed hr=%x\n", hr);
+    if (FAILED(hr))
+        return;
+
+    hr = IWICBitmap_Lock(bitmap, NULL, WICBitmapLockWrite, &lock);
+    ok(hr == S_OK, "IWICBitmap_Lock failed hr=%x\n", hr);
+    if (FAILED(hr))
+    {
+        IWICBitmap_Release(bitmap);
+        return;
+    }
+    IWICBitmapLock_GetStride(lock, &lock_buffer_stride);
+    IWICBitmapLock_GetDataPointer(lock, &lock_buffer_size, &lock_buffer);
+    for (i=0; i<4; i++)
+        for (j=0; j<4; j++)
+            *(DWORD *)(lock_buffer + i * lock_buffer_stride + j * 4) = 0xff408020;
+    IWICBitmapLock_Release(lock);
+
+    /* scaling a single color image must give the same color in every mode */
+    for (i=0; i<sizeof(modes)/sizeof(modes[0]); i++)
+    {
+        for (j=0; j<sizeof(sizes)/sizeof(sizes[0]); j++)
+        {
+            hr = IWICImagingFactory_CreateBitmapScaler(factory, &scaler);
+            ok(hr == S_OK, "IWICImagingFactory_CreateBitmapScaler failed hr=%x\n", hr);
+            if (FAILED(hr))
+                continue;
+
+            hr = IWICBitmapScaler_Initialize(scaler, (IWICBitmapSource *)bitmap,
+                sizes[j][0], sizes[j][1], modes[i]);
+            ok(hr == S_OK, "mode %u: Initialize failed hr=%x\n", modes[i], hr);
+
+            hr = IWICBitmapScaler_GetSize(scaler, &width, &height);
+            ok(hr == S_OK, "mode %u: GetSize failed hr=%x\n", modes[i], hr);
+            ok(width == sizes[j][0] && height == sizes[j][1], "mode %u: got %ux%u\n", modes[i], width, height);
+
+            hr = IWICBitmapScaler_GetPixelFormat(scaler, &pixelformat);
+            ok(hr == S_OK, "mode %u: GetPixelFormat failed hr=%x\n", modes[i], hr);
+            ok(IsEqualGUID(&pixelformat, &GUID_WICPixelFormat32bppBGRA), "mode %u: unexpected pixel format\n", modes[i]);
+
+            memset(returned_data, 0, sizeof(returned_data));
+            hr = IWICBitmapScaler_CopyPixels(scaler, NULL, width * 4, sizeof(returned_data), returned_data);
+            ok(hr == S_OK, "mode %u: CopyPixels failed hr=%x\n", modes[i], hr);
+            for (k=0; k<width*height; k++)
+                ok(((DWORD *)returned_data)[k] == 0xff408020, "mode %u, %ux%u: pixel %u is %08x\n",
+                    modes[i], width, height, k, ((DWORD *)returned_data)[k]);
+
+            IWICBitmapScaler_Release(scaler);
+        }
+    }
+
+    IWICBitmap_Release(bitmap);
+}
+
+static void check_bitmapscaler_row(const BYTE *src, UINT src_width, WICBitmapInterpolationMode mode,
+    const BYTE *expected, UINT dst_width, int line)
+{
+    HRESULT hr;
+    IWICBitmap *bitmap;
+    IWICBitmapScaler *scaler;
+    IWICBitmapLock *lock;
+    BYTE *lock_buffer;
+    DWORD returned_data[4];
+    UINT lock_buffer_size, i;
+
+    hr = IWICImagingFactory_CreateBitmap(factory, src_width, 1, &GUID_WICPixelFormat32bppBGRA,
+        WICBitmapCacheOnLoad, &bitmap);
+    ok_(__FILE__, line)(hr == S_OK, "IWICImagingFactory_CreateBitmap failed hr=%x\n", hr);
+    if (FAILED(hr))
+        return;
+
+    hr = IWICBitmap_Lock(bitmap, NULL, WICBitmapLockWrite, &lock);
+    ok_(__FILE__, line)(hr == S_OK, "IWICBitmap_Lock failed hr=%x\n", hr);
+    if (SUCCEEDED(hr))
+    {
+        IWICBitmapLock_GetDataPointer(lock, &lock_buffer_size, &lock_buffer);
+        for (i=0; i<src_width; i++)
+            ((DWORD *)lock_buffer)[i] = 0xff000000 | (src[i] * 0x010101);
+        IWICBitmapLock_Release(lock);
+    }
+
+    hr = IWICImagingFactory_CreateBitmapScaler(factory, &scaler);
+    ok_(__FILE__, line)(hr == S_OK, "IWICImagingFactory_CreateBitmapScaler failed hr=%x\n", hr);
+    if (SUCCEEDED(hr))
+    {
+        hr = IWICBitmapScaler_Initialize(scaler, (IWICBitmapSource *)bitmap, dst_width, 1, mode);
+        ok_(__FILE__, line)(hr == S_OK, "mode %u: Initialize failed hr=%x\n", mode, hr);
+
+        memset(returned_data, 0, sizeof(returned_data));
+        hr = IWICBitmapScaler_CopyPixels(scaler, NULL, dst_width * 4, sizeof(returned_data), (BYTE *)returned_data);
+        ok_(__FILE__, line)(hr == S_OK, "mode %u: CopyPixels failed hr=%x\n", mode, hr);
+
+        /* the expected values allow for rounding differences */
+        for (i=0; i<dst_width; i++)
+            ok_(__FILE__, line)(abs((int)(returned_data[i] & 0xff) - expected[i]) <= 2 &&
+                returned_data[i] == (0xff000000 | ((returned_data[i] & 0xff) * 0x010101)),
+                "mode %u, %u->%u: pixel %u is %08x, expected about %02x\n",
+                mode, src_width, dst_width, i, returned_data[i], expected[i]);
+
+        IWICBitmapScaler_Release(scaler);
+    }
+
+    IWICBitmap_Release(bitmap);
+}
+
+static void test_bitmapscaler_interpolation(void)
+{
+    static const BYTE black_white[] = {0x00, 0xff};
+    static const BYTE gradient[] = {0x00, 0x55, 0xaa, 0xff};
+    static const BYTE expect_2_3[] = {0x00, 0x80, 0xff};
+    static const BYTE expect_2_4[] = {0x00, 0x40, 0xbf, 0xff};
+    static const BYTE expect_4_2[] = {0x2b, 0xd5};
+
+    /* the midpoint of two pixels is halfway between them */
+    check_bitmapscaler_row(black_white, 2, WICBitmapInterpolationModeLinear, expect_2_3, 3, __LINE__);
+    check_bitmapscaler_row(black_white, 2, WICBitmapInterpolationModeCubic, expect_2_3, 3, __LINE__);
+    check_bitmapscaler_row(black_white, 2, WICBitmapInterpolationModeFant, expect_2_3, 3, __LINE__);
+
+    /* linear interpolation at a quarter and three quarters of the way */
+    check_bitmapscaler_row(black_white, 2, WICBitmapInterpolationModeLinear, expect_2_4, 4, __LINE__);
+
+    /* Fant averages the covered pixels when shrinking */
+    check_bitmapscaler_row(gradient, 4, WICBitmapInterpolationModeFant, expect_4_2, 2, __LINE__);
+}
+
 START_TEST(bitmap)
 {
     HRESULT hr;
@@ -379,6 +520,8 @@ START_TEST(bitmap)
 
     test_createbitmap();
     test_createbitmapfromsource();
+    test_bitmapscaler();
+    test_bitmapscaler_interpolation();
 
     IWICImagingFactory_Release(factory);
 
@@ -361,7 +361,7 @@ static void mailslot_device_destroy( struct object *obj )
     struct mailslot_device *device = (struct mailslot_device*)obj;
     assert( obj->ops == &mailslot_device_ops );
     if (device->fd) release_object( device->fd );
-    free( device->mailslots );
+    free_namespace( device->mailslots );
 }
 
 static enum server_fd_type mailslot_device_get_fd_type( struct fd *fd )
@@ -43,18 +43,26 @@
 struct object_name
 {
     struct list         entry;           /* entry in the hash list */
+    struct namespace   *namespace;       /* namespace containing the name */
     struct object      *obj;             /* object owning this name */
     struct object      *parent;          /* parent object */
+    unsigned int        hash;            /* full hash value of the name */
     data_size_t         len;             /* name length in bytes */
     WCHAR               name[1];
 };
 
 struct namespace
 {
+    struct list         entry;           /* entry in the global list of namespaces */
     unsigned int        hash_size;       /* size of hash table */
-    struct list         names[1];        /* array of hash entry lists */
+    unsigned int        count;           /* number of names in the table */
+    struct list        *names;           /* array of hash entry lists */
 };
 
+#define MAX_LOAD_FACTOR 2  /* average chain length that triggers a resize */
+
+static struct list namespace_list = LIST_INIT(namespace_list);
+
 
 #ifdef DEBUG_OBJECTS
 static struct list object_list = LIST_INIT(object_list);
@@ -120,12 +128,42 @@ void *memdup( const void *data, size_t len )
 
 /*****************************************************************/
 
-static int get_name_hash( const struct namespace *namespace, const WCHAR *name, data_size_t len )
+/* FNV-1a hash of the lower-cased name, so that case-insensitive lookups land in the same bucket */
+static unsigned int get_name_hash( const WCHAR *name, data_size_t len )
 {
-    WCHAR hash = 0;
+    unsigned int hash = 2166136261u;
     len /= sizeof(WCHAR);
-    while (len--) hash ^= tolowerW(*name++);
-    return hash % namespace->hash_size;
+    while (len--)
+    {
+        WCHAR ch = tolowerW(*name++);
+        hash = (hash ^ (ch & 0xff)) * 16777619;
+        hash = (hash ^ (ch >> 8)) * 16777619;
+    }
+    return hash;
+}
+
+/* grow the hash table of a namespace, rehashing all the names */
+static void grow_namespace( struct namespace *namespace )
+{
+    unsigned int i, new_size = namespace->hash_size * 2 + 1;
+    struct object_name *ptr, *next;
+    struct list *names;
+
+    if (!(names = malloc( new_size * sizeof(*names) ))) return;  /* keep using the old table */
+    for (i = 0; i < new_size; i++) list_init( &names[i] );
+
+    for (i = 0; i < namespace->hash_size; i++)
+    {
+        /* walk the chain backwards to preserve the order of the entries */
+        LIST_FOR_EACH_ENTRY_SAFE_REV( ptr, next, &namespace->names[i], struct object_name, entry )
+        {
+            list_remove( &ptr->entry );
+            list_add_head( &names[ptr->hash % new_size], &ptr->entry );
+        }
+    }
+    free( namespace->names );
+    namespace->names = names;
+    namespace->hash_size = new_size;
 }
 
 /* allocate a name for an object */
@@ -147,6 +185,7 @@ static void free_name( struct object *obj )
 {
     struct object_name *ptr = obj->name;
     list_remove( &ptr->entry );
+    ptr->namespace->count--;
     if (ptr->parent) release_object( ptr->parent );
     free( ptr );
 }
@@ -155,9 +194,12 @@ static void free_name( struct object *obj )
 static void set_object_name( struct namespace *namespace,
                              struct object *obj, struct object_name *ptr )
 {
-    int hash = get_name_hash( namespace, ptr->name, ptr->len );
+    if (namespace->count >= namespace->hash_size * MAX_LOAD_FACTOR) grow_namespace( namespace );
 
-    list_add_head( &namespace->names[hash], &ptr->entry );
+    ptr->hash = get_name_hash( ptr->name, ptr->len );
+    ptr->namespace = namespace;
+    list_add_head( &namespace->names[ptr->hash % namespace->hash_size], &ptr->entry );
+    namespace->count++;
     ptr->obj = obj;
     obj->name = ptr;
 }
@@ -325,14 +367,16 @@ struct object *find_object( const struct namespace *namespace, const struct unic
 {
     const struct list *list;
     struct list *p;
+    unsigned int hash;
 
     if (!name || !name->len) return NULL;
 
-    list = &namespace->names[ get_name_hash( namespace, name->str, name->len ) ];
+    hash = get_name_hash( name->str, name->len );
+    list = &namespace->names[hash % namespace->hash_size];
     LIST_FOR_EACH( p, list )
     {
         const struct object_name *ptr = LIST_ENTRY( p, struct object_name, entry );
-        if (ptr->len != name->len) continue;
+        if (ptr->hash != hash || ptr->len != name->len) continue;
         if (attributes & OBJ_CASE_INSENSITIVE)
         {
             if (!strncmpiW( ptr->name, name->str, name->len/sizeof(WCHAR) ))
@@ -371,15 +415,53 @@ struct namespace *create_namespace( unsigned int hash_size )
     struct namespace *namespace;
     unsigned int i;
 
-    namespace = mem_alloc( sizeof(*namespace) + (hash_size - 1) * sizeof(namespace->names[0]) );
-    if (namespace)
+    if (!(namespace = mem_alloc( sizeof(*namespace) ))) return NULL;
+    if (!(namespace->names = mem_alloc( hash_size * sizeof(namespace->names[0]) )))
     {
-        namespace->hash_size      = hash_size;
-        for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
+        free( namespace );
+        return NULL;
     }
+    namespace->hash_size = hash_size;
+    namespace->count     = 0;
+    for (i = 0; i < hash_size; i++) list_init( &namespace->names[i] );
+    list_add_tail( &namespace_list, &namespace->entry );
     return namespace;
 }
 
+/* free a namespace; all the names must have been removed already */
+void free_namespace( struct namespace *namespace )
+{
+    if (!namespace) return;
+    assert( !namespace->count );
+    list_remove( &namespace->entry );
+    free( namespace->names );
+    free( namespace );
+}
+
+/* dump the bucket occupancy of all the namespaces to stderr */
+void dump_namespaces(void)
+{
+    struct namespace *namespace;
+    unsigned int i, len, used, longest, histogram[5];
+
+    LIST_FOR_EACH_ENTRY( namespace, &namespace_list, struct namespace, entry )
+    {
+        used = longest = 0;
+        memset( histogram, 0, sizeof(histogram) );
+        for (i = 0; i < namespace->hash_size; i++)
+        {
+            len = list_count( &namespace->names[i] );
+            if (len) used++;
+            if (len > longest) longest = len;
+            histogram[len < 4 ? len : 4]++;
+        }
+        fprintf( stderr, "namespace %p: %u names in %u buckets, %u used, longest chain %u, "
+                 "chains of 0/1/2/3/4+ names: %u/%u/%u/%u/%u\n",
+                 namespace, namespace->count, namespace->hash_size, used, longest,
+                 histogram[0], histogram[1], histogram[2], histogram[3], histogram[4] );
+    }
+}
+
 /* functions for unimplemented/default object operations */
 
 struct object_type *no_get_type( struct object *obj )
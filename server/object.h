@@ -124,6 +124,8 @@ extern void *create_named_object( struct namespace *namespace, const struct obje
 extern void unlink_named_object( struct object *obj );
 extern void make_object_static( struct object *obj );
 extern struct namespace *create_namespace( unsigned int hash_size );
+extern void free_namespace( struct namespace *namespace );
+extern void dump_namespaces(void);
 /* grab/release_object can take any pointer, but you better make sure */
 /* that the thing pointed to starts with a struct object... */
 extern struct object *grab_object( void *obj );
@@ -185,6 +187,7 @@ extern void debug_exit_thread( struct thread *thread );
 extern unsigned int get_prefix_cpu_mask(void);
 extern void init_registry(void);
 extern void flush_registry(void);
+extern void dump_registry_cache(void);
 
 /* signal functions */
 
@@ -34,8 +34,19 @@
 #include <stdarg.h>
 #include <string.h>
 #include <stdlib.h>
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
 #include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#ifdef HAVE_SYS_WAIT_H
+# include <sys/wait.h>
+#endif
 #include <unistd.h>
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
 
 #include "ntstatus.h"
 #define WIN32_NO_STATUS
@@ -71,13 +82,17 @@ struct key
     struct key       *parent;      /* parent key */
     int               last_subkey; /* last in use subkey */
     int               nb_subkeys;  /* count of allocated subkeys */
+    int               pending_subkeys; /* count of subkeys at the end of the array not merged yet */
     struct key      **subkeys;     /* subkeys array */
     int               last_value;  /* last in use value */
     int               nb_values;   /* count of allocated values in array */
+    int               pending_values; /* count of values at the end of the array not merged yet */
     struct key_value *values;      /* values array */
     unsigned int      flags;       /* flags */
     timeout_t         modif;       /* last modification time */
     struct list       notify_list; /* list of notifications */
+    struct hive_cache *hive;       /* hive cache holding the subkeys and values not loaded yet */
+    unsigned int      hive_node;   /* offset of the key in the hive cache */
 };
 
 /* key flags */
@@ -100,6 +115,7 @@ struct key_value
 
 #define MIN_SUBKEYS  8   /* min. number of allocated subkeys per key */
 #define MIN_VALUES   8   /* min. number of allocated values per key */
+#define WIDE_KEY_SIZE 1024  /* arrays with more entries than this insert into a separate run */
 
 #define MAX_NAME_LEN  255    /* max. length of a key name */
 #define MAX_VALUE_LEN 16383  /* max. length of a value name */
@@ -118,6 +134,10 @@ static const WCHAR symlink_value[] = {'S','y','m','b','o','l','i','c','L','i','n
 static const struct unicode_str symlink_str = { symlink_value, sizeof(symlink_value) };
 
 static void set_periodic_save_timer(void);
+static void merge_subkeys( struct key *key );
+static void merge_values( struct key *key );
+static void load_hive_key( struct key *key );
+static void save_hive_cache( struct key *key, const char *path );
 static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index );
 
 /* information about where to save a registry branch */
@@ -142,6 +162,73 @@ struct file_load_info
     int         line;     /* current input line */
     WCHAR      *tmp;      /* temp buffer to use while parsing input */
     size_t      tmplen;   /* length of temp buffer */
+    WCHAR      *path;     /* path of the last loaded key */
+    data_size_t path_len; /* length of the path in bytes */
+    struct key **keys;    /* keys along the path of the last loaded key */
+    int         depth;    /* number of keys in the keys array */
+    int         max_depth; /* allocated size of the keys array */
+};
+
+/* The hive cache next to a registry file (e.g. system.reg.cache) holds the
+ * same keys in a binary form that is mapped instead of parsed. It is only used
+ * while the modification time and size of the text file match the ones it was
+ * written for, and it is written again every time the text file is saved.
+ * Keys are created from it on first access, one level at a time. All offsets
+ * are relative to the start of the file; structures are aligned to 8 bytes,
+ * names and data to 2 bytes. */
+#define HIVE_CACHE_MAGIC   0x45564948  /* "HIVE" */
+#define HIVE_CACHE_VERSION 1
+
+struct hive_header
+{
+    timeout_t      reg_mtime;   /* modification time of the text file, in seconds */
+    file_pos_t     reg_size;    /* size of the text file */
+    unsigned int   magic;       /* HIVE_CACHE_MAGIC */
+    unsigned int   version;     /* HIVE_CACHE_VERSION */
+    unsigned int   size;        /* size of the cache file */
+    unsigned int   root;        /* offset of the branch key */
+    unsigned int   prefix_type; /* architecture of the prefix */
+    unsigned int   reserved;
+};
+
+struct hive_key
+{
+    timeout_t      modif;       /* last modification time */
+    unsigned int   flags;       /* KEY_SYMLINK and KEY_WOW64 flags */
+    unsigned short namelen;     /* length of key name */
+    unsigned short classlen;    /* length of class name */
+    unsigned int   name;        /* offset of key name */
+    unsigned int   class;       /* offset of class name */
+    unsigned int   subkeys;     /* offset of the array of subkey offsets */
+    unsigned int   nb_subkeys;  /* count of subkeys */
+    unsigned int   values;      /* offset of the values array */
+    unsigned int   nb_values;   /* count of values */
+};
+
+struct hive_value
+{
+    unsigned int   name;        /* offset of value name */
+    unsigned short namelen;     /* length of value name */
+    unsigned short type;        /* value type */
+    unsigned int   data;        /* offset of value data */
+    data_size_t    len;         /* value data length in bytes */
+};
+
+/* a mapped hive cache */
+struct hive_cache
+{
+    const char    *base;        /* start of the mapping */
+    unsigned int   size;        /* size of the mapping */
+    const char    *filename;    /* name of the registry file */
+};
+
+/* a hive cache being built */
+struct hive_buffer
+{
+    char          *data;        /* contents of the file */
+    unsigned int   size;        /* used size */
+    unsigned int   alloc;       /* allocated size */
+    int            error;       /* out of memory */
 };
 
 
@@ -257,6 +344,7 @@ static void save_subkeys( const struct key *key, const struct key *base, FILE *f
     int i;
 
     if (key->flags & KEY_VOLATILE) return;
+    load_hive_key( (struct key *)key );
     /* save key if it has either some values or no subkeys, or needs special options */
     /* keys with no values but subkeys are saved implicitly by saving the subkeys */
     if ((key->last_value >= 0) || (key->last_subkey == -1) || key->class || (key->flags & KEY_SYMLINK))
@@ -271,8 +359,10 @@ static void save_subkeys( const struct key *key, const struct key *base, FILE *f
             fprintf( f, "\"\n" );
         }
         if (key->flags & KEY_SYMLINK) fputs( "#link\n", f );
+        merge_values( (struct key *)key );
         for (i = 0; i <= key->last_value; i++) dump_value( &key->values[i], f );
     }
+    merge_subkeys( (struct key *)key );
     for (i = 0; i <= key->last_subkey; i++) save_subkeys( key->subkeys[i], base, f );
 }
 
@@ -428,12 +518,16 @@ static struct key *alloc_key( const struct unicode_str *name, timeout_t modif )
         key->flags       = 0;
         key->last_subkey = -1;
         key->nb_subkeys  = 0;
+        key->pending_subkeys = 0;
         key->subkeys     = NULL;
         key->nb_values   = 0;
         key->last_value  = -1;
+        key->pending_values = 0;
         key->values      = NULL;
         key->modif       = modif;
         key->parent      = NULL;
+        key->hive        = NULL;
+        key->hive_node   = 0;
         list_init( &key->notify_list );
         if (name->len && !(key->name = memdup( name->str, name->len )))
         {
@@ -518,12 +612,103 @@ static int grow_subkeys( struct key *key )
     return 1;
 }
 
+/* Cache of recently opened key paths. Entries aren't reference counted; instead,
+ * the whole cache is invalidated by bumping the generation whenever a change can
+ * affect the result of a path lookup: key deletion, creation of keys that change
+ * the Wow64 redirection, and changes to symlinks. */
+
+#define KEY_CACHE_SIZE 1024  /* must be a power of 2 */
+
+struct key_cache_entry
+{
+    struct key   *parent;     /* key the path is relative to */
+    struct key   *key;        /* resolved key */
+    unsigned int  generation; /* cache generation when the entry was added */
+    unsigned int  flags;      /* access and attribute flags affecting the lookup */
+    unsigned int  hash;       /* hash of the path */
+    data_size_t   len;        /* length of the path */
+    WCHAR        *path;       /* path relative to the parent */
+};
+
+static struct key_cache_entry key_cache[KEY_CACHE_SIZE];
+static unsigned int key_cache_generation = 1;
+static unsigned int key_cache_hits, key_cache_misses, key_cache_invalidations;
+
+static inline void invalidate_key_cache(void)
+{
+    key_cache_generation++;
+    key_cache_invalidations++;
+}
+
+/* compare the names of two keys */
+static inline int compare_key_names( const struct key *key1, const struct key *key2 )
+{
+    data_size_t len = min( key1->namelen, key2->namelen );
+    int res = memicmpW( key1->name, key2->name, len / sizeof(WCHAR) );
+    if (!res) res = key1->namelen - key2->namelen;
+    return res;
+}
+
+/* Inserting into the sorted subkeys or values array of a key moves a large part
+ * of the array every time, which makes bulk registrations under keys like CLSID
+ * quadratic. Wide arrays keep new entries in a separate sorted run at the end
+ * instead. The run is merged into the main part in linear time once it holds
+ * more than the square root of the number of entries, so an insertion costs
+ * O(sqrt(n)) moves on average. It is also merged when the order matters for
+ * enumeration or saving. */
+static inline int use_pending_run( int pending, int count )
+{
+    return pending || count >= WIDE_KEY_SIZE;
+}
+
+static inline int pending_run_full( int pending, int count )
+{
+    return pending * pending > count;
+}
+
+static inline int use_pending_subkeys( const struct key *key )
+{
+    return use_pending_run( key->pending_subkeys, key->last_subkey + 1 );
+}
+
+/* merge the pending subkeys into the sorted part of the array */
+static void merge_subkeys( struct key *key )
+{
+    struct key **pending, *subkey;
+    int min, max, pos, count = key->pending_subkeys;
+    int last = key->last_subkey - count;  /* last entry of the sorted part not moved yet */
+
+    if (!count) return;
+    if (!(pending = malloc( count * sizeof(*pending) ))) return;
+    memcpy( pending, key->subkeys + last + 1, count * sizeof(*pending) );
+    /* insert the pending subkeys from the largest one down, moving the
+     * sorted entries that follow each of them in a single block */
+    while (count)
+    {
+        subkey = pending[--count];
+        min = 0;
+        max = last;
+        while (min <= max)
+        {
+            pos = (min + max) / 2;
+            if (compare_key_names( key->subkeys[pos], subkey ) > 0) max = pos - 1;
+            else min = pos + 1;
+        }
+        memmove( key->subkeys + min + count + 1, key->subkeys + min,
+                 (last + 1 - min) * sizeof(*pending) );
+        key->subkeys[min + count] = subkey;
+        last = min - 1;
+    }
+    free( pending );
+    key->pending_subkeys = 0;
+}
+
 /* allocate a subkey for a given key, and return its index */
 static struct key *alloc_subkey( struct key *parent, const struct unicode_str *name,
                                  int index, timeout_t modif )
 {
     struct key *key;
-    int i;
+    int i, pending = use_pending_subkeys( parent );
 
     if (name->len > MAX_NAME_LEN * sizeof(WCHAR))
     {
@@ -542,7 +727,13 @@ static struct key *alloc_subkey( struct key *parent, const struct unicode_str *n
             parent->subkeys[i] = parent->subkeys[i-1];
         parent->subkeys[index] = key;
         if (is_wow6432node( key->name, key->namelen ) && !is_wow6432node( parent->name, parent->namelen ))
+        {
             parent->flags |= KEY_WOW64;
+            invalidate_key_cache();  /* lookups in the parent are now redirected */
+        }
+        else if (parent->flags & KEY_WOWSHARE) invalidate_key_cache();  /* may hide a key of the 64-bit parent */
+        if (pending && pending_run_full( ++parent->pending_subkeys, parent->last_subkey + 1 ))
+            merge_subkeys( parent );
     }
     return key;
 }
@@ -557,6 +748,8 @@ static void free_subkey( struct key *parent, int index )
     assert( index <= parent->last_subkey );
 
     key = parent->subkeys[index];
+    invalidate_key_cache();
+    if (index > parent->last_subkey - parent->pending_subkeys) parent->pending_subkeys--;
     for (i = index; i < parent->last_subkey; i++) parent->subkeys[i] = parent->subkeys[i + 1];
     parent->last_subkey--;
     key->flags |= KEY_DELETED;
@@ -577,14 +770,13 @@ static void free_subkey( struct key *parent, int index )
     }
 }
 
-/* find the named child of a given key and return its index */
-static struct key *find_subkey( const struct key *key, const struct unicode_str *name, int *index )
+/* find the named child in a sorted range of the subkeys array */
+static struct key *search_subkeys( const struct key *key, const struct unicode_str *name,
+                                   int min, int max, int *index )
 {
-    int i, min, max, res;
+    int i, res;
     data_size_t len;
 
-    min = 0;
-    max = key->last_subkey;
     while (min <= max)
     {
         i = (min + max) / 2;
@@ -603,6 +795,20 @@ static struct key *find_subkey( const struct key *key, const struct unicode_str
     return NULL;
 }
 
+/* find the named child of a given key and return its index */
+static struct key *find_subkey( const struct key *key, const struct unicode_str *name, int *index )
+{
+    struct key *subkey;
+    int start;
+
+    load_hive_key( (struct key *)key );
+    start = key->last_subkey + 1 - key->pending_subkeys;
+    if ((subkey = search_subkeys( key, name, 0, start - 1, index ))) return subkey;
+    if (!use_pending_subkeys( key )) return NULL;
+    /* new subkeys of wide keys are inserted into the pending run */
+    return search_subkeys( key, name, start, key->last_subkey, index );
+}
+
 /* return the wow64 variant of the key, or the key itself if none */
 static struct key *find_wow64_subkey( struct key *key, const struct unicode_str *name )
 {
@@ -683,14 +889,90 @@ static struct key *open_key_prefix( struct key *key, const struct unicode_str *n
     return key;
 }
 
+static unsigned int get_key_cache_flags( unsigned int access, unsigned int attributes )
+{
+    return (access & (KEY_WOW64_32KEY | KEY_WOW64_64KEY)) | (attributes & OBJ_OPENLINK);
+}
+
+static struct key_cache_entry *get_key_cache_entry( const struct key *parent,
+                                                    const struct unicode_str *name, unsigned int *hash )
+{
+    data_size_t i;
+
+    *hash = 2166136261u ^ (unsigned int)(unsigned long)parent;
+    for (i = 0; i < name->len / sizeof(WCHAR); i++) *hash = (*hash ^ tolowerW( name->str[i] )) * 16777619;
+    return &key_cache[*hash & (KEY_CACHE_SIZE - 1)];
+}
+
+/* look up a key path in the cache */
+static struct key *find_cached_key( struct key *parent, const struct unicode_str *name,
+                                    unsigned int access, unsigned int attributes )
+{
+    struct key_cache_entry *entry;
+    unsigned int hash;
+
+    entry = get_key_cache_entry( parent, name, &hash );
+    if (entry->generation == key_cache_generation && entry->hash == hash &&
+        entry->parent == parent && entry->len == name->len &&
+        entry->flags == get_key_cache_flags( access, attributes ) &&
+        !memicmpW( entry->path, name->str, name->len / sizeof(WCHAR) ))
+    {
+        key_cache_hits++;
+        return entry->key;
+    }
+    key_cache_misses++;
+    return NULL;
+}
+
+/* add a resolved key path to the cache */
+static void cache_key( struct key *parent, const struct unicode_str *name,
+                       unsigned int access, unsigned int attributes, struct key *key )
+{
+    struct key_cache_entry *entry;
+    unsigned int hash;
+    WCHAR *path;
+
+    entry = get_key_cache_entry( parent, name, &hash );
+    if (entry->len != name->len || !entry->path)
+    {
+        if (!(path = realloc( entry->path, name->len ))) return;
+        entry->path = path;
+    }
+    memcpy( entry->path, name->str, name->len );
+    entry->len        = name->len;
+    entry->parent     = parent;
+    entry->key        = key;
+    entry->hash       = hash;
+    entry->flags      = get_key_cache_flags( access, attributes );
+    entry->generation = key_cache_generation;
+}
+
+/* dump the key cache statistics */
+void dump_registry_cache(void)
+{
+    unsigned int total = key_cache_hits + key_cache_misses;
+
+    fprintf( stderr, "registry key cache: %u hits, %u misses (%u%% hit rate), %u invalidations\n",
+             key_cache_hits, key_cache_misses, total ? (unsigned int)(key_cache_hits * 100.0 / total) : 0,
+             key_cache_invalidations );
+}
+
 /* open a subkey */
 static struct key *open_key( struct key *key, const struct unicode_str *name, unsigned int access,
                              unsigned int attributes )
 {
     int index;
     struct unicode_str token;
+    struct key *parent = key;
 
-    if (!(key = open_key_prefix( key, name, access, &token, &index ))) return NULL;
+    if (name->len && (key = find_cached_key( parent, name, access, attributes )))
+    {
+        if (debug_level > 1) dump_operation( key, NULL, "Open" );
+        grab_object( key );
+        return key;
+    }
+
+    if (!(key = open_key_prefix( parent, name, access, &token, &index ))) return NULL;
 
     if (token.len)
     {
@@ -703,6 +985,7 @@ static struct key *open_key( struct key *key, const struct unicode_str *name, un
         set_error( STATUS_OBJECT_NAME_NOT_FOUND );
         return NULL;
     }
+    if (name->len) cache_key( parent, name, access, attributes, key );
     if (debug_level > 1) dump_operation( key, NULL, "Open" );
     grab_object( key );
     return key;
@@ -823,6 +1106,7 @@ static void enum_key( const struct key *key, int index, int info_class,
     data_size_t max_value = 0, max_data = 0;
     char *data;
 
+    load_hive_key( (struct key *)key );
     if (index != -1)  /* -1 means use the specified key directly */
     {
         if ((index < 0) || (index > key->last_subkey))
@@ -831,6 +1115,7 @@ static void enum_key( const struct key *key, int index, int info_class,
             return;
         }
         key = key->subkeys[index];
+        load_hive_key( (struct key *)key );
     }
 
     namelen = key->namelen;
@@ -910,6 +1195,7 @@ static int delete_key( struct key *key, int recurse )
     }
     assert( parent );
 
+    load_hive_key( key );
     while (recurse && (key->last_subkey>=0))
         if (0 > delete_key(key->subkeys[key->last_subkey], 1))
             return -1;
@@ -926,6 +1212,9 @@ static int delete_key( struct key *key, int recurse )
     }
 
     if (debug_level > 1) dump_operation( key, NULL, "Delete" );
+    /* the watchers of the key itself won't see any further change */
+    check_notify( key, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_ATTRIBUTES |
+                  REG_NOTIFY_CHANGE_LAST_SET | REG_NOTIFY_CHANGE_SECURITY, 1 );
     free_subkey( parent, index );
     touch_key( parent, REG_NOTIFY_CHANGE_NAME );
     return 0;
@@ -956,14 +1245,51 @@ static int grow_values( struct key *key )
     return 1;
 }
 
-/* find the named value of a given key and return its index in the array */
-static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index )
+/* compare the names of two values */
+static inline int compare_value_names( const struct key_value *value1, const struct key_value *value2 )
+{
+    data_size_t len = min( value1->namelen, value2->namelen );
+    int res = memicmpW( value1->name, value2->name, len / sizeof(WCHAR) );
+    if (!res) res = value1->namelen - value2->namelen;
+    return res;
+}
+
+/* merge the pending values into the sorted part of the array, like merge_subkeys */
+static void merge_values( struct key *key )
 {
-    int i, min, max, res;
+    struct key_value *pending;
+    int min, max, pos, count = key->pending_values;
+    int last = key->last_value - count;
+
+    if (!count) return;
+    if (!(pending = malloc( count * sizeof(*pending) ))) return;
+    memcpy( pending, key->values + last + 1, count * sizeof(*pending) );
+    while (count--)
+    {
+        min = 0;
+        max = last;
+        while (min <= max)
+        {
+            pos = (min + max) / 2;
+            if (compare_value_names( &key->values[pos], &pending[count] ) > 0) max = pos - 1;
+            else min = pos + 1;
+        }
+        memmove( key->values + min + count + 1, key->values + min,
+                 (last + 1 - min) * sizeof(*pending) );
+        key->values[min + count] = pending[count];
+        last = min - 1;
+    }
+    free( pending );
+    key->pending_values = 0;
+}
+
+/* find the named value in a sorted range of the values array */
+static struct key_value *search_values( const struct key *key, const struct unicode_str *name,
+                                        int min, int max, int *index )
+{
+    int i, res;
     data_size_t len;
 
-    min = 0;
-    max = key->last_value;
     while (min <= max)
     {
         i = (min + max) / 2;
@@ -982,12 +1308,26 @@ static struct key_value *find_value( const struct key *key, const struct unicode
     return NULL;
 }
 
+/* find the named value of a given key and return its index in the array */
+static struct key_value *find_value( const struct key *key, const struct unicode_str *name, int *index )
+{
+    struct key_value *value;
+    int start;
+
+    load_hive_key( (struct key *)key );
+    start = key->last_value + 1 - key->pending_values;
+    if ((value = search_values( key, name, 0, start - 1, index ))) return value;
+    if (!use_pending_run( key->pending_values, key->last_value + 1 )) return NULL;
+    /* new values of wide keys are inserted into the pending run */
+    return search_values( key, name, start, key->last_value, index );
+}
+
 /* insert a new value; the index must have been returned by find_value */
 static struct key_value *insert_value( struct key *key, const struct unicode_str *name, int index )
 {
     struct key_value *value;
     WCHAR *new_name = NULL;
-    int i;
+    int i, pending = use_pending_run( key->pending_values, key->last_value + 1 );
 
     if (name->len > MAX_VALUE_LEN * sizeof(WCHAR))
     {
@@ -1005,6 +1345,12 @@ static struct key_value *insert_value( struct key *key, const struct unicode_str
     value->namelen = name->len;
     value->len     = 0;
     value->data    = NULL;
+    if (pending && pending_run_full( ++key->pending_values, key->last_value + 1 ))
+    {
+        merge_values( key );
+        find_value( key, name, &index );
+        value = &key->values[index];
+    }
     return value;
 }
 
@@ -1052,6 +1398,7 @@ static void set_value( struct key *key, const struct unicode_str *name,
     value->type  = type;
     value->len   = len;
     value->data  = ptr;
+    if (key->flags & KEY_SYMLINK) invalidate_key_cache();
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
     if (debug_level > 1) dump_operation( key, value, "Set" );
 }
@@ -1081,6 +1428,7 @@ static void enum_value( struct key *key, int i, int info_class, struct enum_key_
 {
     struct key_value *value;
 
+    load_hive_key( key );
     if (i < 0 || i > key->last_value) set_error( STATUS_NO_MORE_ENTRIES );
     else
     {
@@ -1141,8 +1489,10 @@ static void delete_value( struct key *key, const struct unicode_str *name )
     if (debug_level > 1) dump_operation( key, value, "Delete" );
     free( value->name );
     free( value->data );
+    if (index > key->last_value - key->pending_values) key->pending_values--;
     for (i = index; i < key->last_value; i++) key->values[i] = key->values[i + 1];
     key->last_value--;
+    if (key->flags & KEY_SYMLINK) invalidate_key_cache();
     touch_key( key, REG_NOTIFY_CHANGE_LAST_SET );
 
     /* try to shrink the array */
@@ -1269,6 +1619,66 @@ static int get_data_type( const char *buffer, int *type, int *parse_type )
     return 0;
 }
 
+/* create a key path from the input file; the keys along the previous path are
+ * kept in info, so that the common leading elements don't need to be looked up
+ * again, since consecutive keys in a file are usually siblings or children */
+static struct key *load_key_path( struct key *base, const struct unicode_str *name,
+                                  timeout_t modif, struct file_load_info *info )
+{
+    struct unicode_str token;
+    struct key *key = base;
+    WCHAR *path;
+    data_size_t i, common = 0;
+    data_size_t len = name->len / sizeof(WCHAR), prev_len = info->path_len / sizeof(WCHAR);
+    int depth = 0;
+
+    /* find the length of the leading path elements shared with the previous key */
+    for (i = 0; i < min( len, prev_len ); i++)
+    {
+        if (tolowerW( name->str[i] ) != tolowerW( info->path[i] )) break;
+        if (name->str[i] == '\\') common = i;
+    }
+    if ((i == len || name->str[i] == '\\') && (i == prev_len || info->path[i] == '\\')) common = i;
+    info->path_len = 0;
+
+    token.str = NULL;
+    if (!get_path_token( name, &token )) return NULL;
+    while (token.len && token.str + token.len / sizeof(WCHAR) <= name->str + common &&
+           depth < info->depth && !(info->keys[depth]->flags & KEY_SYMLINK))
+    {
+        key = info->keys[depth++];
+        get_path_token( name, &token );
+    }
+    while (info->depth > depth) release_object( info->keys[--info->depth] );
+
+    while (token.len)
+    {
+        if (info->depth == info->max_depth)
+        {
+            int new_depth = max( 16, info->max_depth * 2 );
+            struct key **new_keys = realloc( info->keys, new_depth * sizeof(*new_keys) );
+            if (!new_keys)
+            {
+                set_error( STATUS_NO_MEMORY );
+                return NULL;
+            }
+            info->keys = new_keys;
+            info->max_depth = new_depth;
+        }
+        if (!(key = create_key_recursive( key, &token, modif ))) return NULL;
+        info->keys[info->depth++] = key;
+        get_path_token( name, &token );
+    }
+
+    if ((path = realloc( info->path, name->len )))
+    {
+        memcpy( path, name->str, name->len );
+        info->path = path;
+        info->path_len = name->len;
+    }
+    return (struct key *)grab_object( key );
+}
+
 /* load and create a key from the input file */
 static struct key *load_key( struct key *base, const char *buffer,
                              int prefix_len, struct file_load_info *info )
@@ -1306,7 +1716,7 @@ static struct key *load_key( struct key *base, const char *buffer,
     }
     name.str = p;
     name.len = len - (p - info->tmp + 1) * sizeof(WCHAR);
-    return create_key_recursive( base, &name, modif );
+    return load_key_path( base, &name, modif, info );
 }
 
 /* load a global option from the input file */
@@ -1525,6 +1935,11 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     info.len    = 4;
     info.tmplen = 4;
     info.line   = 0;
+    info.path   = NULL;
+    info.path_len = 0;
+    info.keys   = NULL;
+    info.depth  = 0;
+    info.max_depth = 0;
     if (!(info.buffer = mem_alloc( info.len ))) return;
     if (!(info.tmp = mem_alloc( info.tmplen )))
     {
@@ -1570,7 +1985,11 @@ static void load_keys( struct key *key, const char *filename, FILE *f, int prefi
     }
 
  done:
+    invalidate_key_cache();  /* the file may have changed links of existing keys */
     if (subkey) release_object( subkey );
+    while (info.depth) release_object( info.keys[--info.depth] );
+    free( info.keys );
+    free( info.path );
     free( info.buffer );
     free( info.tmp );
 }
@@ -1596,13 +2015,171 @@ static void load_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* get the name of the hive cache of a registry file */
+static char *get_hive_cache_name( const char *filename )
+{
+    char *name = malloc( strlen( filename ) + sizeof(".cache") );
+
+    if (name) sprintf( name, "%s.cache", filename );
+    return name;
+}
+
+/* get a pointer to an array in a hive cache, checking that it's inside the mapping */
+/* arrays of structures must be aligned, names and data are accessed as bytes */
+static const void *get_hive_data( const struct hive_cache *cache, unsigned int offset,
+                                  unsigned int count, unsigned int size )
+{
+    if (size > 1 && (offset & 7)) return NULL;
+    if (offset > cache->size || (cache->size - offset) / size < count) return NULL;
+    return cache->base + offset;
+}
+
+/* create the subkeys and values of a key that are still in the hive cache */
+static void load_hive_key( struct key *key )
+{
+    const struct hive_cache *cache = key->hive;
+    const struct hive_key *node, *subnode;
+    const struct hive_value *values;
+    const unsigned int *subkeys;
+    const void *name, *data;
+    struct unicode_str str;
+    struct key *subkey;
+    unsigned int i;
+
+    if (!cache) return;
+    key->hive = NULL;
+    if (!(node = get_hive_data( cache, key->hive_node, 1, sizeof(*node) ))) goto error;
+
+    if (node->nb_values)
+    {
+        if (!(values = get_hive_data( cache, node->values, node->nb_values, sizeof(*values) ))) goto error;
+        if (!(key->values = mem_alloc( max( node->nb_values, MIN_VALUES ) * sizeof(*key->values) ))) return;
+        key->nb_values = max( node->nb_values, MIN_VALUES );
+        for (i = 0; i < node->nb_values; i++)
+        {
+            struct key_value *value = &key->values[key->last_value + 1];
+
+            if (!(name = get_hive_data( cache, values[i].name, values[i].namelen, 1 ))) goto error;
+            if (!(data = get_hive_data( cache, values[i].data, values[i].len, 1 ))) goto error;
+            value->name    = NULL;
+            value->namelen = values[i].namelen;
+            value->type    = values[i].type;
+            value->len     = values[i].len;
+            value->data    = NULL;
+            if (value->namelen && !(value->name = memdup( name, value->namelen ))) return;
+            if (value->len && !(value->data = memdup( data, value->len )))
+            {
+                free( value->name );
+                return;
+            }
+            key->last_value++;
+        }
+    }
+
+    if (node->nb_subkeys)
+    {
+        if (!(subkeys = get_hive_data( cache, node->subkeys, node->nb_subkeys, sizeof(*subkeys) ))) goto error;
+        if (!(key->subkeys = mem_alloc( max( node->nb_subkeys, MIN_SUBKEYS ) * sizeof(*key->subkeys) ))) return;
+        key->nb_subkeys = max( node->nb_subkeys, MIN_SUBKEYS );
+        for (i = 0; i < node->nb_subkeys; i++)
+        {
+            if (!(subnode = get_hive_data( cache, subkeys[i], 1, sizeof(*subnode) ))) goto error;
+            if (!(name = get_hive_data( cache, subnode->name, subnode->namelen, 1 ))) goto error;
+            if (!(data = get_hive_data( cache, subnode->class, subnode->classlen, 1 ))) goto error;
+            str.str = name;
+            str.len = subnode->namelen;
+            if (!(subkey = alloc_key( &str, subnode->modif ))) return;
+            subkey->parent = key;
+            subkey->flags = subnode->flags & (KEY_SYMLINK | KEY_WOW64);
+            if (subnode->classlen && (subkey->class = memdup( data, subnode->classlen )))
+                subkey->classlen = subnode->classlen;
+            if (subnode->nb_subkeys || subnode->nb_values)
+            {
+                subkey->hive = (struct hive_cache *)cache;
+                subkey->hive_node = subkeys[i];
+            }
+            key->subkeys[++key->last_subkey] = subkey;
+        }
+    }
+    return;
+
+ error:
+    fprintf( stderr, "wineserver: corrupted registry cache for %s\n", cache->filename );
+}
+
+/* map the hive cache of a registry file as the contents of a key; return 0 if it's out of date */
+static int load_hive_cache( struct key *key, const char *filename )
+{
+    const struct hive_header *header;
+    const struct hive_key *node;
+    struct hive_cache *cache;
+    struct stat st, cache_st;
+    const void *class;
+    char *cache_name;
+    void *base;
+    int fd;
+
+    if (stat( filename, &st ) == -1) return 0;
+    if (!(cache_name = get_hive_cache_name( filename ))) return 0;
+    fd = open( cache_name, O_RDONLY );
+    free( cache_name );
+    if (fd == -1) return 0;
+    if (fstat( fd, &cache_st ) == -1 || cache_st.st_size < sizeof(*header) || cache_st.st_size > UINT_MAX)
+    {
+        close( fd );
+        return 0;
+    }
+    base = mmap( NULL, cache_st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close( fd );
+    if (base == MAP_FAILED) return 0;
+
+    header = base;
+    if (header->magic != HIVE_CACHE_MAGIC || header->version != HIVE_CACHE_VERSION) goto failed;
+    if (header->size != cache_st.st_size) goto failed;
+    if (header->reg_mtime != st.st_mtime || header->reg_size != st.st_size) goto failed;
+    if (header->prefix_type > PREFIX_64BIT) goto failed;
+    /* let the text file report a mismatched architecture */
+    if (header->prefix_type != PREFIX_UNKNOWN && prefix_type != PREFIX_UNKNOWN &&
+        header->prefix_type != prefix_type) goto failed;
+    if (!(cache = mem_alloc( sizeof(*cache) ))) goto failed;
+    cache->base = base;
+    cache->size = cache_st.st_size;
+    cache->filename = filename;
+    if (!(node = get_hive_data( cache, header->root, 1, sizeof(*node) )))
+    {
+        free( cache );
+        goto failed;
+    }
+
+    if (header->prefix_type != PREFIX_UNKNOWN) prefix_type = header->prefix_type;
+    key->flags |= node->flags & (KEY_SYMLINK | KEY_WOW64);
+    if (node->classlen && (class = get_hive_data( cache, node->class, node->classlen, 1 )))
+    {
+        free( key->class );
+        if ((key->class = memdup( class, node->classlen ))) key->classlen = node->classlen;
+        else key->classlen = 0;
+    }
+    key->hive = cache;
+    key->hive_node = header->root;
+    return 1;
+
+ failed:
+    munmap( base, cache_st.st_size );
+    return 0;
+}
+
 /* load one of the initial registry files */
 static int load_init_registry_from_file( const char *filename, struct key *key )
 {
+    struct timeval start, end;
+    int cached, found = 0;
     FILE *f;
 
-    if ((f = fopen( filename, "r" )))
+    gettimeofday( &start, NULL );
+    if ((cached = load_hive_cache( key, filename ))) found = 1;
+    else if ((f = fopen( filename, "r" )))
     {
+        found = 1;
         load_keys( key, filename, f, 0 );
         fclose( f );
         if (get_error() == STATUS_NOT_REGISTRY_FILE)
@@ -1611,13 +2188,20 @@ static int load_init_registry_from_file( const char *filename, struct key *key )
             return 1;
         }
     }
+    if (found && debug_level)
+    {
+        gettimeofday( &end, NULL );
+        fprintf( stderr, "wineserver: loaded %s%s in %ld ms\n", filename, cached ? " from cache" : "",
+                 (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000 );
+    }
+    if (found && !cached) save_hive_cache( key, filename );
 
     assert( save_branch_count < MAX_SAVE_BRANCH_INFO );
 
     save_branch_info[save_branch_count].path = filename;
     save_branch_info[save_branch_count++].key = (struct key *)grab_object( key );
     make_object_static( &key->obj );
-    return (f != NULL);
+    return found;
 }
 
 static WCHAR *format_user_registry_path( const SID *sid, struct unicode_str *path )
@@ -1792,6 +2376,150 @@ static void save_registry( struct key *key, obj_handle_t handle )
     }
 }
 
+/* allocate zeroed space in a hive cache being built and return its offset */
+static unsigned int hive_alloc( struct hive_buffer *buffer, data_size_t size, unsigned int align )
+{
+    unsigned int offset = (buffer->size + align - 1) & ~(align - 1);
+
+    if (buffer->error) return 0;
+    if (offset < buffer->size || size > UINT_MAX - offset)
+    {
+        buffer->error = 1;
+        return 0;
+    }
+    if (offset + size > buffer->alloc)
+    {
+        unsigned int new_alloc = max( offset + size, min( buffer->alloc, UINT_MAX / 2 ) * 2 );
+        char *new_data = realloc( buffer->data, new_alloc );
+
+        if (!new_data)
+        {
+            buffer->error = 1;
+            return 0;
+        }
+        buffer->data = new_data;
+        buffer->alloc = new_alloc;
+    }
+    memset( buffer->data + buffer->size, 0, offset + size - buffer->size );
+    buffer->size = offset + size;
+    return offset;
+}
+
+/* copy a name or some value data into a hive cache being built and return its offset */
+static unsigned int hive_add_data( struct hive_buffer *buffer, const void *data, data_size_t size )
+{
+    unsigned int offset;
+
+    if (!size) return 0;
+    if ((offset = hive_alloc( buffer, size, sizeof(WCHAR) ))) memcpy( buffer->data + offset, data, size );
+    return offset;
+}
+
+/* add a key and the subkeys that are saved to a hive cache being built */
+static unsigned int hive_add_key( struct hive_buffer *buffer, struct key *key )
+{
+    struct hive_key *node;
+    struct hive_value *value;
+    unsigned int offset, name, class, data, values, subkeys, subkey;
+    unsigned int count = 0, flags = key->flags & KEY_SYMLINK;
+    int i;
+
+    load_hive_key( key );
+    merge_values( key );
+    merge_subkeys( key );
+    offset  = hive_alloc( buffer, sizeof(*node), 8 );
+    name    = hive_add_data( buffer, key->name, key->namelen );
+    class   = hive_add_data( buffer, key->class, key->classlen );
+    values  = hive_alloc( buffer, (key->last_value + 1) * sizeof(*value), 8 );
+    for (i = 0; i <= key->last_value; i++)
+    {
+        unsigned int value_name = hive_add_data( buffer, key->values[i].name, key->values[i].namelen );
+
+        data = hive_add_data( buffer, key->values[i].data, key->values[i].len );
+        if (buffer->error) return 0;
+        value = (struct hive_value *)(buffer->data + values) + i;
+        value->name    = value_name;
+        value->namelen = key->values[i].namelen;
+        value->type    = key->values[i].type;
+        value->data    = data;
+        value->len     = key->values[i].len;
+    }
+    subkeys = hive_alloc( buffer, (key->last_subkey + 1) * sizeof(unsigned int), 8 );
+    for (i = 0; i <= key->last_subkey; i++)
+    {
+        if (key->subkeys[i]->flags & KEY_VOLATILE) continue;
+        subkey = hive_add_key( buffer, key->subkeys[i] );
+        if (buffer->error) return 0;
+        ((unsigned int *)(buffer->data + subkeys))[count++] = subkey;
+        if (is_wow6432node( key->subkeys[i]->name, key->subkeys[i]->namelen ) &&
+            !is_wow6432node( key->name, key->namelen ))
+            flags |= KEY_WOW64;
+    }
+    if (buffer->error) return 0;
+
+    node = (struct hive_key *)(buffer->data + offset);
+    node->modif      = key->modif;
+    node->flags      = flags;
+    node->namelen    = key->namelen;
+    node->classlen   = key->classlen;
+    node->name       = name;
+    node->class      = class;
+    node->subkeys    = subkeys;
+    node->nb_subkeys = count;
+    node->values     = values;
+    node->nb_values  = key->last_value + 1;
+    return offset;
+}
+
+/* write the hive cache of a registry branch that matches its saved text file */
+static void save_hive_cache( struct key *key, const char *path )
+{
+    struct hive_buffer buffer;
+    struct hive_header *header;
+    struct stat st;
+    char *cache_name, *tmp = NULL, *p;
+    unsigned int root, size;
+    int fd, ret = 0;
+
+    if (stat( path, &st ) == -1 || !S_ISREG( st.st_mode )) return;
+    if (!(cache_name = get_hive_cache_name( path ))) return;
+
+    buffer.data  = NULL;
+    buffer.size  = 0;
+    buffer.alloc = 0;
+    buffer.error = 0;
+    hive_alloc( &buffer, sizeof(*header), 8 );
+    root = hive_add_key( &buffer, key );
+    if (buffer.error) goto done;
+
+    header = (struct hive_header *)buffer.data;
+    header->reg_mtime   = st.st_mtime;
+    header->reg_size    = st.st_size;
+    header->magic       = HIVE_CACHE_MAGIC;
+    header->version     = HIVE_CACHE_VERSION;
+    header->size        = buffer.size;
+    header->root        = root;
+    header->prefix_type = prefix_type;
+
+    if (!(tmp = malloc( strlen( cache_name ) + 20 ))) goto done;
+    sprintf( tmp, "%s%lx.tmp", cache_name, (long)getpid() );
+    if ((fd = open( tmp, O_CREAT | O_TRUNC | O_WRONLY, 0666 )) == -1) goto done;
+    for (p = buffer.data, size = buffer.size; size; p += ret, size -= ret)
+    {
+        if ((ret = write( fd, p, size )) > 0) continue;
+        if (ret == -1 && errno == EINTR) ret = 0;
+        else break;
+    }
+    ret = !close( fd ) && !size;
+    if (ret) ret = !rename( tmp, cache_name );
+    if (!ret) unlink( tmp );
+
+ done:
+    free( buffer.data );
+    free( cache_name );
+    free( tmp );
+}
+
 /* save a registry branch to a file */
 static int save_branch( struct key *key, const char *path )
 {
@@ -1850,6 +2578,13 @@ static int save_branch( struct key *key, const char *path )
         dump_operation( key, NULL, "saving" );
     }
 
+    /* the hive cache doesn't match the file anymore once it's changed */
+    if ((p = get_hive_cache_name( path )))
+    {
+        unlink( p );
+        free( p );
+    }
+
     save_all_subkeys( key, f );
     ret = !fclose(f);
 
@@ -1862,10 +2597,107 @@ static int save_branch( struct key *key, const char *path )
 
 done:
     free( tmp );
-    if (ret) make_clean( key );
+    if (ret)
+    {
+        make_clean( key );
+        save_hive_cache( key, path );
+    }
     return ret;
 }
 
+#ifdef USE_PTRACE  /* other tracing mechanisms can't cope with SIGCHLD from unknown children */
+
+/* background save: the dirty branches are written by a forked child from its
+ * copy-on-write snapshot of the registry, so that the server doesn't stall */
+static pid_t save_child_pid;          /* pid of the saving child, 0 if none */
+static int save_child_fd = -1;        /* pipe where the child reports the saved branches */
+static unsigned int save_child_mask;  /* branches being saved by the child */
+
+/* collect the result of a background save; returns 0 if it's still in progress */
+static int finish_background_save( int wait )
+{
+    unsigned int i, saved = 0;
+    int ret;
+
+    if (!save_child_pid) return 1;
+    if (!wait)
+    {
+        struct pollfd pfd;
+
+        pfd.fd = save_child_fd;
+        pfd.events = POLLIN;
+        if (poll( &pfd, 1, 0 ) <= 0) return 0;
+    }
+    while ((ret = read( save_child_fd, &saved, sizeof(saved) )) == -1 && errno == EINTR);
+    if (ret != sizeof(saved)) saved = 0;  /* child died before reporting */
+    close( save_child_fd );
+    waitpid( save_child_pid, NULL, 0 );  /* may already have been reaped by the SIGCHLD handler */
+
+    for (i = 0; i < save_branch_count; i++)
+    {
+        if (!(save_child_mask & (1 << i)) || (saved & (1 << i))) continue;
+        fprintf( stderr, "wineserver: could not save registry branch to %s\n", save_branch_info[i].path );
+        make_dirty( save_branch_info[i].key );  /* try again next time */
+    }
+    save_child_pid = 0;
+    save_child_fd = -1;
+    save_child_mask = 0;
+    return 1;
+}
+
+/* start saving the dirty branches in a child process; returns 0 on failure */
+static int save_branches_in_background(void)
+{
+    unsigned int i, mask = 0, saved = 0;
+    int fds[2];
+    pid_t pid;
+
+    if (!finish_background_save( 0 )) return 1;  /* previous save still in progress */
+
+    for (i = 0; i < save_branch_count; i++)
+        if (save_branch_info[i].key->flags & KEY_DIRTY) mask |= 1 << i;
+    if (!mask) return 1;
+
+    if (pipe( fds ) == -1) return 0;
+    switch ((pid = fork()))
+    {
+    case -1:
+        close( fds[0] );
+        close( fds[1] );
+        return 0;
+    case 0:  /* child */
+        close( fds[0] );
+        for (i = 0; i < save_branch_count; i++)
+            if ((mask & (1 << i)) && save_branch( save_branch_info[i].key, save_branch_info[i].path ))
+                saved |= 1 << i;
+        _exit( write( fds[1], &saved, sizeof(saved) ) != sizeof(saved) );
+    }
+    close( fds[1] );
+    if (debug_level > 1) fprintf( stderr, "saving registry in process %d\n", (int)pid );
+
+    /* further changes will mark the keys dirty again */
+    for (i = 0; i < save_branch_count; i++)
+        if (mask & (1 << i)) make_clean( save_branch_info[i].key );
+    save_child_pid = pid;
+    save_child_fd = fds[0];
+    save_child_mask = mask;
+    return 1;
+}
+
+#else  /* USE_PTRACE */
+
+static int finish_background_save( int wait )
+{
+    return 1;
+}
+
+static int save_branches_in_background(void)
+{
+    return 0;
+}
+
+#endif  /* USE_PTRACE */
+
 /* periodic saving of the registry */
 static void periodic_save( void *arg )
 {
@@ -1873,8 +2705,9 @@ static void periodic_save( void *arg )
 
     if (fchdir( config_dir_fd ) == -1) return;
     save_timeout_user = NULL;
-    for (i = 0; i < save_branch_count; i++)
-        save_branch( save_branch_info[i].key, save_branch_info[i].path );
+    if (!save_branches_in_background())
+        for (i = 0; i < save_branch_count; i++)
+            save_branch( save_branch_info[i].key, save_branch_info[i].path );
     if (fchdir( server_dir_fd ) == -1) fatal_perror( "chdir to server dir" );
     set_periodic_save_timer();
 }
@@ -1891,6 +2724,7 @@ void flush_registry(void)
 {
     int i;
 
+    finish_background_save( 1 );
     if (fchdir( config_dir_fd ) == -1) return;
     for (i = 0; i < save_branch_count; i++)
     {
@@ -2004,6 +2838,7 @@ DECL_HANDLER(enum_key)
     if ((key = get_hkey_obj( req->hkey,
                              req->index == -1 ? KEY_QUERY_VALUE : KEY_ENUMERATE_SUB_KEYS )))
     {
+        if (req->index != -1) merge_subkeys( key );
         enum_key( key, req->index, req->info_class, reply );
         release_object( key );
     }
@@ -2055,6 +2890,7 @@ DECL_HANDLER(enum_key_value)
 
     if ((key = get_hkey_obj( req->hkey, KEY_QUERY_VALUE )))
     {
+        merge_values( key );
         enum_value( key, req->index, req->info_class, reply );
         release_object( key );
     }
@@ -178,6 +178,11 @@ static void sighup_callback(void)
 #ifdef DEBUG_OBJECTS
     dump_objects();
 #endif
+    if (debug_level)
+    {
+        dump_namespaces();
+        dump_registry_cache();
+    }
 }
 
 /* SIGTERM callback */
@@ -73,6 +73,11 @@ struct window
     rectangle_t      client_rect;     /* client rectangle (relative to parent client area) */
     struct region   *win_region;      /* region for shaped windows (relative to window rect) */
     struct region   *update_region;   /* update region (relative to window rect) */
+    struct region   *vis_cache;       /* cached visible region (relative to window) */
+    unsigned int     vis_flags;       /* DCX flags of the cached visible region */
+    unsigned int     vis_serial;      /* layout clock value of the cached visible region */
+    unsigned int     children_serial; /* layout clock value of the last change of the children */
+    struct window_index *child_index; /* spatial index of the children for hit-testing */
     unsigned int     style;           /* window style */
     unsigned int     ex_style;        /* window extended style */
     unsigned int     id;              /* window id */
@@ -98,6 +103,26 @@ struct window
 #define PAINT_NONCLIENT     0x04  /* needs WM_NCPAINT */
 #define PAINT_DELAYED_ERASE 0x08  /* still needs erase after WM_ERASEBKGND */
 
+/* grid of the children of a window, each cell listing the children overlapping it in Z-order */
+struct window_index
+{
+    unsigned int    serial;           /* layout serial the index was built for */
+    rectangle_t     extents;          /* bounding rectangle of the indexed children */
+    int             cols;             /* number of columns of the grid */
+    int             rows;             /* number of rows of the grid */
+    int             cell_width;       /* width of a cell */
+    int             cell_height;      /* height of a cell */
+    unsigned int   *cells;            /* start of each cell in the entries array */
+    struct window **entries;          /* children overlapping each cell */
+};
+
+#define INDEX_MIN_CHILDREN  64   /* don't bother indexing windows with fewer children */
+#define INDEX_MAX_CELLS     64   /* maximum number of cells in each direction */
+#define INDEX_MAX_OVERLAP   16   /* maximum average number of cells per child */
+
+/* incremented whenever the position, Z-order, style or shape of a window changes */
+static unsigned int layout_clock;
+
 /* growable array of user handles */
 struct user_handle_array
 {
@@ -160,6 +185,27 @@ static inline struct window *get_last_child( struct window *win )
     return ptr ? LIST_ENTRY( ptr, struct window, entry ) : NULL;
 }
 
+/* record a change in the layout of the children of a window */
+static inline void invalidate_children_layout( struct window *parent )
+{
+    parent->children_serial = ++layout_clock;
+}
+
+/* record a change of the position, Z-order, style or shape of a window */
+static inline void invalidate_layout( struct window *win )
+{
+    invalidate_children_layout( win->parent ? win->parent : win );
+}
+
+/* get the layout clock value of the last change that can affect the visible region of a window */
+static unsigned int get_layout_serial( const struct window *win )
+{
+    unsigned int serial = win->children_serial;
+
+    for ( ; win->parent; win = win->parent) serial = max( serial, win->parent->children_serial );
+    return serial;
+}
+
 /* link a window at the right place in the siblings list */
 static void link_window( struct window *win, struct window *previous )
 {
@@ -213,6 +259,7 @@ static void link_window( struct window *win, struct window *previous )
     }
 
     win->is_linked = 1;
+    invalidate_layout( win );
 }
 
 /* change the parent of a window (or unlink the window if the new parent is NULL) */
@@ -232,6 +279,7 @@ static int set_parent_window( struct window *win, struct window *parent )
 
     if (parent)
     {
+        if (win->parent) invalidate_layout( win );  /* the previous parent loses a child */
         win->parent = parent;
         link_window( win, WINPTR_TOP );
 
@@ -245,6 +293,7 @@ static int set_parent_window( struct window *win, struct window *parent )
         list_remove( &win->entry );  /* unlink it from the previous location */
         list_add_head( &win->parent->unlinked, &win->entry );
         win->is_linked = 0;
+        invalidate_layout( win );
     }
     return 1;
 }
@@ -461,6 +510,11 @@ static struct window *create_window( struct window *parent, struct window *owner
     win->last_active    = win->handle;
     win->win_region     = NULL;
     win->update_region  = NULL;
+    win->vis_cache      = NULL;
+    win->vis_flags      = 0;
+    win->vis_serial     = 0;
+    win->children_serial = 0;
+    win->child_index    = NULL;
     win->style          = 0;
     win->ex_style       = 0;
     win->id             = 0;
@@ -622,14 +676,21 @@ int is_window_transparent( user_handle_t window )
     return (win->ex_style & (WS_EX_LAYERED|WS_EX_TRANSPARENT)) == (WS_EX_LAYERED|WS_EX_TRANSPARENT);
 }
 
-/* check if point is inside the window */
-static inline int is_point_in_window( struct window *win, int x, int y )
+/* check if the window can be hit by a point at all */
+static inline int is_window_hittable( const struct window *win )
 {
     if (!(win->style & WS_VISIBLE)) return 0; /* not visible */
     if ((win->style & (WS_POPUP|WS_CHILD|WS_DISABLED)) == (WS_CHILD|WS_DISABLED))
         return 0;  /* disabled child */
     if ((win->ex_style & (WS_EX_LAYERED|WS_EX_TRANSPARENT)) == (WS_EX_LAYERED|WS_EX_TRANSPARENT))
         return 0;  /* transparent */
+    return 1;
+}
+
+/* check if point is inside the window */
+static inline int is_point_in_window( struct window *win, int x, int y )
+{
+    if (!is_window_hittable( win )) return 0;
     if (x < win->visible_rect.left || x >= win->visible_rect.right ||
         y < win->visible_rect.top || y >= win->visible_rect.bottom)
         return 0;  /* not in window */
@@ -662,50 +723,212 @@ static unsigned int get_children_windows( struct window *parent, atom_t atom, th
     return count;
 }
 
-/* find child of 'parent' that contains the given point (in parent-relative coords) */
-static struct window *child_window_from_point( struct window *parent, int x, int y )
+/* free the spatial index of the children of a window */
+static void free_window_index( struct window *win )
+{
+    if (!win->child_index) return;
+    free( win->child_index->cells );
+    free( win->child_index->entries );
+    free( win->child_index );
+    win->child_index = NULL;
+}
+
+/* get the range of index cells covered by a rectangle */
+static inline void get_index_cells( const struct window_index *index, const rectangle_t *rect,
+                                    int *left, int *top, int *right, int *bottom )
+{
+    *left   = (rect->left - index->extents.left) / index->cell_width;
+    *top    = (rect->top - index->extents.top) / index->cell_height;
+    *right  = min( (rect->right - 1 - index->extents.left) / index->cell_width, index->cols - 1 );
+    *bottom = min( (rect->bottom - 1 - index->extents.top) / index->cell_height, index->rows - 1 );
+}
+
+/* build the spatial index of the children of a window; return 0 if they are not worth indexing */
+static int build_window_index( struct window *parent, struct window_index *index )
 {
     struct window *ptr;
+    unsigned int i, count = 0, total = 0, nb_cells;
+    int x, y, left, top, right, bottom;
 
     LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
     {
-        if (!is_point_in_window( ptr, x, y )) continue;  /* skip it */
+        if (!is_window_hittable( ptr )) continue;
+        if (ptr->visible_rect.left >= ptr->visible_rect.right ||
+            ptr->visible_rect.top >= ptr->visible_rect.bottom) continue;
+        if (!count++) index->extents = ptr->visible_rect;
+        else
+        {
+            index->extents.left   = min( index->extents.left, ptr->visible_rect.left );
+            index->extents.top    = min( index->extents.top, ptr->visible_rect.top );
+            index->extents.right  = max( index->extents.right, ptr->visible_rect.right );
+            index->extents.bottom = max( index->extents.bottom, ptr->visible_rect.bottom );
+        }
+    }
+    if (count < INDEX_MIN_CHILDREN) return 0;
+
+    for (index->cols = 1; index->cols * index->cols < count && index->cols < INDEX_MAX_CELLS; index->cols++)
+        ;
+    index->rows = index->cols;
+    index->cell_width  = (index->extents.right - index->extents.left + index->cols - 1) / index->cols;
+    index->cell_height = (index->extents.bottom - index->extents.top + index->rows - 1) / index->rows;
+    nb_cells = index->cols * index->rows;
 
-        /* if window is minimized or disabled, return at once */
-        if (ptr->style & (WS_MINIMIZE|WS_DISABLED)) return ptr;
+    if (!(index->cells = calloc( nb_cells + 1, sizeof(*index->cells) ))) return 0;
 
-        /* if point is not in client area, return at once */
-        if (x < ptr->client_rect.left || x >= ptr->client_rect.right ||
-            y < ptr->client_rect.top || y >= ptr->client_rect.bottom)
-            return ptr;
+    /* count the children in each cell */
+    LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
+    {
+        if (!is_window_hittable( ptr )) continue;
+        if (ptr->visible_rect.left >= ptr->visible_rect.right ||
+            ptr->visible_rect.top >= ptr->visible_rect.bottom) continue;
+        get_index_cells( index, &ptr->visible_rect, &left, &top, &right, &bottom );
+        total += (right - left + 1) * (bottom - top + 1);
+        if (total > count * INDEX_MAX_OVERLAP) return 0;  /* too much overlap to be useful */
+        for (y = top; y <= bottom; y++)
+            for (x = left; x <= right; x++) index->cells[y * index->cols + x]++;
+    }
+
+    /* turn the counts into end offsets, then fill the cells backwards in reverse Z-order */
+    for (i = 1; i <= nb_cells; i++) index->cells[i] += index->cells[i - 1];
+    index->cells[nb_cells] = total;
+    if (!(index->entries = malloc( total * sizeof(*index->entries) ))) return 0;
+
+    LIST_FOR_EACH_ENTRY_REV( ptr, &parent->children, struct window, entry )
+    {
+        if (!is_window_hittable( ptr )) continue;
+        if (ptr->visible_rect.left >= ptr->visible_rect.right ||
+            ptr->visible_rect.top >= ptr->visible_rect.bottom) continue;
+        get_index_cells( index, &ptr->visible_rect, &left, &top, &right, &bottom );
+        for (y = top; y <= bottom; y++)
+            for (x = left; x <= right; x++)
+                index->entries[--index->cells[y * index->cols + x]] = ptr;
+    }
+    return 1;
+}
+
+/* get the children of 'parent' that may contain a point, in Z-order; return NULL if not indexed */
+static struct window **get_index_children( struct window *parent, int x, int y, unsigned int *count )
+{
+    struct window_index *index = parent->child_index;
+    unsigned int cell;
+
+    if (!index || index->serial != parent->children_serial)
+    {
+        if (!index)
+        {
+            /* check the number of children first to avoid allocating an index for small windows */
+            struct list *ptr = list_head( &parent->children );
+            for (cell = 0; ptr && cell < INDEX_MIN_CHILDREN; cell++) ptr = list_next( &parent->children, ptr );
+            if (cell < INDEX_MIN_CHILDREN) return NULL;
+            if (!(index = malloc( sizeof(*index) ))) return NULL;
+            parent->child_index = index;
+        }
+        else
+        {
+            free( index->cells );
+            free( index->entries );
+        }
+        index->cells = NULL;
+        index->entries = NULL;
+        index->serial = parent->children_serial;
+        if (!build_window_index( parent, index ))
+        {
+            free( index->cells );
+            free( index->entries );
+            index->cells = NULL;
+            index->entries = NULL;
+        }
+    }
+    if (!index->entries) return NULL;
+
+    *count = 0;
+    if (x < index->extents.left || x >= index->extents.right ||
+        y < index->extents.top || y >= index->extents.bottom)
+        return index->entries;  /* no child there */
+
+    cell = ((y - index->extents.top) / index->cell_height) * index->cols +
+           (x - index->extents.left) / index->cell_width;
+    *count = index->cells[cell + 1] - index->cells[cell];
+    return index->entries + index->cells[cell];
+}
+
+/* find the window containing the point (in parent-relative coords) inside a child that contains it */
+static struct window *child_window_from_point( struct window *parent, int x, int y );
+
+static struct window *window_from_point_in_child( struct window *child, int x, int y )
+{
+    /* if window is minimized or disabled, return at once */
+    if (child->style & (WS_MINIMIZE|WS_DISABLED)) return child;
+
+    /* if point is not in client area, return at once */
+    if (x < child->client_rect.left || x >= child->client_rect.right ||
+        y < child->client_rect.top || y >= child->client_rect.bottom)
+        return child;
+
+    return child_window_from_point( child, x - child->client_rect.left, y - child->client_rect.top );
+}
+
+/* find child of 'parent' that contains the given point (in parent-relative coords) */
+static struct window *child_window_from_point( struct window *parent, int x, int y )
+{
+    struct window *ptr, **children;
+    unsigned int i, count;
+
+    if ((children = get_index_children( parent, x, y, &count )))
+    {
+        for (i = 0; i < count; i++)
+            if (is_point_in_window( children[i], x, y ))
+                return window_from_point_in_child( children[i], x, y );
+        return parent;  /* not found any child */
+    }
 
-        return child_window_from_point( ptr, x - ptr->client_rect.left, y - ptr->client_rect.top );
+    LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
+    {
+        if (!is_point_in_window( ptr, x, y )) continue;  /* skip it */
+        return window_from_point_in_child( ptr, x, y );
     }
     return parent;  /* not found any child */
 }
 
+/* add a child that contains the given point and its own children containing it to the array */
+static int get_window_children_from_point( struct window *parent, int x, int y,
+                                           struct user_handle_array *array );
+
+static int add_child_from_point( struct window *child, int x, int y, struct user_handle_array *array )
+{
+    /* if point is in client area, and window is not minimized or disabled, check children */
+    if (!(child->style & (WS_MINIMIZE|WS_DISABLED)) &&
+        x >= child->client_rect.left && x < child->client_rect.right &&
+        y >= child->client_rect.top && y < child->client_rect.bottom)
+    {
+        if (!get_window_children_from_point( child, x - child->client_rect.left,
+                                             y - child->client_rect.top, array ))
+            return 0;
+    }
+
+    /* now add window to the array */
+    return add_handle_to_array( array, child->handle );
+}
+
 /* find all children of 'parent' that contain the given point */
 static int get_window_children_from_point( struct window *parent, int x, int y,
                                            struct user_handle_array *array )
 {
-    struct window *ptr;
+    struct window *ptr, **children;
+    unsigned int i, count;
 
-    LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
+    if ((children = get_index_children( parent, x, y, &count )))
     {
-        if (!is_point_in_window( ptr, x, y )) continue;  /* skip it */
-
-        /* if point is in client area, and window is not minimized or disabled, check children */
-        if (!(ptr->style & (WS_MINIMIZE|WS_DISABLED)) &&
-            x >= ptr->client_rect.left && x < ptr->client_rect.right &&
-            y >= ptr->client_rect.top && y < ptr->client_rect.bottom)
-        {
-            if (!get_window_children_from_point( ptr, x - ptr->client_rect.left,
-                                                 y - ptr->client_rect.top, array ))
+        for (i = 0; i < count; i++)
+            if (is_point_in_window( children[i], x, y ) && !add_child_from_point( children[i], x, y, array ))
                 return 0;
-        }
+        return 1;
+    }
 
-        /* now add window to the array */
-        if (!add_handle_to_array( array, ptr->handle )) return 0;
+    LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
+    {
+        if (!is_point_in_window( ptr, x, y )) continue;  /* skip it */
+        if (!add_child_from_point( ptr, x, y, array )) return 0;
     }
     return 1;
 }
@@ -869,19 +1092,33 @@ static inline void map_win_region_to_screen( struct window *win, struct region *
 }
 
 
+/* offset the coordinates of a rectangle */
+static inline void offset_rect( rectangle_t *rect, int offset_x, int offset_y )
+{
+    rect->left   += offset_x;
+    rect->top    += offset_y;
+    rect->right  += offset_x;
+    rect->bottom += offset_y;
+}
+
+
 /* clip all children of a given window out of the visible region */
 static struct region *clip_children( struct window *parent, struct window *last,
                                      struct region *region, int offset_x, int offset_y )
 {
     struct window *ptr;
     struct region *tmp = create_empty_region();
+    rectangle_t extents, rect;
 
     if (!tmp) return NULL;
+    get_region_extents( region, &extents );
+    offset_rect( &extents, -offset_x, -offset_y );
     LIST_FOR_EACH_ENTRY( ptr, &parent->children, struct window, entry )
     {
         if (ptr == last) break;
         if (!(ptr->style & WS_VISIBLE)) continue;
         if (ptr->ex_style & WS_EX_TRANSPARENT) continue;
+        if (!intersect_rect( &rect, &ptr->visible_rect, &extents )) continue;
         set_region_rect( tmp, &ptr->visible_rect );
         if (ptr->win_region && !intersect_window_region( tmp, ptr ))
         {
@@ -891,22 +1128,14 @@ static struct region *clip_children( struct window *parent, struct window *last,
         offset_region( tmp, offset_x, offset_y );
         if (!(region = subtract_region( region, region, tmp ))) break;
         if (is_region_empty( region )) break;
+        get_region_extents( region, &extents );
+        offset_rect( &extents, -offset_x, -offset_y );
     }
     free_region( tmp );
     return region;
 }
 
 
-/* offset the coordinates of a rectangle */
-static inline void offset_rect( rectangle_t *rect, int offset_x, int offset_y )
-{
-    rect->left   += offset_x;
-    rect->top    += offset_y;
-    rect->right  += offset_x;
-    rect->bottom += offset_y;
-}
-
-
 /* set the region to the client rect clipped by the window rect, in parent-relative coordinates */
 static void set_region_client_rect( struct region *region, struct window *win )
 {
@@ -926,7 +1155,7 @@ static inline struct window *get_top_clipping_window( struct window *win )
 
 
 /* compute the visible region of a window, in window coordinates */
-static struct region *get_visible_region( struct window *win, unsigned int flags )
+static struct region *compute_visible_region( struct window *win, unsigned int flags )
 {
     struct region *tmp = NULL, *region;
     int offset_x, offset_y;
@@ -1012,6 +1241,46 @@ error:
 }
 
 
+/* get the visible region of a window, reusing the last one if the window layout didn't change */
+static struct region *get_visible_region( struct window *win, unsigned int flags )
+{
+    struct region *region;
+
+    flags &= DCX_PARENTCLIP | DCX_WINDOW | DCX_CLIPCHILDREN;
+
+    if (win->vis_cache && win->vis_flags == flags && win->vis_serial >= get_layout_serial( win ))
+    {
+        if (!(region = create_empty_region())) return NULL;
+        if (!copy_region( region, win->vis_cache ))
+        {
+            free_region( region );
+            return NULL;
+        }
+        return region;
+    }
+
+    if (!(region = compute_visible_region( win, flags ))) return NULL;
+
+    if (!win->vis_cache && !(win->vis_cache = create_empty_region()))
+    {
+        clear_error();
+        return region;
+    }
+    if (copy_region( win->vis_cache, region ))
+    {
+        win->vis_flags  = flags;
+        win->vis_serial = layout_clock;
+    }
+    else
+    {
+        free_region( win->vis_cache );
+        win->vis_cache = NULL;
+        clear_error();
+    }
+    return region;
+}
+
+
 /* get the window class of a window */
 struct window_class* get_window_class( user_handle_t window )
 {
@@ -1551,8 +1820,11 @@ static void set_window_pos( struct window *win, struct window *previous,
             offset_rect( &child->visible_rect, new_size - old_size, 0 );
             offset_rect( &child->client_rect, new_size - old_size, 0 );
         }
+        if (old_size != new_size) invalidate_children_layout( win );
     }
 
+    invalidate_layout( win );
+
     /* reset cursor clip rectangle when the desktop changes size */
     if (win == win->desktop->top_window) win->desktop->cursor.clip = *window_rect;
 
@@ -1692,6 +1964,7 @@ static void set_window_region( struct window *win, struct region *region, int re
 
     if (win->win_region) free_region( win->win_region );
     win->win_region = region;
+    invalidate_layout( win );
 
     /* expose anything revealed by the change */
     if (old_vis_rgn && ((exposed_rgn = expose_window( win, &win->window_rect, old_vis_rgn ))))
@@ -1713,6 +1986,7 @@ void destroy_window( struct window *win )
     {
         struct region *vis_rgn = get_visible_region( win, DCX_WINDOW );
         win->style &= ~WS_VISIBLE;
+        invalidate_layout( win );
         if (vis_rgn)
         {
             struct region *exposed_rgn = expose_window( win, &win->window_rect, vis_rgn );
@@ -1738,6 +2012,7 @@ void destroy_window( struct window *win )
     free_user_handle( win->handle );
     destroy_properties( win );
     list_remove( &win->entry );
+    invalidate_layout( win );
     if (is_desktop_window(win))
     {
         struct desktop *desktop = win->desktop;
@@ -1748,6 +2023,8 @@ void destroy_window( struct window *win )
     detach_window_thread( win );
     if (win->win_region) free_region( win->win_region );
     if (win->update_region) free_region( win->update_region );
+    if (win->vis_cache) free_region( win->vis_cache );
+    free_window_index( win );
     if (win->class) release_class( win->class );
     free( win->text );
     memset( win, 0x55, sizeof(*win) + win->nb_extra_bytes - 1 );
@@ -1956,6 +2233,7 @@ DECL_HANDLER(set_window_info)
     if (req->flags & SET_WIN_USERDATA) win->user_data = req->user_data;
     if (req->flags & SET_WIN_EXTRA) memcpy( win->extra_bytes + req->extra_offset,
                                             &req->extra_value, req->extra_size );
+    if (req->flags & (SET_WIN_STYLE | SET_WIN_EXSTYLE)) invalidate_layout( win );
 
     /* changing window style triggers a non-client paint */
     if (req->flags & SET_WIN_STYLE) win->paint_flags |= PAINT_NONCLIENT;
@@ -2476,6 +2754,7 @@ DECL_HANDLER(update_window_zorder)
         {
             list_remove( &win->entry );
             list_add_before( &ptr->entry, &win->entry );
+            invalidate_layout( win );
         }
         break;
     }